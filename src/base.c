@@ -1,6 +1,6 @@
 /*
 
- src/base.c - default callbacks and exceptions.
+ src/base.c - default callbacks, exceptions and timers.
  
  ------------------------------------------------------------------------------
  
@@ -14,8 +14,10 @@
  
 */
 
+#define BSE_EXPOSE_MEMORY_MANAGER
 #include "base.h"
 #include <stdio.h> // fprintf
+#include <stdlib.h> // posix_memalign
 #include <string.h>
 #include <errno.h>
 #include <malloc.h>
@@ -30,6 +32,16 @@
 #   include <stdlib.h> // exit
 #endif
 
+#ifdef BSE_TIMING
+#   include <time.h> // clock_gettime
+#endif
+
+#ifdef BSE_ASYNC_EXCEPTIONS
+#   include <pthread.h>
+#   include <semaphore.h>
+#   include <sched.h> // sched_yield
+#endif
+
 int bse_quiet_exceptions = 0; // the test harness can set this to 1 to suppress
 
 
@@ -48,8 +60,55 @@ void bse_default_free(void *ptr, size_t size, void *arg)
 }
 
 
-void bse_print_exception
+void *bse_default_aligned_malloc(size_t size, size_t alignment, void *arg)
+{
+    UNUSED(arg);
+    
+#   ifdef BSE_WINDOWS
+        return _aligned_malloc(size, alignment);
+#   else
+        void *ptr = NULL;
+        if (alignment < sizeof(void *)) { alignment = sizeof(void *); }
+        if (posix_memalign(&ptr, alignment, size)) { return NULL; }
+        return ptr;
+#   endif
+}
+
+
+void bse_default_aligned_free(void *ptr, size_t size, size_t alignment, void *arg)
+{
+    UNUSED(size);
+    UNUSED(alignment);
+    UNUSED(arg);
+    
+#   ifdef BSE_WINDOWS
+        _aligned_free(ptr);
+#   else
+        free(ptr);
+#   endif
+}
+
+
+static void bse_errno_string(int errnum, char *buf, size_t size)
+{
+    if (!errnum)
+    {
+        snprintf(buf, size, "(no errno)");
+    }
+#   ifdef BSE_WINDOWS
+    else if (strerror_s(buf, size, errnum))
+#   else
+    else if (strerror_r(errnum, buf, size))
+#   endif
+    {
+        snprintf(buf, size, "(unknown errno)");
+    }
+}
+
+
+static void bse_write_exception
 (
+    FILE *stream,
     const char *type,
     const char *file,
     unsigned int line,
@@ -60,28 +119,64 @@ void bse_print_exception
     int detail
 )
 {
-    if (bse_quiet_exceptions) { return; }
     char errnobuf[256];
+    bse_errno_string(errnum, errnobuf, 256);
     
-    if (!errnum)
+    if (!msg)
     {
-        sprintf(errnobuf, "(no errno)");
+        fprintf
+        (
+            stream,
+            PROG_ID ": %s:%u %s: %s 'err_%s' at line %u\n"
+            "    (errno: %d, '%s')\n"
+            "    (detail: %d)\n",
+              file, line, func, type, label, line,
+              errnum, errnobuf,
+              detail
+        );
     }
     else
     {
-        strncpy(errnobuf, strerror(errnum), 256);
-        errnobuf[255] = '\0';
+        fprintf
+        (
+            stream,
+            PROG_ID ": %s:%u %s: %s 'err_%s' at line %u\n"
+            "    (errno: %d, '%s')\n"
+            "    (detail: '%s', %d)\n",
+              file, line, func, type, label, line,
+              errnum, errnobuf,
+              msg, detail
+        );
     }
     
+    fflush(stream);
+}
+
+
+static void bse_write_warning
+(
+    FILE *stream,
+    const char *type,
+    const char *file,
+    unsigned int line,
+    const char *func,
+    const char *msg,
+    int errnum,
+    int detail
+)
+{
+    char errnobuf[256];
+    bse_errno_string(errnum, errnobuf, 256);
+    
     if (!msg)
     {
         fprintf
         (
-            stderr,
-            PROG_ID ": %s:%u %s: %s 'err_%s' at line %u\n"
+            stream,
+            PROG_ID ": %s:%u %s: %s at line %u\n"
             "    (errno: %d, '%s')\n"
             "    (detail: %d)\n",
-              file, line, func, type, label, line,
+              file, line, func, type, line,
               errnum, errnobuf,
               detail
         );
@@ -90,20 +185,269 @@ void bse_print_exception
     {
         fprintf
         (
-            stderr,
-            PROG_ID ": %s:%u %s: %s 'err_%s' at line %u\n"
+            stream,
+            PROG_ID ": %s:%u %s: %s at line %u\n"
             "    (errno: %d, '%s')\n"
             "    (detail: '%s', %d)\n",
-              file, line, func, type, label, line,
+              file, line, func, type, line,
               errnum, errnobuf,
               msg, detail
         );
     }
     
-    fflush(stderr);
+    fflush(stream);
+}
+
+
+#ifdef BSE_ASYNC_EXCEPTIONS
+
+// A bounded multi-producer ring (after Dmitry Vyukov's queue), emptied by one
+// thread. A record is free to claim at position pos when its seq is pos, and
+// ready to write when its seq is pos + 1.
+
+typedef char bse_async_ring_power_of_two
+    [(BSE_ASYNC_EXCEPTIONS_RING & (BSE_ASYNC_EXCEPTIONS_RING - 1)) ? -1 : 1];
+
+typedef struct bse_async_record bse_async_record;
+
+struct bse_async_record
+{
+    size_t seq;
+    int exception; // or a warning
+    const char *type;
+    const char *file;
+    unsigned int line;
+    const char *func;
+    const char *label;
+    int has_msg;
+    int errnum;
+    int detail;
+    char msg[BSE_ASYNC_EXCEPTIONS_MSG];
+};
+
+static bse_async_record bse_async_ring[BSE_ASYNC_EXCEPTIONS_RING];
+static int bse_async_ready = 0; // ring initialised
+static size_t bse_async_head = 0; // next position to claim
+static size_t bse_async_tail = 0; // next position to write (thread only)
+static int bse_async_running = 0; // accepting records
+static int bse_async_stopping = 0; // every record is in the ring
+static int bse_async_writers = 0; // callers between checking running and publishing
+static unsigned long bse_async_dropped_count = 0;
+static FILE *bse_async_stream = NULL;
+static pthread_t bse_async_thread;
+static sem_t bse_async_wake;
+
+
+// Returns zero if the thread is not running, so the caller should write the
+// message itself.
+static int bse_async_push
+(
+    int exception,
+    const char *type,
+    const char *file,
+    unsigned int line,
+    const char *func,
+    const char *label,
+    const char *msg,
+    int errnum,
+    int detail
+)
+{
+    __atomic_fetch_add(&bse_async_writers, 1, __ATOMIC_SEQ_CST);
+    
+    if (!__atomic_load_n(&bse_async_running, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_sub(&bse_async_writers, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+    
+    size_t pos = __atomic_load_n(&bse_async_head, __ATOMIC_RELAXED);
+    bse_async_record *r;
+    
+    for (;;)
+    {
+        r = &bse_async_ring[pos & (BSE_ASYNC_EXCEPTIONS_RING - 1)];
+        size_t seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        ptrdiff_t diff = (ptrdiff_t) (seq - pos);
+        
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&bse_async_head, &pos, pos + 1, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { break; }
+        }
+        else if (diff < 0)
+        {
+            // full: count it rather than wait for the thread
+            __atomic_fetch_add(&bse_async_dropped_count, 1UL, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&bse_async_writers, 1, __ATOMIC_RELEASE);
+            return 1;
+        }
+        else
+        {
+            pos = __atomic_load_n(&bse_async_head, __ATOMIC_RELAXED);
+        }
+    }
+    
+    r->exception = exception;
+    r->type      = type;
+    r->file      = file;
+    r->line      = line;
+    r->func      = func;
+    r->label     = label;
+    r->has_msg   = (msg != NULL);
+    r->errnum    = errnum;
+    r->detail    = detail;
+    
+    if (msg)
+    {
+        strncpy(r->msg, msg, BSE_ASYNC_EXCEPTIONS_MSG);
+        r->msg[BSE_ASYNC_EXCEPTIONS_MSG - 1] = '\0';
+    }
+    
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&bse_async_writers, 1, __ATOMIC_RELEASE);
+    sem_post(&bse_async_wake);
+    
+    return 1;
+}
+
+
+static void bse_async_drain(unsigned long *reported)
+{
+    for (;;)
+    {
+        size_t pos = bse_async_tail;
+        bse_async_record *slot = &bse_async_ring[pos & (BSE_ASYNC_EXCEPTIONS_RING - 1)];
+        
+        // empty, or claimed but not yet published (whoever claimed it will
+        // wake us again)
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) { break; }
+        
+        bse_async_record r = *slot;
+        __atomic_store_n(&slot->seq, pos + BSE_ASYNC_EXCEPTIONS_RING, __ATOMIC_RELEASE);
+        bse_async_tail = pos + 1;
+        
+        if (r.exception)
+        {
+            bse_write_exception(bse_async_stream, r.type, r.file, r.line, r.func,
+                r.label, r.has_msg ? r.msg : NULL, r.errnum, r.detail);
+        }
+        else
+        {
+            bse_write_warning(bse_async_stream, r.type, r.file, r.line, r.func,
+                r.has_msg ? r.msg : NULL, r.errnum, r.detail);
+        }
+    }
+    
+    unsigned long dropped = __atomic_load_n(&bse_async_dropped_count, __ATOMIC_RELAXED);
+    if (dropped != *reported)
+    {
+        fprintf(bse_async_stream, PROG_ID ": %lu errors and warnings dropped\n",
+            dropped - *reported);
+        fflush(bse_async_stream);
+        *reported = dropped;
+    }
+}
+
+
+static void *bse_async_main(void *arg)
+{
+    UNUSED(arg);
+    unsigned long reported = 0;
+    
+    for (;;)
+    {
+        // read before draining, so that the last drain sees every record
+        int stopping = __atomic_load_n(&bse_async_stopping, __ATOMIC_ACQUIRE);
+        
+        bse_async_drain(&reported);
+        if (stopping) { break; }
+        
+        while (sem_wait(&bse_async_wake) && (errno == EINTR)) {}
+    }
+    
+    return NULL;
+}
+
+
+int bse_async_exceptions_start(FILE *stream)
+{
+    if (__atomic_load_n(&bse_async_running, __ATOMIC_ACQUIRE)) { return 0; }
+    
+    if (!bse_async_ready)
+    {
+        for (size_t i = 0; i < BSE_ASYNC_EXCEPTIONS_RING; i++)
+            { bse_async_ring[i].seq = i; }
+        bse_async_ready = 1;
+    }
+    
+    bse_async_stream = stream ? stream : stderr;
+    __atomic_store_n(&bse_async_stopping, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&bse_async_dropped_count, 0UL, __ATOMIC_RELAXED);
+    
+    if (sem_init(&bse_async_wake, 0, 0)) { return 0; }
+    
+    if (pthread_create(&bse_async_thread, NULL, bse_async_main, NULL))
+    {
+        sem_destroy(&bse_async_wake);
+        return 0;
+    }
+    
+    __atomic_store_n(&bse_async_running, 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+
+unsigned long bse_async_exceptions_stop(void)
+{
+    if (!__atomic_load_n(&bse_async_running, __ATOMIC_ACQUIRE)) { return 0; }
+    
+    // new messages are written synchronously; wait for the ones in flight
+    __atomic_store_n(&bse_async_running, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&bse_async_writers, __ATOMIC_SEQ_CST)) { sched_yield(); }
+    
+    __atomic_store_n(&bse_async_stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&bse_async_wake);
+    pthread_join(bse_async_thread, NULL);
+    sem_destroy(&bse_async_wake);
+    
+    return __atomic_load_n(&bse_async_dropped_count, __ATOMIC_RELAXED);
+}
+
+
+unsigned long bse_async_exceptions_dropped(void)
+{
+    return __atomic_load_n(&bse_async_dropped_count, __ATOMIC_RELAXED);
+}
+
+#endif
+
+
+void bse_print_exception
+(
+    const char *type,
+    const char *file,
+    unsigned int line,
+    const char *func,
+    const char *label,
+    const char *msg,
+    int errnum,
+    int detail
+)
+{
+    if (bse_quiet_exceptions) { return; }
+    
+#   ifdef BSE_ASYNC_EXCEPTIONS
+        if (bse_async_push(1, type, file, line, func, label, msg, errnum, detail))
+            { return; }
+#   endif
+    
+    bse_write_exception(stderr, type, file, line, func, label, msg, errnum, detail);
     
 #   ifdef BSE_GRAPHICAL_EXCEPTIONS
         char buf[4096];
+        char errnobuf[256];
+        bse_errno_string(errnum, errnobuf, 256);
         
         snprintf
         (
@@ -159,49 +503,18 @@ void bse_print_warning
 )
 {
     if (bse_quiet_exceptions) { return; }
-    char errnobuf[256];
     
-    if (!errnum)
-    {
-        sprintf(errnobuf, "(no errno)");
-    }
-    else
-    {
-        strncpy(errnobuf, strerror(errnum), 256);
-        errnobuf[255] = '\0';
-    }
-    
-    if (!msg)
-    {
-        fprintf
-        (
-            stderr,
-            PROG_ID ": %s:%u %s: %s at line %u\n"
-            "    (errno: %d, '%s')\n"
-            "    (detail: %d)\n",
-              file, line, func, type, line,
-              errnum, errnobuf,
-              detail
-        );
-    }
-    else
-    {
-        fprintf
-        (
-            stderr,
-            PROG_ID ": %s:%u %s: %s at line %u\n"
-            "    (errno: %d, '%s')\n"
-            "    (detail: '%s', %d)\n",
-              file, line, func, type, line,
-              errnum, errnobuf,
-              msg, detail
-        );
-    }
+#   ifdef BSE_ASYNC_EXCEPTIONS
+        if (bse_async_push(0, type, file, line, func, NULL, msg, errnum, detail))
+            { return; }
+#   endif
     
-    fflush(stderr);
+    bse_write_warning(stderr, type, file, line, func, msg, errnum, detail);
     
 #   ifdef BSE_GRAPHICAL_EXCEPTIONS
         char buf[4096];
+        char errnobuf[256];
+        bse_errno_string(errnum, errnobuf, 256);
         
         snprintf
         (
@@ -283,3 +596,130 @@ void bse_print_info
     
     fflush(stdout);
 }
+
+
+#ifdef BSE_TIMING
+
+static bse_timing_site *bse_timing_sites = NULL; // only ever pushed to
+
+
+unsigned long long bse_timing_now(void)
+{
+    struct timespec t;
+    if (clock_gettime(CLOCK_MONOTONIC, &t)) { return 0; }
+    return ((unsigned long long) t.tv_sec * 1000000000ULL)
+        + (unsigned long long) t.tv_nsec;
+}
+
+
+void bse_timing_record(bse_timing_site *site, unsigned long long ns)
+{
+    int expected = 0;
+    
+    // the first thread to time a site pushes it onto the list; sites are
+    // never removed, so a compare and swap on the head is enough
+    if ((!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+        && __atomic_compare_exchange_n(&site->registered, &expected, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        bse_timing_site *head = __atomic_load_n(&bse_timing_sites, __ATOMIC_ACQUIRE);
+        do { site->next = head; }
+        while (!__atomic_compare_exchange_n(&bse_timing_sites, &head, site, 1,
+            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+    
+    unsigned int bucket = 0;
+    for (unsigned long long i = ns; i > 1; i >>= 1) { bucket++; }
+    if (bucket >= BSE_TIMING_BUCKETS) { bucket = BSE_TIMING_BUCKETS - 1; }
+    
+    __atomic_fetch_add(&site->calls, 1ULL, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->total, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->buckets[bucket], 1ULL, __ATOMIC_RELAXED);
+    
+    unsigned long long max = __atomic_load_n(&site->max, __ATOMIC_RELAXED);
+    while ((ns > max) && !__atomic_compare_exchange_n(&site->max, &max, ns, 1,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+
+void bse_timing_end(bse_timing_scope *scope)
+{
+    unsigned long long now = bse_timing_now();
+    bse_timing_record(scope->site, (now > scope->start) ? now - scope->start : 0);
+}
+
+
+static void bse_timing_print_ns(FILE *stream, unsigned long long ns)
+{
+    if      (ns < 1000ULL)          { fprintf(stream, "%lluns", ns); }
+    else if (ns < 1000000ULL)       { fprintf(stream, "%lluus", ns / 1000ULL); }
+    else if (ns < 1000000000ULL)    { fprintf(stream, "%llums", ns / 1000000ULL); }
+    else                            { fprintf(stream, "%llus",  ns / 1000000000ULL); }
+}
+
+
+void bse_timing_report(FILE *stream)
+{
+    bse_timing_site *site = __atomic_load_n(&bse_timing_sites, __ATOMIC_ACQUIRE);
+    
+    fprintf(stream, PROG_ID ": timing report\n");
+    
+    for (; site; site = site->next)
+    {
+        unsigned long long calls = __atomic_load_n(&site->calls, __ATOMIC_RELAXED);
+        unsigned long long total = __atomic_load_n(&site->total, __ATOMIC_RELAXED);
+        unsigned long long max   = __atomic_load_n(&site->max,   __ATOMIC_RELAXED);
+        
+        fprintf(stream, "  %s (%s:%u)\n", site->name, site->file, site->line);
+        fprintf(stream, "    calls: %llu, total: ", calls);
+        bse_timing_print_ns(stream, total);
+        fprintf(stream, ", mean: ");
+        bse_timing_print_ns(stream, calls ? total / calls : 0);
+        fprintf(stream, ", max: ");
+        bse_timing_print_ns(stream, max);
+        fprintf(stream, "\n");
+        
+        for (unsigned int i = 0; i < BSE_TIMING_BUCKETS; i++)
+        {
+            unsigned long long n = __atomic_load_n(&site->buckets[i], __ATOMIC_RELAXED);
+            if (!n) { continue; }
+            
+            fprintf(stream, "    >= ");
+            bse_timing_print_ns(stream, i ? (1ULL << i) : 0);
+            fprintf(stream, ": %llu\n", n);
+        }
+    }
+    
+    fflush(stream);
+}
+
+
+void bse_timing_reset(void)
+{
+    bse_timing_site *site = __atomic_load_n(&bse_timing_sites, __ATOMIC_ACQUIRE);
+    
+    for (; site; site = site->next)
+    {
+        __atomic_store_n(&site->calls, 0ULL, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->total, 0ULL, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->max,   0ULL, __ATOMIC_RELAXED);
+        
+        for (unsigned int i = 0; i < BSE_TIMING_BUCKETS; i++)
+            { __atomic_store_n(&site->buckets[i], 0ULL, __ATOMIC_RELAXED); }
+    }
+}
+
+
+bse_timing_site *bse_timing_find(const char *name)
+{
+    bse_timing_site *site = __atomic_load_n(&bse_timing_sites, __ATOMIC_ACQUIRE);
+    
+    for (; site; site = site->next)
+    {
+        if (!strcmp(site->name, name)) { return site; }
+    }
+    
+    return NULL;
+}
+
+#endif
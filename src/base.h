@@ -53,6 +53,9 @@
  
  ------------------------------------------------------------------------------
  
+ 20261019: add asynchronous exceptions (BSE_ASYNC_EXCEPTIONS)
+ 20261019: add scoped timers (BSE_TIMING)
+ 20261019: add bse_default_aligned_malloc/free
  20140722: add bse_simple_memory_manager
  20140718: add PROGRAM_NAME and expanded comments
  20140716: add X4/W3
@@ -153,6 +156,10 @@
         // pointers, wrap to a standard malloc/free
         void *bse_default_malloc(size_t size, void *arg);
         void bse_default_free(void *ptr, size_t size, void *arg);
+        
+        // likewise for bse_aligned_memory_manager function pointers
+        void *bse_default_aligned_malloc(size_t size, size_t alignment, void *arg);
+        void bse_default_aligned_free(void *ptr, size_t size, size_t alignment, void *arg);
 #   endif
 
 
@@ -173,6 +180,11 @@
 #       endif
 #   endif
 
+    /* C++11 includes the features of C99 used here (e.g. __func__) */
+#   if defined(__cplusplus) && (__cplusplus >= 201103L) && (!defined(IS_C99))
+#       define IS_C99
+#   endif
+
 
     /* General minimum requirements */
 #   if (!defined(IS_C99))
@@ -404,4 +416,130 @@ void bse_print_info
 
 extern int bse_quiet_exceptions; // when set to 1, inhibits printing of errors
 
+
+/* Asynchronous exceptions
+ * -----------------------
+ * Compile with -DBSE_ASYNC_EXCEPTIONS for an optional background thread that
+ * formats and writes errors and warnings. While it runs, bse_print_exception
+ * and bse_print_warning copy their arguments into a fixed-size record in a
+ * lock-free ring buffer and return at once, so a storm of errors never blocks
+ * the thread that raises them. If the ring is full the message is dropped and
+ * counted, and the count is written once there is room again.
+ *
+ * The type, file, function and label are kept as pointers, so must be string
+ * literals (as they are in the X and W macros). The message is copied and may
+ * be truncated to BSE_ASYNC_EXCEPTIONS_MSG bytes.
+ */
+#   ifdef BSE_ASYNC_EXCEPTIONS
+#       ifndef BSE_LINUX
+#           error BSE_ASYNC_EXCEPTIONS requires you define BSE_LINUX
+#       endif
+#       include <stdio.h> // FILE *
+
+#       ifndef BSE_ASYNC_EXCEPTIONS_RING
+#           define BSE_ASYNC_EXCEPTIONS_RING 1024 // records; a power of two
+#       endif
+#       ifndef BSE_ASYNC_EXCEPTIONS_MSG
+#           define BSE_ASYNC_EXCEPTIONS_MSG 128
+#       endif
+
+        // Start the background thread, writing to a stream (NULL for stderr).
+        // Returns zero on failure or if it is already running. Call from one
+        // thread only, as with bse_async_exceptions_stop.
+        int bse_async_exceptions_start(FILE *stream);
+
+        // Write every message already queued and stop the background thread.
+        // Later messages are written synchronously again. Returns the number
+        // of messages dropped since the thread was started.
+        unsigned long bse_async_exceptions_stop(void);
+
+        // The number of messages dropped since the thread was started
+        unsigned long bse_async_exceptions_dropped(void);
+#   endif
+
+
+/* ================================ Timing =================================== */
+
+/*
+ * Compile with -DBSE_TIMING to turn on scoped timers. Otherwise they compile
+ * to nothing.
+ *
+ * T_SCOPE(name)
+ *  -- time from here to the end of the enclosing block, however it is left
+ *     (including by return or goto), accumulated into a timing site called
+ *     name. Use it before any statement that may jump out of the block.
+ *
+ * Each site is a static record that joins a global list the first time it is
+ * timed. Sites are updated with atomic operations, so timing is safe from any
+ * thread and takes no locks. Times are from clock_gettime(CLOCK_MONOTONIC),
+ * in nanoseconds. bse_timing_report prints, for every site, the number of
+ * calls, the total and mean time, and a histogram with a bucket per power of
+ * two nanoseconds.
+ */
+
+#   ifdef T_SCOPE
+#       error T_SCOPE already defined
+#   endif
+
+#   ifdef BSE_TIMING
+#       ifndef BSE_LINUX
+#           error BSE_TIMING requires you define BSE_LINUX
+#       endif
+#       ifndef __GNUC__
+#           error BSE_TIMING requires GNUC (for __attribute__((cleanup)))
+#       endif
+#       include <stdio.h> // FILE *
+
+#       define BSE_TIMING_BUCKETS 40 // [2^k, 2^(k+1)) ns; the last is open
+
+        typedef struct bse_timing_site  bse_timing_site;
+        typedef struct bse_timing_scope bse_timing_scope;
+
+        struct bse_timing_site
+        {
+            const char *name;
+            const char *file;
+            unsigned int line;
+            int registered;
+            bse_timing_site *next;
+            unsigned long long calls;
+            unsigned long long total; // ns
+            unsigned long long max; // ns
+            unsigned long long buckets[BSE_TIMING_BUCKETS];
+        };
+
+        struct bse_timing_scope
+        {
+            bse_timing_site *site;
+            unsigned long long start;
+        };
+
+#       define T_SCOPE(name) \
+            static bse_timing_site bse_timing_site_##name = \
+                { __STRING(name), __FILE__, __LINE__, 0, NULL, 0, 0, 0, {0} }; \
+            bse_timing_scope bse_timing_scope_##name \
+                __attribute__((cleanup(bse_timing_end))) = \
+                { &bse_timing_site_##name, bse_timing_now() };
+
+        // Monotonic time in nanoseconds
+        unsigned long long bse_timing_now(void);
+
+        // Add one call of a given duration to a site
+        void bse_timing_record(bse_timing_site *site, unsigned long long ns);
+
+        // Called at the end of the scope of T_SCOPE
+        void bse_timing_end(bse_timing_scope *scope);
+
+        // Print every site that has been timed to a stream
+        void bse_timing_report(FILE *stream);
+
+        // Zero the counts of every site
+        void bse_timing_reset(void);
+
+        // Return the first site that has been timed with a given name, or NULL
+        bse_timing_site *bse_timing_find(const char *name);
+#   else
+#       define T_SCOPE(name)
+#   endif
+
 #endif // BASE_H
@@ -0,0 +1,154 @@
+/*
+ * Benchmark comparing transition table layouts (unaligned, cache-line aligned
+ * and frozen sparse) under batch dispatch workloads: a population of elements
+ * driven by a stream of random events.
+ *
+ * Usage: bench-linux64 [EVENTS]
+ */
+
+// Public Domain BSAG 2014
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h"
+#include "state-machine/state-machine.h"
+#include "state-machine/population.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h> // clock_gettime
+#include <assert.h>
+
+#define NUM_ELEMENTS 65536u
+#define BATCH        4096u
+
+
+static unsigned int rng_state = 1;
+
+static unsigned int rng(void)
+{
+    // xorshift32
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + ((double) t.tv_nsec * 1e-9);
+}
+
+
+// fill a machine with states 1..states and a random, fairly dense table
+static void fill(state_machine *m, unsigned int states, unsigned int actions, unsigned int seed)
+{
+    rng_state = seed;
+    
+    for (unsigned int i = 1; i <= states; i++)
+        { assert(state_machine_add_state(m, i)); }
+    
+    for (unsigned int i = 1; i <= states; i++)
+    {
+        for (unsigned int a = 0; a < actions; a++)
+        {
+            if ((rng() & 3) == 0) { continue; }
+            assert(state_machine_add_transition(m, a, i, 1 + (rng() % states)));
+        }
+    }
+}
+
+
+static size_t sink; // keeps the results of each run live
+
+
+static double run(state_machine *m, const state_machine_event *events, size_t n)
+{
+    state_machine_population *p = state_machine_population_new(m, NUM_ELEMENTS, 1);
+    assert(p);
+    
+    size_t taken = 0;
+    double start = now();
+    
+    for (size_t i = 0; i < n; i += BATCH)
+    {
+        size_t batch = ((n - i) < BATCH) ? (n - i) : BATCH;
+        taken += state_machine_population_dispatch(p, events + i, batch);
+    }
+    
+    double elapsed = now() - start;
+    
+    state_machine_population_free(p);
+    
+    sink += taken;
+    return elapsed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = 20000000;
+    if (argc >= 2) { n = (size_t) strtoul(argv[1], NULL, 10); }
+    
+    static const unsigned int shapes[][2] =
+    {
+        // states, actions
+        {   32,  14 },
+        { 4096,  14 },
+        { 4096, 100 },
+        {65536,  30 }
+    };
+    
+    printf("%8s %8s %14s %14s %14s\n",
+           "states", "actions", "unaligned ns", "aligned ns", "sparse ns");
+    
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        unsigned int states  = shapes[s][0];
+        unsigned int actions = shapes[s][1];
+        
+        state_machine *u = state_machine_new(states, actions);
+        state_machine *a = state_machine_new_aligned(states, actions, NULL);
+        assert(u && a);
+        
+        fill(u, states, actions, 12345);
+        fill(a, states, actions, 12345);
+        
+        state_machine *sp = state_machine_freeze(u, STATE_MACHINE_LAYOUT_SPARSE);
+        assert(sp);
+        
+        state_machine_event *events = malloc(sizeof(state_machine_event) * n);
+        assert(events);
+        
+        rng_state = 777;
+        for (size_t i = 0; i < n; i++)
+        {
+            events[i].element = rng() % NUM_ELEMENTS;
+            events[i].action  = rng() % actions;
+        }
+        
+        run(u, events, n / 10); // warm up
+        
+        double tu = run(u, events, n);
+        double ta = run(a, events, n);
+        double ts = run(sp, events, n);
+        
+        printf("%8u %8u %14.2f %14.2f %14.2f\n", states, actions,
+               (tu * 1e9) / (double) n, (ta * 1e9) / (double) n,
+               (ts * 1e9) / (double) n);
+        
+        free(events);
+        state_machine_free(sp);
+        state_machine_free(a);
+        state_machine_free(u);
+    }
+    
+    printf("(%lu transitions)\n", (unsigned long) sink);
+    
+#   ifdef BSE_TIMING
+        bse_timing_report(stdout);
+#   endif
+    
+    return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * Command-line driver that runs a stream of actions through a model and
+ * reports the final states, the number of events that found each element in
+ * each state (dwell counts), and throughput.
+ *
+ * Usage: cli-linux64 [-b | -m MODEL] [-n ELEMENTS] [-i INITIAL] [-s SAVE] [STREAM]
+ *
+ *   -b           use the built-in GUI button model (the default)
+ *   -m MODEL     load a model written by state_machine_save
+ *   -n ELEMENTS  number of elements driven by the stream (default 1)
+ *   -i INITIAL   initial state ID of every element (default: the button's
+ *                default state with -b; with -m, the model's state index 0,
+ *                as a model file does not record an initial state. For a
+ *                saved button model that is a disabled state rather than
+ *                STATE_GUI_BUTTON_DEFAULT, so pass -i.)
+ *   -s SAVE      also save the model to a file, e.g. to make a model file
+ *   STREAM       file of events, memory mapped; reads stdin if omitted or "-"
+ *
+ * The stream is text with one event per line, either "ACTION" (applied to
+ * element 0) or "ELEMENT ACTION", in decimal. Blank lines are ignored.
+ */
+
+// Public Domain BSAG 2014
+
+#include "base.h"
+#include "state-machine/state-machine.h"
+#include "state-machine/models/gui.h"
+#include <stdio.h>
+#include <stdlib.h> // strtoul
+#include <string.h> // strcmp
+#include <time.h> // clock_gettime
+#include <fcntl.h> // open
+#include <unistd.h> // read, close
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+
+#define READ_CHUNK (1u << 20)
+
+
+typedef struct run
+{
+    state_machine *m;
+    unsigned int elements;
+    unsigned int actions;
+    unsigned int *state; // index of each element
+    unsigned long long *dwell; // events seen by elements in each state
+    
+    unsigned long long events;
+    unsigned long long transitions;
+    unsigned long long bytes;
+    
+    // parser state, kept between chunks of input
+    unsigned long long line;
+    unsigned long long value[2];
+    unsigned int values;
+    int digits;
+    int failed;
+} run;
+
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + ((double) t.tv_nsec * 1e-9);
+}
+
+
+static void fail(run *r, const char *msg)
+{
+    if (!r->failed) { fprintf(stderr, "line %llu: %s\n", r->line + 1, msg); }
+    r->failed = 1;
+}
+
+
+static void end_value(run *r)
+{
+    if (!r->digits) { return; }
+    
+    r->digits = 0;
+    r->values++;
+    
+    if (r->values > 2) { fail(r, "expected ACTION or ELEMENT ACTION"); }
+}
+
+
+static void end_line(run *r)
+{
+    end_value(r);
+    
+    if (r->values && !r->failed)
+    {
+        unsigned long long element = (r->values == 2) ? r->value[0] : 0;
+        unsigned long long action  = r->value[r->values - 1];
+        
+        if (element >= r->elements) { fail(r, "invalid element"); return; }
+        if (action >= r->actions)   { fail(r, "invalid action"); return; }
+        
+        unsigned int from = r->state[element];
+        unsigned int to = state_machine_take_action_index(r->m, from, (unsigned int) action);
+        
+        r->dwell[from]++;
+        r->events++;
+        
+        if (to != STATE_MACHINE_INVALID)
+        {
+            r->state[element] = to;
+            r->transitions++;
+        }
+    }
+    
+    r->values = 0;
+    r->value[0] = r->value[1] = 0;
+    r->line++;
+}
+
+
+static void feed(run *r, const unsigned char *data, size_t size)
+{
+    r->bytes += size;
+    
+    for (size_t i = 0; (i < size) && !r->failed; i++)
+    {
+        unsigned int c = data[i];
+        
+        if ((c >= '0') && (c <= '9'))
+        {
+            if (r->values >= 2) { fail(r, "expected ACTION or ELEMENT ACTION"); break; }
+            
+            unsigned long long *v = &r->value[r->values];
+            *v = (*v * 10) + (c - '0');
+            if (*v > 0xFFFFFFFFull) { fail(r, "number too large"); break; }
+            
+            r->digits = 1;
+        }
+        else if (c == '\n')                            { end_line(r); }
+        else if ((c == ' ') || (c == '\t') || (c == '\r')) { end_value(r); }
+        else                                           { fail(r, "unexpected character"); }
+    }
+}
+
+
+// memory map a regular file, or read from a pipe in large chunks
+static int feed_file(run *r, const char *path)
+{
+    int fd = 0;
+    
+    if (path && strcmp(path, "-"))
+    {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) { perror(path); return 0; }
+        
+        struct stat info;
+        if ((fstat(fd, &info) == 0) && S_ISREG(info.st_mode) && (info.st_size > 0))
+        {
+            size_t size = (size_t) info.st_size;
+            void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            
+            if (data != MAP_FAILED)
+            {
+                posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+                feed(r, data, size);
+                munmap(data, size);
+                close(fd);
+                
+                return 1;
+            }
+        }
+    }
+    
+    unsigned char *chunk = malloc(READ_CHUNK);
+    if (!chunk) { perror("malloc"); return 0; }
+    
+    ssize_t got;
+    while ((got = read(fd, chunk, READ_CHUNK)) > 0) { feed(r, chunk, (size_t) got); }
+    if (got < 0) { perror(path ? path : "stdin"); }
+    
+    free(chunk);
+    if (fd) { close(fd); }
+    
+    return (got == 0);
+}
+
+
+static void *load_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror(path); return NULL; }
+    
+    unsigned char *data = NULL;
+    long end = -1;
+    
+    if (fseek(f, 0, SEEK_END) == 0) { end = ftell(f); }
+    if ((end > 0) && (fseek(f, 0, SEEK_SET) == 0)) { data = malloc((size_t) end); }
+    
+    if (data && (fread(data, 1, (size_t) end, f) != (size_t) end)) { free(data); data = NULL; }
+    if (!data) { fprintf(stderr, "%s: could not be read\n", path); }
+    
+    fclose(f);
+    *size = (size_t) end;
+    
+    return data;
+}
+
+
+static int write_file(const char *data, size_t size, void *arg)
+{
+    return (fwrite(data, 1, size, (FILE *) arg) == size);
+}
+
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: cli [-b | -m MODEL] [-n ELEMENTS] [-i INITIAL] [-s SAVE] [STREAM]\n");
+    fprintf(stderr, "  -b           use the built-in GUI button model (the default)\n");
+    fprintf(stderr, "  -m MODEL     load a model written by state_machine_save\n");
+    fprintf(stderr, "  -n ELEMENTS  number of elements driven by the stream (default 1)\n");
+    fprintf(stderr, "  -i INITIAL   initial state ID of every element (default: %u with -b;\n",
+        (unsigned int) STATE_GUI_BUTTON_DEFAULT);
+    fprintf(stderr, "               with -m, the model's state index 0, as a model file does\n");
+    fprintf(stderr, "               not record an initial state, so pass -i to choose one)\n");
+    fprintf(stderr, "  -s SAVE      also save the model to a file\n");
+    fprintf(stderr, "  STREAM       file of events, one \"ACTION\" or \"ELEMENT ACTION\" per line;\n");
+    fprintf(stderr, "               reads stdin if omitted or \"-\"\n");
+    return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *model = NULL, *save = NULL, *stream = NULL;
+    unsigned long elements = 1, initial = 0;
+    
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        int more = (i + 1 < argc);
+        
+        if      (!strcmp(a, "-b"))          { model = NULL; }
+        else if (!strcmp(a, "-m") && more)  { model = argv[++i]; }
+        else if (!strcmp(a, "-n") && more)  { elements = strtoul(argv[++i], NULL, 10); }
+        else if (!strcmp(a, "-i") && more)  { initial = strtoul(argv[++i], NULL, 0); }
+        else if (!strcmp(a, "-s") && more)  { save = argv[++i]; }
+        else if ((a[0] == '-') && a[1])     { return usage(); }
+        else if (!stream)                   { stream = a; }
+        else                                { return usage(); }
+    }
+    
+    if (!elements || (elements > 0xFFFFFFFFul)) { return usage(); }
+    
+    state_machine *source = NULL;
+    const char **names = NULL;
+    
+    if (model)
+    {
+        size_t size;
+        void *data = load_file(model, &size);
+        if (!data) { return 1; }
+        
+        source = state_machine_load(data, size);
+        free(data);
+        
+        if (!source) { fprintf(stderr, "%s: not a valid model\n", model); return 1; }
+        if (!initial) { initial = state_machine_state_id(source, 0); }
+    }
+    else
+    {
+        source = state_machine_new_gui_button();
+        names = state_machine_gui_button_state_strings();
+        
+        if (!source) { return 1; }
+        if (!initial) { initial = STATE_GUI_BUTTON_DEFAULT; }
+    }
+    
+    if (save)
+    {
+        FILE *f = fopen(save, "wb");
+        int ok = f && state_machine_save(write_file, f, source);
+        if (f && fclose(f)) { ok = 0; }
+        if (!ok) { fprintf(stderr, "%s: could not be written\n", save); return 1; }
+    }
+    
+    run r;
+    memset(&r, 0, sizeof(r));
+    
+    r.m        = state_machine_freeze(source, STATE_MACHINE_LAYOUT_AUTO);
+    r.elements = (unsigned int) elements;
+    r.actions  = state_machine_actions(source);
+    
+    unsigned int states = state_machine_states(source);
+    unsigned int index = state_machine_state_index(source, (unsigned int) initial);
+    
+    if (!r.m) { return 1; }
+    if (index == STATE_MACHINE_INVALID) { fprintf(stderr, "invalid initial state %lu\n", initial); return 1; }
+    
+    r.state = malloc(sizeof(unsigned int) * elements);
+    r.dwell = calloc(states ? states : 1, sizeof(unsigned long long));
+    if (!r.state || !r.dwell) { perror("malloc"); return 1; }
+    
+    for (unsigned long i = 0; i < elements; i++) { r.state[i] = index; }
+    
+    double start = now();
+    int ok = feed_file(&r, stream);
+    if (ok && !r.failed) { end_line(&r); }
+    double seconds = now() - start;
+    
+    if (!ok || r.failed) { return 1; }
+    
+    printf("%llu events, %llu transitions, %llu bytes in %.3f s\n",
+           r.events, r.transitions, r.bytes, seconds);
+    
+    if (seconds > 0)
+    {
+        printf("%.0f events/s, %.1f MB/s\n",
+               (double) r.events / seconds, (double) r.bytes / seconds / 1e6);
+    }
+    
+    unsigned long long *final = calloc(states ? states : 1, sizeof(unsigned long long));
+    if (!final) { perror("malloc"); return 1; }
+    
+    for (unsigned long i = 0; i < elements; i++) { final[r.state[i]]++; }
+    
+    printf("%-12s %20s %12s  %s\n", "state", "dwell", "final", "name");
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int id = state_machine_state_id(source, i);
+        if (!id || (!r.dwell[i] && !final[i])) { continue; }
+        
+        const char *name = (names && names[i]) ? names[i] : "";
+        printf("%-12u %20llu %12llu  %s\n", id, r.dwell[i], final[i], name);
+    }
+    
+    free(final);
+    free(r.dwell);
+    free(r.state);
+    state_machine_free(r.m);
+    state_machine_free(source);
+    
+    return 0;
+}
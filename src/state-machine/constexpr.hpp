@@ -0,0 +1,265 @@
+/*
+ 
+ state-machine/constexpr.hpp
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ 
+ Header-only C++17 front-end for machines known at compile time. The states
+ are declared as a constexpr array of state IDs and the transitions as a
+ constexpr array of rules (see state_machine_rule and the STATE_MACHINE_RULE_*
+ initialisers in state-machine.h), which are expanded into a transition
+ table while compiling:
+ 
+     constexpr std::array<unsigned int, 3> states = { IDLE, HOVER, DOWN };
+     constexpr std::array<state_machine_rule, 2> rules =
+     {{
+         STATE_MACHINE_RULE_TRANSITION(ENTER, IDLE, HOVER),
+         STATE_MACHINE_RULE_FROM_ALL_STATES(LEAVE, IDLE, 0),
+     }};
+     
+     using button = sm::fixed_machine<NUM_ACTIONS, states, rules, IDLE>;
+     
+     constexpr unsigned int hover = button::take_action(button::index(IDLE), ENTER);
+ 
+ The rules mean exactly what they mean to state_machine_add_rules. Declaring
+ the machine checks, with static_assert, that state IDs are distinct and
+ non-zero, that every action is in range, that every rule leads only to
+ declared states, and that every state is reachable from the initial state.
+ Taking an action by state index is a single load from a constexpr table. A
+ regular state_machine with the same state indexes can be created for use
+ with the C APIs.
+ 
+*/
+
+#ifndef STATE_MACHINE_CONSTEXPR_HPP
+#define STATE_MACHINE_CONSTEXPR_HPP
+
+#include <array>
+#include <cstddef> // size_t
+
+// the C headers come last because base.h defines short macros
+extern "C"
+{
+#   include "base.h"
+#   include "state-machine/state-machine.h"
+}
+
+// base.h marks symbol visibility with macros that are C++ keywords. They stay
+// undefined, as redefining them would break the C++ that follows, so include
+// any C header that uses them before this one.
+#undef public
+#undef private
+
+namespace sm
+{
+
+namespace detail
+{
+
+// A transition table expanded from rules, and the result of each check.
+template <std::size_t States, std::size_t Actions>
+struct fixed_table
+{
+    std::array<unsigned int, States> id{};            // by state index
+    std::array<unsigned int, States> sorted_id{};     // ascending
+    std::array<unsigned int, States> sorted_index{};  // of each sorted_id
+    std::array<unsigned int, States * Actions> to{};  // state index or STATE_MACHINE_INVALID
+    
+    bool distinct = true; // state IDs are distinct and non-zero
+    bool actions = true;  // every rule's action is in range
+    bool closed = true;   // every rule leads to a declared state
+    
+    constexpr unsigned int index(unsigned int state) const noexcept
+    {
+        std::size_t lo = 0, hi = States;
+        
+        while (lo < hi)
+        {
+            std::size_t mid = lo + ((hi - lo) / 2);
+            if (sorted_id[mid] < state) { lo = mid + 1; } else { hi = mid; }
+        }
+        
+        return ((lo < States) && (sorted_id[lo] == state))
+            ? sorted_index[lo] : STATE_MACHINE_INVALID;
+    }
+    
+    // every state is reachable from a state index
+    constexpr bool reachable(unsigned int from) const noexcept
+    {
+        if (from >= States) { return false; }
+        
+        std::array<bool, States> seen{};
+        std::array<unsigned int, States> queue{};
+        std::size_t head = 0, tail = 0, found = 1;
+        
+        seen[from] = true;
+        queue[tail++] = from;
+        
+        while (head < tail)
+        {
+            unsigned int i = queue[head++];
+            
+            for (std::size_t a = 0; a < Actions; a++)
+            {
+                unsigned int t = to[(i * Actions) + a];
+                if ((t == STATE_MACHINE_INVALID) || seen[t]) { continue; }
+                
+                seen[t] = true;
+                queue[tail++] = t;
+                found++;
+            }
+        }
+        
+        return found == States;
+    }
+};
+
+
+template <std::size_t Actions, std::size_t States, std::size_t Rules>
+constexpr fixed_table<States, Actions> expand
+    (const std::array<unsigned int, States> &states,
+     const std::array<state_machine_rule, Rules> &rules) noexcept
+{
+    fixed_table<States, Actions> t{};
+    
+    // insertion sort of the IDs for the lookup index
+    for (std::size_t i = 0; i < States; i++)
+    {
+        t.id[i] = states[i];
+        if (!states[i]) { t.distinct = false; }
+        
+        std::size_t j = i;
+        
+        for (; (j > 0) && (t.sorted_id[j - 1] >= states[i]); j--)
+        {
+            if (t.sorted_id[j - 1] == states[i]) { t.distinct = false; }
+            t.sorted_id[j]    = t.sorted_id[j - 1];
+            t.sorted_index[j] = t.sorted_index[j - 1];
+        }
+        
+        t.sorted_id[j]    = states[i];
+        t.sorted_index[j] = (unsigned int) i;
+    }
+    
+    for (std::size_t i = 0; i < t.to.size(); i++) { t.to[i] = STATE_MACHINE_INVALID; }
+    
+    // later rules replace the transitions of earlier ones
+    for (std::size_t r = 0; r < Rules; r++)
+    {
+        const state_machine_rule &rule = rules[r];
+        if (rule.action >= Actions) { t.actions = false; continue; }
+        
+        for (std::size_t i = 0; i < States; i++)
+        {
+            unsigned int state = states[i];
+            if ((state & rule.mask) != rule.match) { continue; }
+            
+            unsigned int target = t.index((state & ~rule.replace) | rule.with);
+            if (target == STATE_MACHINE_INVALID) { t.closed = false; continue; }
+            
+            t.to[(i * Actions) + rule.action] = target;
+        }
+    }
+    
+    return t;
+}
+
+} // namespace detail
+
+
+// A machine expanded at compile time from constexpr arrays of state IDs and
+// rules (which must have static storage duration). State indexes are the
+// positions of the states in the array.
+template <unsigned int Actions, const auto &States, const auto &Rules, unsigned int Initial>
+class fixed_machine
+{
+    public:
+        static constexpr auto table = detail::expand<Actions>(States, Rules);
+        
+        static constexpr unsigned int states = (unsigned int) States.size();
+        static constexpr unsigned int actions = Actions;
+        
+        static_assert(table.distinct, "state IDs must be distinct and non-zero");
+        static_assert(table.actions, "a rule has an action out of range");
+        static_assert(table.closed, "a rule leads to a state that is not declared");
+        static_assert(table.index(Initial) != STATE_MACHINE_INVALID, "the initial state is not declared");
+        static_assert(table.reachable(table.index(Initial)), "a state is not reachable from the initial state");
+        
+        static constexpr unsigned int initial = table.index(Initial);
+        
+        // As state_machine_state_index and state_machine_state_id
+        static constexpr unsigned int index(unsigned int state) noexcept
+            { return table.index(state); }
+        static constexpr unsigned int id(unsigned int index) noexcept
+            { return (index < states) ? table.id[index] : 0; }
+        
+        // As state_machine_take_action_index: the resulting state index or
+        // STATE_MACHINE_INVALID. Both arguments must be in range.
+        static constexpr unsigned int take_action(unsigned int index, unsigned int action) noexcept
+            { return table.to[(index * Actions) + action]; }
+        
+        // As state_machine_take_action, by state ID: the resulting state ID,
+        // or 0 if there is no transition or the arguments are out of range.
+        static constexpr unsigned int take_action_id(unsigned int state, unsigned int action) noexcept
+        {
+            unsigned int from = index(state);
+            if ((from == STATE_MACHINE_INVALID) || (action >= Actions)) { return 0; }
+            
+            unsigned int to = take_action(from, action);
+            return (to == STATE_MACHINE_INVALID) ? 0 : table.id[to];
+        }
+        
+        // Create a regular machine with the same states, state indexes and
+        // transitions, to be freed with state_machine_free. Returns NULL on
+        // failure to allocate.
+        static state_machine *make(bse_simple_memory_manager *mgr = nullptr)
+        {
+            state_machine *m = mgr
+                ? state_machine_new_using(states, Actions, mgr)
+                : state_machine_new(states, Actions);
+            if (!m) { return nullptr; }
+            
+            for (unsigned int i = 0; i < states; i++)
+                { state_machine_add_state(m, table.id[i]); }
+            
+            for (unsigned int i = 0; i < states; i++)
+            {
+                for (unsigned int a = 0; a < Actions; a++)
+                {
+                    unsigned int to = take_action(i, a);
+                    if (to == STATE_MACHINE_INVALID) { continue; }
+                    
+                    state_machine_add_transition(m, a, table.id[i], table.id[to]);
+                }
+            }
+            
+            return m;
+        }
+};
+
+} // namespace sm
+
+#endif
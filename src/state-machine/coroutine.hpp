@@ -0,0 +1,313 @@
+/*
+ 
+ state-machine/coroutine.hpp
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ 
+ Header-only C++20 coroutine support for populations (see population.h). A
+ flow is a coroutine that waits for an element to reach a combination of state
+ flags:
+ 
+     sm::flow on_click(sm::population &p, unsigned int button)
+     {
+         for (;;)
+         {
+             co_await p.until(button, STATE_GUI_CLICKED);
+             ...
+             p.take_action(button, ACTION_GUI_CONTINUE);
+         }
+     }
+ 
+ Waiting flows are kept in a subscription index, per element, together with
+ the union of the flags they wait on. Taking an action only looks at the
+ index when the element's state changes one of those flags, so any number of
+ waiting flows cost nothing until the flags they wait on change. Flows are
+ resumed from the dispatch loop, after the event that satisfied them, in the
+ order they became ready. A flow may take actions itself; these are applied
+ immediately and any flows they satisfy are resumed after it suspends again.
+ 
+ Flows that are still waiting when the population is destroyed are destroyed
+ with it. Not safe to use from more than one thread at a time.
+ 
+*/
+
+#ifndef STATE_MACHINE_COROUTINE_HPP
+#define STATE_MACHINE_COROUTINE_HPP
+
+#include <coroutine>
+#include <cstddef> // size_t
+#include <deque>
+#include <exception> // terminate
+#include <new> // bad_alloc
+#include <utility> // exchange, swap
+#include <vector>
+
+// the C headers come last because base.h defines short macros
+extern "C"
+{
+#   include "base.h"
+#   include "state-machine/state-machine.h"
+#   include "state-machine/population.h"
+}
+
+// base.h marks symbol visibility with macros that are C++ keywords. They stay
+// undefined, as redefining them would break the C++ that follows, so include
+// any C header that uses them before this one.
+#undef public
+#undef private
+
+namespace sm
+{
+
+// The return type of a coroutine run as a flow. A flow starts immediately,
+// runs until its first co_await that is not ready, and frees itself when it
+// returns. Exceptions escaping a flow terminate the program.
+struct flow
+{
+    struct promise_type
+    {
+        flow get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+
+// A state machine, freed when it goes out of scope.
+class machine
+{
+    public:
+        explicit machine(state_machine *m) : m_(m) { if (!m_) { throw std::bad_alloc(); } }
+        machine(machine &&o) noexcept : m_(std::exchange(o.m_, nullptr)) {}
+        machine &operator=(machine &&o) noexcept { std::swap(m_, o.m_); return *this; }
+        machine(const machine &) = delete;
+        machine &operator=(const machine &) = delete;
+        ~machine() { if (m_) { state_machine_free(m_); } }
+        
+        state_machine *get() const noexcept { return m_; }
+        
+        unsigned int take_action(unsigned int state, unsigned int action) const noexcept
+            { return state_machine_take_action(m_, state, action); }
+        
+    private:
+        state_machine *m_;
+};
+
+
+// A population of elements sharing a machine, which must outlive it, with
+// awaitable changes of state.
+class population
+{
+    public:
+        class awaiter;
+        
+        population(state_machine *m, unsigned int elements, unsigned int initial)
+            : p_(state_machine_population_new(m, elements, initial)),
+              subscriptions_(elements),
+              actions_(state_machine_actions(m))
+            { if (!p_) { throw std::bad_alloc(); } }
+        
+        population(const population &) = delete;
+        population &operator=(const population &) = delete;
+        
+        ~population()
+        {
+            for (auto &s : subscriptions_)
+                { for (auto &w : s.waiters) { w.handle.destroy(); } }
+            
+            state_machine_population_free(p_);
+        }
+        
+        state_machine_population *get() const noexcept { return p_; }
+        unsigned int elements() const noexcept { return (unsigned int) subscriptions_.size(); }
+        
+        unsigned int state(unsigned int element) const noexcept
+            { return state_machine_population_state(p_, element); }
+        
+        // As state_machine_population_take_action, resuming the flows that
+        // the new state satisfies.
+        unsigned int take_action(unsigned int element, unsigned int action)
+        {
+            unsigned int from = state(element);
+            unsigned int to = state_machine_population_take_action(p_, element, action);
+            
+            if (to) { changed(element, from, to); }
+            resume();
+            
+            return to;
+        }
+        
+        // As state_machine_population_dispatch, resuming the flows satisfied
+        // by each event after that event. An invalid event is reported in the
+        // same way and stops the batch at that event.
+        std::size_t dispatch(const state_machine_event *events, std::size_t n)
+        {
+            std::size_t taken = 0;
+            
+            for (std::size_t i = 0; i < n; i++)
+            {
+                if ((events[i].element >= elements()) || (events[i].action >= actions_))
+                {
+                    state_machine_population_dispatch(p_, &events[i], 1); // reports it
+                    break;
+                }
+                
+                if (take_action(events[i].element, events[i].action)) { taken++; }
+            }
+            
+            return taken;
+        }
+        
+        // As state_machine_population_set_state, resuming the flows that the
+        // new state satisfies.
+        bool set_state(unsigned int element, unsigned int to)
+        {
+            unsigned int from = state(element);
+            if (!state_machine_population_set_state(p_, element, to)) { return false; }
+            
+            changed(element, from, to);
+            resume();
+            
+            return true;
+        }
+        
+        // An awaitable that completes when an element's state contains every
+        // one of a set of flags ((state & flags) == flags), immediately if it
+        // already does. co_await gives the state at the time the flow resumes.
+        // For an invalid element it completes immediately, giving 0 as
+        // state_machine_population_state does.
+        awaiter until(unsigned int element, unsigned int flags) noexcept;
+        
+        // The number of flows waiting on an element (0 for an invalid element).
+        std::size_t waiting(unsigned int element) const noexcept
+        {
+            if (element >= elements()) { return 0; }
+            return subscriptions_[element].waiters.size();
+        }
+        
+    private:
+        struct waiter
+        {
+            unsigned int flags;
+            std::coroutine_handle<> handle;
+        };
+        
+        struct subscription
+        {
+            unsigned int flags = 0; // union of the flags of the waiters
+            std::vector<waiter> waiters;
+        };
+        
+        void subscribe(unsigned int element, unsigned int flags, std::coroutine_handle<> h)
+        {
+            subscription &s = subscriptions_[element];
+            s.flags |= flags;
+            s.waiters.push_back({flags, h});
+        }
+        
+        void changed(unsigned int element, unsigned int from, unsigned int to)
+        {
+            subscription &s = subscriptions_[element];
+            
+            // only a flag that was set can satisfy a waiter
+            if (!(s.flags & to & ~from)) { return; }
+            
+            std::size_t kept = 0;
+            unsigned int flags = 0;
+            
+            for (std::size_t i = 0; i < s.waiters.size(); i++)
+            {
+                waiter &w = s.waiters[i];
+                
+                if ((to & w.flags) == w.flags)
+                    { ready_.push_back(w.handle); }
+                else
+                    { flags |= w.flags; s.waiters[kept++] = w; }
+            }
+            
+            s.waiters.resize(kept);
+            s.flags = flags;
+        }
+        
+        void resume()
+        {
+            if (resuming_) { return; } // resumed by the outermost call
+            
+            resuming_ = true;
+            
+            while (!ready_.empty())
+            {
+                std::coroutine_handle<> h = ready_.front();
+                ready_.pop_front();
+                h.resume();
+            }
+            
+            resuming_ = false;
+        }
+        
+        state_machine_population *p_;
+        std::vector<subscription> subscriptions_;
+        unsigned int actions_;
+        std::deque<std::coroutine_handle<>> ready_;
+        bool resuming_ = false;
+};
+
+
+class population::awaiter
+{
+    public:
+        awaiter(population &p, unsigned int element, unsigned int flags) noexcept
+            : p_(p), element_(element), flags_(flags) {}
+        
+        bool await_ready() const noexcept
+        {
+            if (element_ >= p_.elements()) { return true; } // never subscribed
+            return (p_.state(element_) & flags_) == flags_;
+        }
+        
+        void await_suspend(std::coroutine_handle<> h)
+            { p_.subscribe(element_, flags_, h); }
+        
+        unsigned int await_resume() const noexcept
+            { return p_.state(element_); }
+        
+    private:
+        population &p_;
+        unsigned int element_;
+        unsigned int flags_;
+};
+
+
+inline population::awaiter population::until(unsigned int element, unsigned int flags) noexcept
+{
+    return awaiter(*this, element, flags);
+}
+
+} // namespace sm
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ 
+ state-machine/lazy.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/lazy.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+
+#define P(x) state_machine_lazy_private_##x
+
+#define STATE_MACHINE_LAZY_DEFAULT_CACHE 4096u
+#define STATE_MACHINE_LAZY_MAX_CACHE     (1u << 24)
+
+
+typedef struct P(entry) P(entry);
+
+struct P(entry)
+{
+    unsigned int state; // zero for an empty entry
+    unsigned int action;
+    unsigned int to;
+};
+
+
+struct state_machine_lazy
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding everything below
+    
+    unsigned int actions;
+    
+    // rules ordered by action (and then by their original order) so that the
+    // rules for action a are rules[first[a]] to rules[first[a + 1] - 1]
+    size_t num_rules;
+    size_t *first;
+    state_machine_rule *rules;
+    
+    // direct-mapped memo of (state, action) -> to
+    unsigned int cache_mask;
+    P(entry) *cache;
+    
+    state_machine_lazy_valid_fn valid;
+    void *valid_arg;
+    
+    unsigned long hits;
+    unsigned long misses;
+};
+
+
+static unsigned int P(hash)(unsigned int state, unsigned int action)
+{
+    unsigned int h = (state * 2654435761u) ^ (action * 2246822519u);
+    return h ^ (h >> 15);
+}
+
+
+static void P(invalidate)(state_machine_lazy *l)
+{
+    for (unsigned int i = 0; i <= l->cache_mask; i++)
+        { l->cache[i].state = 0; }
+}
+
+
+state_machine_lazy *state_machine_lazy_new_using
+    (unsigned int actions, const state_machine_rule *rules, size_t num_rules,
+     unsigned int cache_size, bse_simple_memory_manager *mgr)
+{
+    if (!mgr)                  { X(bad_arg); }
+    if (!actions)              { X2(bad_arg, "need at least one action"); }
+    if (num_rules && !rules)   { X(bad_arg); }
+    
+    for (size_t r = 0; r < num_rules; r++)
+    {
+        if (rules[r].action >= actions)
+            { X4(bad_arg, "invalid action in rule", 0, r); }
+    }
+    
+    if (!cache_size) { cache_size = STATE_MACHINE_LAZY_DEFAULT_CACHE; }
+    if (cache_size > STATE_MACHINE_LAZY_MAX_CACHE)
+        { cache_size = STATE_MACHINE_LAZY_MAX_CACHE; }
+    
+    unsigned int entries = 1;
+    while (entries < cache_size) { entries <<= 1; }
+    
+    // one allocation: header, first, rules, cache (in decreasing alignment)
+    size_t size_first = sizeof(size_t) * (actions + 1u);
+    size_t size_rules = sizeof(state_machine_rule) * num_rules;
+    size_t size_cache = sizeof(P(entry)) * entries;
+    size_t size = sizeof(state_machine_lazy) + size_first + size_rules + size_cache;
+    
+    char *block = mgr->allocate(size, mgr->user_arg);
+    if (!block) { X(allocate); }
+    
+    state_machine_lazy *l = (state_machine_lazy *) block;
+    memcpy(&l->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    l->size       = size;
+    l->actions    = actions;
+    l->num_rules  = num_rules;
+    l->first      = (size_t *) (block + sizeof(state_machine_lazy));
+    l->rules      = (state_machine_rule *) (block + sizeof(state_machine_lazy) + size_first);
+    l->cache      = (P(entry) *) (block + sizeof(state_machine_lazy) + size_first + size_rules);
+    l->cache_mask = entries - 1;
+    l->valid      = NULL;
+    l->valid_arg  = NULL;
+    l->hits       = 0;
+    l->misses     = 0;
+    
+    // stable counting sort of the rules by action
+    for (unsigned int a = 0; a <= actions; a++) { l->first[a] = 0; }
+    for (size_t r = 0; r < num_rules; r++) { l->first[rules[r].action + 1]++; }
+    for (unsigned int a = 0; a < actions; a++) { l->first[a + 1] += l->first[a]; }
+    
+    for (size_t r = 0; r < num_rules; r++)
+    {
+        // first[a] is used as a cursor and restored below
+        l->rules[l->first[rules[r].action]++] = rules[r];
+    }
+    
+    for (unsigned int a = actions; a > 0; a--) { l->first[a] = l->first[a - 1]; }
+    l->first[0] = 0;
+    
+    P(invalidate)(l);
+    
+    return l;
+    
+    err_allocate:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_lazy *state_machine_lazy_new
+    (unsigned int actions, const state_machine_rule *rules, size_t num_rules,
+     unsigned int cache_size)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_lazy_new_using(actions, rules, num_rules, cache_size, &mgr);
+}
+
+
+void state_machine_lazy_free(state_machine_lazy *l)
+{
+    if (!l) { X(bad_arg); }
+    
+    l->mgr.deallocate(l, l->size, l->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+void state_machine_lazy_set_validator
+    (state_machine_lazy *l, state_machine_lazy_valid_fn valid, void *arg)
+{
+    if (!l) { X(bad_arg); }
+    
+    l->valid     = valid;
+    l->valid_arg = arg;
+    
+    P(invalidate)(l);
+    
+    err_bad_arg:
+        return;
+}
+
+
+unsigned int state_machine_lazy_take_action
+    (state_machine_lazy *l, unsigned int state, unsigned int action)
+{
+    if (!l)                   { X(bad_arg); }
+    if (action >= l->actions) { X2(bad_arg, "invalid action"); }
+    if (!state)               { X2(bad_arg, "state must be non-zero"); }
+    
+    P(entry) *e = &l->cache[P(hash)(state, action) & l->cache_mask];
+    if ((e->state == state) && (e->action == action)) { l->hits++; return e->to; }
+    
+    l->misses++;
+    
+    if (l->valid && !l->valid(state, l->valid_arg))
+        { X4(bad_arg, "invalid state", 0, state); }
+    
+    // the last matching rule wins, as if the rules were applied in order
+    unsigned int to = 0;
+    for (size_t r = l->first[action + 1]; r-- > l->first[action]; )
+    {
+        const state_machine_rule *rule = &l->rules[r];
+        if ((state & rule->mask) != rule->match) { continue; }
+        
+        to = (state & ~rule->replace) | rule->with;
+        if (to && l->valid && !l->valid(to, l->valid_arg)) { to = 0; }
+        break;
+    }
+    
+    e->state  = state;
+    e->action = action;
+    e->to     = to;
+    
+    return to;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+void state_machine_lazy_stats
+    (state_machine_lazy *l, unsigned long *hits, unsigned long *misses)
+{
+    if (!l) { X(bad_arg); }
+    
+    if (hits)   { *hits   = l->hits; }
+    if (misses) { *misses = l->misses; }
+    
+    err_bad_arg:
+        return;
+}
+
+
+// open addressing set of state IDs (zero marks an empty slot)
+static int P(insert)(unsigned int *set, unsigned int mask, unsigned int state)
+{
+    unsigned int i = P(hash)(state, 0) & mask;
+    
+    while (set[i])
+    {
+        if (set[i] == state) { return 0; }
+        i = (i + 1) & mask;
+    }
+    
+    set[i] = state;
+    return 1;
+}
+
+
+state_machine *state_machine_lazy_materialize
+    (state_machine_lazy *l, const unsigned int *initial, size_t num_initial,
+     unsigned int max_states)
+{
+    T_SCOPE(state_machine_lazy_materialize);
+    
+    state_machine *m = NULL;
+    unsigned int *queue = NULL;
+    unsigned int *set = NULL;
+    
+    if (!l)                       { X(bad_arg); }
+    if (!initial || !num_initial) { X2(bad_arg, "need an initial state"); }
+    if (!max_states)              { X(bad_arg); }
+    
+    // the set of seen states is a power of two at least twice max_states
+    if (max_states > (UINT_MAX / 4) + 1) { X2(bad_arg, "max_states too large"); }
+    
+    unsigned int set_size = 1;
+    while (set_size < 2u * max_states) { set_size <<= 1; }
+    
+    queue = l->mgr.allocate(sizeof(unsigned int) * max_states, l->mgr.user_arg);
+    if (!queue) { X(allocate); }
+    
+    set = l->mgr.allocate(sizeof(unsigned int) * set_size, l->mgr.user_arg);
+    if (!set) { X(allocate); }
+    
+    for (unsigned int i = 0; i < set_size; i++) { set[i] = 0; }
+    
+    unsigned int count = 0;
+    
+    for (size_t i = 0; i < num_initial; i++)
+    {
+        unsigned int state = initial[i];
+        if (!state) { X2(bad_arg, "state must be non-zero"); }
+        if (l->valid && !l->valid(state, l->valid_arg))
+            { X4(bad_arg, "invalid initial state", 0, state); }
+        
+        if (!P(insert)(set, set_size - 1, state)) { continue; }
+        if (count >= max_states) { X4(too_many_states, "limit", 0, max_states); }
+        queue[count++] = state;
+    }
+    
+    // breadth first search; queue doubles as the list of discovered states
+    for (unsigned int head = 0; head < count; head++)
+    {
+        for (unsigned int a = 0; a < l->actions; a++)
+        {
+            unsigned int to = state_machine_lazy_take_action(l, queue[head], a);
+            if (!to) { continue; }
+            
+            if (!P(insert)(set, set_size - 1, to)) { continue; }
+            if (count >= max_states) { X4(too_many_states, "limit", 0, max_states); }
+            queue[count++] = to;
+        }
+    }
+    
+    m = state_machine_new_using(count, l->actions, &l->mgr);
+    if (!m) { X(state_machine_new_using); }
+    
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (!state_machine_add_state(m, queue[i])) { X(state_machine_add_state); }
+    }
+    
+    for (unsigned int i = 0; i < count; i++)
+    {
+        for (unsigned int a = 0; a < l->actions; a++)
+        {
+            unsigned int to = state_machine_lazy_take_action(l, queue[i], a);
+            if (!to) { continue; }
+            
+            if (!state_machine_add_transition(m, a, queue[i], to))
+                { X(state_machine_add_transition); }
+        }
+    }
+    
+    l->mgr.deallocate(set, sizeof(unsigned int) * set_size, l->mgr.user_arg);
+    l->mgr.deallocate(queue, sizeof(unsigned int) * max_states, l->mgr.user_arg);
+    
+    return m;
+    
+    err_state_machine_add_transition:
+    err_state_machine_add_state:
+        state_machine_free(m);
+    err_state_machine_new_using:
+    err_too_many_states:
+    err_allocate:
+        if (set) { l->mgr.deallocate(set, sizeof(unsigned int) * set_size, l->mgr.user_arg); }
+        if (queue) { l->mgr.deallocate(queue, sizeof(unsigned int) * max_states, l->mgr.user_arg); }
+    err_bad_arg:
+        return NULL;
+}
@@ -0,0 +1,97 @@
+/*
+ 
+ state-machine/lazy.h
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+
+ ------------------------------------------------------------------------------
+
+ A lazy state machine is defined only by an ordered list of rules (see
+ state_machine_rule) over a space of state IDs that is never enumerated. Each
+ transition is computed the first time it is taken and memoized in a bounded,
+ direct-mapped cache, so only the states that are actually visited cost
+ anything. This suits models whose states are combinations of many flags.
+
+ A lazy machine is not safe to use from more than one thread at a time because
+ taking an action may update the cache.
+
+*/
+
+#ifndef STATE_MACHINE_LAZY_H
+#define STATE_MACHINE_LAZY_H
+
+#ifndef BSE_BASE_H
+#   include "base.h"
+#endif
+
+#include "state-machine/state-machine.h"
+#include <stddef.h> // size_t
+
+typedef struct state_machine_lazy state_machine_lazy;
+
+// Returns non-zero if a state ID is a member of the machine. Used to reject
+// flag combinations that a rule may produce but that make no sense.
+typedef int (*state_machine_lazy_valid_fn)(unsigned int state, void *arg);
+
+// Create a lazy state machine over an alphabet of actions from an ordered list
+// of rules. The rules are copied. The cache holds at most cache_size
+// transitions (rounded up to a power of two); zero selects a default.
+state_machine_lazy *state_machine_lazy_new
+    (unsigned int actions, const state_machine_rule *rules, size_t num_rules,
+     unsigned int cache_size);
+
+// As state_machine_lazy_new, but accepts a structure indicating how memory
+// should be allocated and deallocated.
+state_machine_lazy *state_machine_lazy_new_using
+    (unsigned int actions, const state_machine_rule *rules, size_t num_rules,
+     unsigned int cache_size, bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a lazy state machine
+void state_machine_lazy_free(state_machine_lazy *l);
+
+// By default every non-zero state ID is a state. Optionally, restrict the
+// states to those accepted by a function. A transition whose target is
+// rejected does not exist. This invalidates the cache.
+void state_machine_lazy_set_validator
+    (state_machine_lazy *l, state_machine_lazy_valid_fn valid, void *arg);
+
+// Return the resulting state when an action is taken from a specific state.
+// The last rule (in order) that matches the state decides the transition.
+// If there is no transition, 0 is returned.
+unsigned int state_machine_lazy_take_action
+    (state_machine_lazy *l, unsigned int state, unsigned int action);
+
+// Retrieve the number of cache hits and misses since creation (either pointer
+// may be NULL).
+void state_machine_lazy_stats
+    (state_machine_lazy *l, unsigned long *hits, unsigned long *misses);
+
+// Explore every state reachable from the given initial states and build an
+// ordinary state machine with exactly those states and their transitions.
+// Fails if more than max_states states are reachable. max_states may be at
+// most UINT_MAX / 4 + 1.
+state_machine *state_machine_lazy_materialize
+    (state_machine_lazy *l, const unsigned int *initial, size_t num_initial,
+     unsigned int max_states);
+
+#endif
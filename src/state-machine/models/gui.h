@@ -1,4 +1,8 @@
+#ifndef STATE_MACHINE_MODELS_GUI_H
+#define STATE_MACHINE_MODELS_GUI_H
+
 #include "state-machine/state-machine.h"
+#include "state-machine/population.h"
 
 # define ACTION_GUI_ENABLE       0
 # define ACTION_GUI_DISABLE      1
@@ -15,7 +19,9 @@
 # define ACTION_GUI_UNFOCUS     11
 # define ACTION_GUI_CONTINUE    12 // for when a state blocks until handled
 # define ACTION_GUI_SCROLL      13
-# define NUM_ACTIONS_GUI        14
+# define ACTION_GUI_CHECK       14
+# define ACTION_GUI_UNCHECK     15
+# define NUM_ACTIONS_GUI        16
 
 #define STATE_GUI_ENABLED        1u // TODO make states common too
 #define STATE_GUI_DISABLED       2u
@@ -40,8 +46,142 @@
     | STATE_GUI_NOT_CLICKED \
     )
 
+#define STATE_GUI_CHECKBOX_DEFAULT (STATE_GUI_BUTTON_DEFAULT | STATE_GUI_UNCHECKED)
+
 state_machine *state_machine_new_gui_button(void);
 
+// A checkbox behaves as a button that also keeps a CHECKED or UNCHECKED flag.
+// Each click (a transition to the clicked state) toggles the flag. A radio
+// button is the same except that a click only ever checks it. In both,
+// ACTION_GUI_CHECK and ACTION_GUI_UNCHECK set the flag in any state, even
+// when disabled.
+state_machine *state_machine_new_gui_checkbox(void);
+state_machine *state_machine_new_gui_radio(void);
+
 const char **state_machine_gui_button_state_strings(void);
 
 const char **state_machine_gui_action_strings(void);
+
+
+// Hit testing: tracks which elements' rectangles are under the pointer, using
+// a uniform grid of cells over the screen, and turns each pointer move into
+// just the ACTION_GUI_MOUSE_LEAVE and ACTION_GUI_MOUSE_ENTER events of the
+// elements that the pointer left or entered. A move costs time proportional
+// to the number of rectangles in the pointer's cell. The grid is rebuilt, in
+// time proportional to the elements and cells, on the first move after any
+// rectangle changes.
+typedef struct state_machine_gui_hit state_machine_gui_hit;
+
+// Create a hit test for elements within a screen of width * height pixels
+// divided into square cells of a given size. All rectangles start empty.
+state_machine_gui_hit *state_machine_gui_hit_new
+    (unsigned int elements, unsigned int width, unsigned int height,
+     unsigned int cell);
+
+// As state_machine_gui_hit_new, but accepts a structure indicating how memory
+// should be allocated and deallocated.
+state_machine_gui_hit *state_machine_gui_hit_new_using
+    (unsigned int elements, unsigned int width, unsigned int height,
+     unsigned int cell, bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a hit test
+void state_machine_gui_hit_free(state_machine_gui_hit *h);
+
+// Set the rectangle of an element (a width or height of 0 removes it). Parts
+// outside the screen are never hit.
+int state_machine_gui_hit_set_rect
+    (state_machine_gui_hit *h, unsigned int element,
+     int x, int y, unsigned int width, unsigned int height);
+
+// Move the pointer to (x, y) and return the resulting leave events followed
+// by the enter events, in order of element, storing their number in n. The
+// events are valid until the next call and are suitable for
+// state_machine_population_dispatch.
+const state_machine_event *state_machine_gui_hit_move
+    (state_machine_gui_hit *h, int x, int y, size_t *n);
+
+// Focus management: keeps the element holding focus and a tab order ring of
+// the focusable (enabled) elements of a population of GUI elements, in order
+// of element. Moving focus takes exactly one ACTION_GUI_UNFOCUS and one
+// ACTION_GUI_FOCUS action in O(1). Actions taken through the focus manager
+// keep it up to date: an element that gains focus another way (e.g. by a
+// mouse down) unfocuses the previous holder, and when the holder is disabled
+// focus passes to the next focusable element. Adding an element to the ring
+// finds its neighbour by scanning a bitmap of the ring, 64 elements a step.
+typedef struct state_machine_gui_focus state_machine_gui_focus;
+
+// Create a focus manager for a population, which must outlive it.
+state_machine_gui_focus *state_machine_gui_focus_new(state_machine_population *p);
+
+// As state_machine_gui_focus_new, but accepts a structure indicating how
+// memory should be allocated and deallocated.
+state_machine_gui_focus *state_machine_gui_focus_new_using
+    (state_machine_population *p, bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a focus manager
+void state_machine_gui_focus_free(state_machine_gui_focus *f);
+
+// The element holding focus, or STATE_MACHINE_INVALID if none.
+unsigned int state_machine_gui_focus_holder(state_machine_gui_focus *f);
+
+// Move focus to a focusable element, to the next or previous focusable
+// element in tab order (wrapping around), or, if no element has focus, to the
+// first or last.
+int state_machine_gui_focus_set(state_machine_gui_focus *f, unsigned int element);
+int state_machine_gui_focus_next(state_machine_gui_focus *f);
+int state_machine_gui_focus_prev(state_machine_gui_focus *f);
+
+// As state_machine_population_take_action and _dispatch, keeping the focus
+// manager up to date.
+unsigned int state_machine_gui_focus_take_action
+    (state_machine_gui_focus *f, unsigned int element, unsigned int action);
+size_t state_machine_gui_focus_dispatch
+    (state_machine_gui_focus *f, const state_machine_event *events, size_t n);
+
+// Update the focus manager after changing the state of an element directly
+// on the population.
+int state_machine_gui_focus_sync(state_machine_gui_focus *f, unsigned int element);
+
+// Radio groups: exclusive groups of elements of a population of checkboxes or
+// radio buttons, each recording the member that is checked. Actions taken
+// through the radio groups keep them up to date: when a member becomes
+// checked, the previously checked member of its group is unchecked with one
+// ACTION_GUI_UNCHECK in O(1), without looking at the other members.
+typedef struct state_machine_gui_radio state_machine_gui_radio;
+
+// Create a number of empty radio groups for a population, which must outlive
+// them.
+state_machine_gui_radio *state_machine_gui_radio_new
+    (state_machine_population *p, unsigned int groups);
+
+// As state_machine_gui_radio_new, but accepts a structure indicating how
+// memory should be allocated and deallocated.
+state_machine_gui_radio *state_machine_gui_radio_new_using
+    (state_machine_population *p, unsigned int groups,
+     bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with radio groups
+void state_machine_gui_radio_free(state_machine_gui_radio *r);
+
+// Move an element into a group, or out of any group if the group is
+// STATE_MACHINE_INVALID. If the element is checked and the group already has a
+// checked member, the element is unchecked.
+int state_machine_gui_radio_join
+    (state_machine_gui_radio *r, unsigned int element, unsigned int group);
+
+// The checked member of a group, or STATE_MACHINE_INVALID if none.
+unsigned int state_machine_gui_radio_holder
+    (state_machine_gui_radio *r, unsigned int group);
+
+// As state_machine_population_take_action and _dispatch, keeping the radio
+// groups up to date.
+unsigned int state_machine_gui_radio_take_action
+    (state_machine_gui_radio *r, unsigned int element, unsigned int action);
+size_t state_machine_gui_radio_dispatch
+    (state_machine_gui_radio *r, const state_machine_event *events, size_t n);
+
+// Update the radio groups after changing the state of an element directly on
+// the population.
+int state_machine_gui_radio_sync(state_machine_gui_radio *r, unsigned int element);
+
+#endif
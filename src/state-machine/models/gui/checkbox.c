@@ -0,0 +1,115 @@
+/*
+ 
+ state-machine/models/gui/checkbox.c -
+ checkbox and radio button models built from the button model
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#include "base.h"
+#include "state-machine/state-machine.h"
+#include "state-machine/models/gui.h"
+
+#define S(x) STATE_GUI_##x
+#define A(x) ACTION_GUI_##x
+
+#define P(x) state_machine_gui_checkbox_private_##x
+
+
+// Every state of the button is paired with each of the checked and unchecked
+// flags, keeping every transition of the button. A transition into the
+// clicked state also toggles the flag or, for a radio button, checks it.
+static state_machine *P(new)(int toggle)
+{
+    state_machine *button = state_machine_new_gui_button();
+    if (!button) { X(new_gui_button); }
+    
+    unsigned int states = state_machine_states(button);
+    
+    state_machine *m = state_machine_new(2 * states, NUM_ACTIONS_GUI);
+    if (!m) { X(state_machine_new); }
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int state = state_machine_state_id(button, i);
+        if (!state) { continue; }
+        
+        if (!state_machine_add_state(m, state | S(UNCHECKED))) { X(add_state); }
+        if (!state_machine_add_state(m, state | S(CHECKED)))   { X(add_state); }
+    }
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int from = state_machine_state_id(button, i);
+        if (!from) { continue; }
+        
+        for (unsigned int a = 0; a < NUM_ACTIONS_GUI; a++)
+        {
+            unsigned int to = state_machine_take_action(button, from, a);
+            if (!to) { continue; }
+            
+            int click = ((to & S(CLICKED)) && !(from & S(CLICKED)));
+            
+            unsigned int unchecked_to = (click) ? S(CHECKED) : S(UNCHECKED);
+            unsigned int checked_to   = (click && toggle) ? S(UNCHECKED) : S(CHECKED);
+            
+            if (!state_machine_add_transition(m, a, from | S(UNCHECKED), to | unchecked_to)) { X(add_transition); }
+            if (!state_machine_add_transition(m, a, from | S(CHECKED),   to | checked_to))   { X(add_transition); }
+        }
+    }
+    
+    if (!state_machine_add_transition_from_all_states_replacing(m, A(CHECK),
+        S(UNCHECKED), S(CHECKED), S(UNCHECKED)))
+        { X(add_transition); }
+    
+    if (!state_machine_add_transition_from_all_states_replacing(m, A(UNCHECK),
+        S(CHECKED), S(UNCHECKED), S(CHECKED)))
+        { X(add_transition); }
+    
+    state_machine_free(button);
+    
+    return m;
+    
+    err_add_transition:
+    err_add_state:
+        state_machine_free(m);
+    err_state_machine_new:
+        state_machine_free(button);
+    err_new_gui_button:
+        return NULL;
+}
+
+
+state_machine *state_machine_new_gui_checkbox(void)
+{
+    return P(new)(1);
+}
+
+
+state_machine *state_machine_new_gui_radio(void)
+{
+    return P(new)(0);
+}
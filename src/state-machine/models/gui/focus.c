@@ -0,0 +1,357 @@
+/*
+ 
+ state-machine/models/gui/focus.c -
+ tracks the focused element and the tab order of a population of elements
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/models/gui.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+
+#define P(x) state_machine_gui_focus_private_##x
+
+
+struct state_machine_gui_focus
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding the arrays below
+    
+    state_machine_population *p;
+    state_machine *m;
+    unsigned int elements;
+    unsigned int holder;
+    
+    // the ring of focusable elements, and a bitmap of its members
+    unsigned int *next;
+    unsigned int *prev;
+    unsigned int words;
+    unsigned long long *bits;
+};
+
+
+static unsigned int P(highest)(unsigned long long w)
+{
+    unsigned int n = 0;
+    
+    if (w >> 32) { n += 32; w >>= 32; }
+    if (w >> 16) { n += 16; w >>= 16; }
+    if (w >> 8)  { n += 8;  w >>= 8; }
+    if (w >> 4)  { n += 4;  w >>= 4; }
+    if (w >> 2)  { n += 2;  w >>= 2; }
+    if (w >> 1)  { n += 1; }
+    
+    return n;
+}
+
+
+static int P(member)(state_machine_gui_focus *f, unsigned int e)
+{
+    return (int) ((f->bits[e / 64] >> (e % 64)) & 1);
+}
+
+
+// the last member of the ring before an element, wrapping around to the last
+// member overall, or STATE_MACHINE_INVALID if the ring is empty
+static unsigned int P(before)(state_machine_gui_focus *f, unsigned int e)
+{
+    unsigned int word = e / 64;
+    unsigned long long below = f->bits[word] & ((1ull << (e % 64)) - 1);
+    
+    if (below) { return (word * 64) + P(highest)(below); }
+    
+    for (unsigned int w = word; w-- > 0; )
+        { if (f->bits[w]) { return (w * 64) + P(highest)(f->bits[w]); } }
+    
+    for (unsigned int w = f->words; w-- > word; )
+        { if (f->bits[w]) { return (w * 64) + P(highest)(f->bits[w]); } }
+    
+    return STATE_MACHINE_INVALID;
+}
+
+
+static unsigned int P(last)(state_machine_gui_focus *f)
+{
+    return f->elements ? P(before)(f, 0) : STATE_MACHINE_INVALID;
+}
+
+
+static void P(insert)(state_machine_gui_focus *f, unsigned int e)
+{
+    unsigned int before = P(before)(f, e);
+    
+    if (before == STATE_MACHINE_INVALID)
+    {
+        f->next[e] = f->prev[e] = e;
+    }
+    else
+    {
+        unsigned int after = f->next[before];
+        
+        f->next[e] = after;
+        f->prev[e] = before;
+        f->next[before] = e;
+        f->prev[after] = e;
+    }
+    
+    f->bits[e / 64] |= (1ull << (e % 64));
+}
+
+
+static void P(remove)(state_machine_gui_focus *f, unsigned int e)
+{
+    f->next[f->prev[e]] = f->next[e];
+    f->prev[f->next[e]] = f->prev[e];
+    f->bits[e / 64] &= ~(1ull << (e % 64));
+}
+
+
+static int P(focus)(state_machine_gui_focus *f, unsigned int e)
+{
+    if (e == f->holder) { return 1; }
+    
+    // check that the element can take focus before unfocusing the holder
+    unsigned int state = state_machine_population_state(f->p, e);
+    if (!state_machine_take_action(f->m, state, ACTION_GUI_FOCUS)) { return 0; }
+    
+    if (f->holder != STATE_MACHINE_INVALID)
+        { state_machine_population_take_action(f->p, f->holder, ACTION_GUI_UNFOCUS); }
+    
+    state_machine_population_take_action(f->p, e, ACTION_GUI_FOCUS);
+    f->holder = e;
+    
+    return 1;
+}
+
+
+static void P(update)(state_machine_gui_focus *f, unsigned int e)
+{
+    unsigned int state = state_machine_population_state(f->p, e);
+    unsigned int pass = STATE_MACHINE_INVALID;
+    
+    int enabled = ((state & STATE_GUI_ENABLED) == STATE_GUI_ENABLED);
+    int focused = ((state & STATE_GUI_FOCUSED) == STATE_GUI_FOCUSED);
+    
+    if (enabled && !P(member)(f, e)) { P(insert)(f, e); }
+    
+    if (!enabled && P(member)(f, e))
+    {
+        if ((f->holder == e) && (f->next[e] != e)) { pass = f->next[e]; }
+        P(remove)(f, e);
+    }
+    
+    if (focused && (f->holder != e))
+    {
+        // focused some other way, e.g. by a mouse down
+        if (f->holder != STATE_MACHINE_INVALID)
+            { state_machine_population_take_action(f->p, f->holder, ACTION_GUI_UNFOCUS); }
+        
+        f->holder = e;
+    }
+    else if (!focused && (f->holder == e))
+    {
+        f->holder = STATE_MACHINE_INVALID;
+    }
+    
+    if (pass != STATE_MACHINE_INVALID) { P(focus)(f, pass); }
+}
+
+
+state_machine_gui_focus *state_machine_gui_focus_new_using
+    (state_machine_population *p, bse_simple_memory_manager *mgr)
+{
+    if (!p)   { X(bad_arg); }
+    if (!mgr) { X(bad_arg); }
+    
+    unsigned int elements = state_machine_population_elements(p);
+    unsigned int words = (elements + 63) / 64;
+    
+    size_t size = sizeof(state_machine_gui_focus)
+        + (sizeof(unsigned long long) * words)
+        + (sizeof(unsigned int) * 2 * (size_t) elements);
+    
+    state_machine_gui_focus *f = mgr->allocate(size, mgr->user_arg);
+    if (!f) { X(allocate_focus); }
+    
+    memcpy(&f->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    f->size     = size;
+    f->p        = p;
+    f->m        = state_machine_population_machine(p);
+    f->elements = elements;
+    f->holder   = STATE_MACHINE_INVALID;
+    f->words    = words;
+    f->bits     = (unsigned long long *) (f + 1);
+    f->next     = (unsigned int *) (f->bits + words);
+    f->prev     = f->next + elements;
+    
+    for (unsigned int w = 0; w < words; w++) { f->bits[w] = 0; }
+    for (unsigned int e = 0; e < elements; e++) { P(update)(f, e); }
+    
+    return f;
+    
+    err_allocate_focus:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_gui_focus *state_machine_gui_focus_new(state_machine_population *p)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_gui_focus_new_using(p, &mgr);
+}
+
+
+void state_machine_gui_focus_free(state_machine_gui_focus *f)
+{
+    if (!f) { X(bad_arg); }
+    
+    f->mgr.deallocate(f, f->size, f->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+unsigned int state_machine_gui_focus_holder(state_machine_gui_focus *f)
+{
+    if (!f) { X(bad_arg); }
+    
+    return f->holder;
+    
+    err_bad_arg:
+        return STATE_MACHINE_INVALID;
+}
+
+
+int state_machine_gui_focus_set(state_machine_gui_focus *f, unsigned int element)
+{
+    if (!f)                     { X(bad_arg); }
+    if (element >= f->elements) { X4(bad_arg, "invalid element", 0, element); }
+    if (!P(member)(f, element)) { X4(bad_arg, "element is not focusable", 0, element); }
+    
+    if (!P(focus)(f, element)) { X4(focus, "element cannot take focus", 0, element); }
+    
+    return 1;
+    
+    err_focus:
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_gui_focus_next(state_machine_gui_focus *f)
+{
+    if (!f) { X(bad_arg); }
+    
+    unsigned int e = (f->holder != STATE_MACHINE_INVALID) ? f->holder : P(last)(f);
+    if (e == STATE_MACHINE_INVALID) { X2(focus, "no focusable element"); }
+    
+    e = f->next[e];
+    if (!P(focus)(f, e)) { X4(focus, "element cannot take focus", 0, e); }
+    
+    return 1;
+    
+    err_focus:
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_gui_focus_prev(state_machine_gui_focus *f)
+{
+    if (!f) { X(bad_arg); }
+    
+    unsigned int e = (f->holder != STATE_MACHINE_INVALID) ? f->prev[f->holder] : P(last)(f);
+    if (e == STATE_MACHINE_INVALID) { X2(focus, "no focusable element"); }
+    
+    if (!P(focus)(f, e)) { X4(focus, "element cannot take focus", 0, e); }
+    
+    return 1;
+    
+    err_focus:
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_gui_focus_take_action
+    (state_machine_gui_focus *f, unsigned int element, unsigned int action)
+{
+    if (!f) { X(bad_arg); }
+    
+    unsigned int to = state_machine_population_take_action(f->p, element, action);
+    if (to) { P(update)(f, element); }
+    
+    return to;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+size_t state_machine_gui_focus_dispatch
+    (state_machine_gui_focus *f, const state_machine_event *events, size_t n)
+{
+    size_t taken = 0;
+    
+    if (!f)            { X(bad_arg); }
+    if (n && !events)  { X(bad_arg); }
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        if (events[i].element >= f->elements) { X4(bad_arg, "invalid element", 0, events[i].element); }
+        
+        if (state_machine_gui_focus_take_action(f, events[i].element, events[i].action)) { taken++; }
+    }
+    
+    return taken;
+    
+    err_bad_arg:
+        return taken;
+}
+
+
+int state_machine_gui_focus_sync(state_machine_gui_focus *f, unsigned int element)
+{
+    if (!f)                     { X(bad_arg); }
+    if (element >= f->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    P(update)(f, element);
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
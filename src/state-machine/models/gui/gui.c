@@ -34,10 +34,12 @@ const char **state_machine_gui_action_strings(void)
         "focus",
         "unfocus",
         "continue",
-        "scroll"
+        "scroll",
+        "check",
+        "uncheck"
     };
     
-    assert(NUM_ACTIONS_GUI == 14); // reminder to update the string table
+    assert(NUM_ACTIONS_GUI == 16); // reminder to update the string table
     
     return actions;
 }
@@ -0,0 +1,310 @@
+/*
+ 
+ state-machine/models/gui/hit.c -
+ hit testing of element rectangles, producing mouse enter and leave actions
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/models/gui.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+
+#define P(x) state_machine_gui_hit_private_##x
+
+
+typedef struct P(rect) P(rect);
+
+// clipped to the screen; empty if x0 == x1
+struct P(rect)
+{
+    unsigned int x0, y0, x1, y1;
+};
+
+
+struct state_machine_gui_hit
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding the arrays below
+    
+    unsigned int elements;
+    unsigned int width, height, cell;
+    unsigned int cols, rows;
+    
+    P(rect) *rect;
+    
+    // for each cell, the elements overlapping it in order are
+    // items[cell_start[cell]] to items[cell_start[cell + 1] - 1]
+    int dirty;
+    unsigned int *cell_start;
+    unsigned int *items; // separately allocated
+    size_t num_items;
+    
+    // the elements under the pointer, in order, and space for the next set
+    unsigned int *under;
+    unsigned int num_under;
+    unsigned int *scratch;
+    
+    state_machine_event *events;
+};
+
+
+static unsigned int P(clip)(long long v, unsigned int limit)
+{
+    if (v < 0) { return 0; }
+    if (v > (long long) limit) { return limit; }
+    return (unsigned int) v;
+}
+
+
+static int P(rebuild)(state_machine_gui_hit *h)
+{
+    unsigned int cells = h->cols * h->rows;
+    
+    for (unsigned int c = 0; c <= cells; c++) { h->cell_start[c] = 0; }
+    
+    // count the rectangles in each cell, then place them
+    size_t total = 0;
+    
+    for (unsigned int e = 0; e < h->elements; e++)
+    {
+        P(rect) *r = &h->rect[e];
+        if (r->x0 == r->x1) { continue; }
+        
+        for (unsigned int cy = r->y0 / h->cell; cy <= (r->y1 - 1) / h->cell; cy++)
+        {
+            for (unsigned int cx = r->x0 / h->cell; cx <= (r->x1 - 1) / h->cell; cx++)
+                { h->cell_start[(cy * h->cols) + cx + 1]++; total++; }
+        }
+    }
+    
+    if (total > h->num_items)
+    {
+        if (h->items) { h->mgr.deallocate(h->items, sizeof(unsigned int) * h->num_items, h->mgr.user_arg); }
+        
+        h->items = h->mgr.allocate(sizeof(unsigned int) * total, h->mgr.user_arg);
+        h->num_items = h->items ? total : 0;
+        if (!h->items) { X(allocate); }
+    }
+    
+    for (unsigned int c = 0; c < cells; c++) { h->cell_start[c + 1] += h->cell_start[c]; }
+    
+    for (unsigned int e = 0; e < h->elements; e++)
+    {
+        P(rect) *r = &h->rect[e];
+        if (r->x0 == r->x1) { continue; }
+        
+        for (unsigned int cy = r->y0 / h->cell; cy <= (r->y1 - 1) / h->cell; cy++)
+        {
+            for (unsigned int cx = r->x0 / h->cell; cx <= (r->x1 - 1) / h->cell; cx++)
+                { h->items[h->cell_start[(cy * h->cols) + cx]++] = e; }
+        }
+    }
+    
+    // placing advanced each start to the next cell's start; shift back
+    for (unsigned int c = cells; c > 0; c--) { h->cell_start[c] = h->cell_start[c - 1]; }
+    h->cell_start[0] = 0;
+    
+    h->dirty = 0;
+    
+    return 1;
+    
+    err_allocate:
+        return 0;
+}
+
+
+state_machine_gui_hit *state_machine_gui_hit_new_using
+    (unsigned int elements, unsigned int width, unsigned int height,
+     unsigned int cell, bse_simple_memory_manager *mgr)
+{
+    if (!mgr)               { X(bad_arg); }
+    if (!width || !height)  { X2(bad_arg, "empty screen"); }
+    if (!cell)              { X2(bad_arg, "cell size must be non-zero"); }
+    
+    unsigned int cols = (width / cell) + ((width % cell) ? 1 : 0);
+    unsigned int rows = (height / cell) + ((height % cell) ? 1 : 0);
+    
+    size_t cells = (size_t) cols * rows;
+    
+    size_t size = sizeof(state_machine_gui_hit)
+        + (sizeof(state_machine_event) * 2 * (size_t) elements)
+        + (sizeof(P(rect)) * elements)
+        + (sizeof(unsigned int) * (cells + 1))
+        + (sizeof(unsigned int) * 2 * (size_t) elements);
+    
+    state_machine_gui_hit *h = mgr->allocate(size, mgr->user_arg);
+    if (!h) { X(allocate_hit); }
+    
+    memcpy(&h->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    h->size       = size;
+    h->elements   = elements;
+    h->width      = width;
+    h->height     = height;
+    h->cell       = cell;
+    h->cols       = cols;
+    h->rows       = rows;
+    h->events     = (state_machine_event *) (h + 1);
+    h->rect       = (P(rect) *) (h->events + (2 * (size_t) elements));
+    h->cell_start = (unsigned int *) (h->rect + elements);
+    h->under      = h->cell_start + cells + 1;
+    h->scratch    = h->under + elements;
+    h->items      = NULL;
+    h->num_items  = 0;
+    h->num_under  = 0;
+    h->dirty      = 1;
+    
+    for (unsigned int e = 0; e < elements; e++)
+        { h->rect[e].x0 = h->rect[e].x1 = h->rect[e].y0 = h->rect[e].y1 = 0; }
+    
+    return h;
+    
+    err_allocate_hit:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_gui_hit *state_machine_gui_hit_new
+    (unsigned int elements, unsigned int width, unsigned int height,
+     unsigned int cell)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_gui_hit_new_using(elements, width, height, cell, &mgr);
+}
+
+
+void state_machine_gui_hit_free(state_machine_gui_hit *h)
+{
+    if (!h) { X(bad_arg); }
+    
+    if (h->items) { h->mgr.deallocate(h->items, sizeof(unsigned int) * h->num_items, h->mgr.user_arg); }
+    h->mgr.deallocate(h, h->size, h->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+int state_machine_gui_hit_set_rect
+    (state_machine_gui_hit *h, unsigned int element,
+     int x, int y, unsigned int width, unsigned int height)
+{
+    if (!h)                     { X(bad_arg); }
+    if (element >= h->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    P(rect) *r = &h->rect[element];
+    
+    r->x0 = P(clip)(x, h->width);
+    r->y0 = P(clip)(y, h->height);
+    r->x1 = P(clip)((long long) x + width, h->width);
+    r->y1 = P(clip)((long long) y + height, h->height);
+    
+    if ((r->x0 == r->x1) || (r->y0 == r->y1)) { r->x0 = r->x1 = r->y0 = r->y1 = 0; }
+    
+    h->dirty = 1;
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+const state_machine_event *state_machine_gui_hit_move
+    (state_machine_gui_hit *h, int x, int y, size_t *n)
+{
+    if (!h) { X(bad_arg); }
+    if (!n) { X(bad_arg); }
+    
+    if (h->dirty && !P(rebuild)(h)) { X(rebuild); }
+    
+    // the elements under the new position, in order
+    unsigned int count = 0;
+    
+    if ((x >= 0) && (y >= 0) && ((unsigned int) x < h->width) && ((unsigned int) y < h->height))
+    {
+        unsigned int px = (unsigned int) x;
+        unsigned int py = (unsigned int) y;
+        unsigned int c = ((py / h->cell) * h->cols) + (px / h->cell);
+        
+        for (unsigned int i = h->cell_start[c]; i < h->cell_start[c + 1]; i++)
+        {
+            unsigned int e = h->items[i];
+            P(rect) *r = &h->rect[e];
+            
+            if ((px >= r->x0) && (px < r->x1) && (py >= r->y0) && (py < r->y1))
+                { h->scratch[count++] = e; }
+        }
+    }
+    
+    // merge the old and new sets: leaves first, then enters
+    size_t num_events = 0;
+    unsigned int i = 0, j = 0;
+    
+    while ((i < h->num_under) || (j < count))
+    {
+        if ((j == count) || ((i < h->num_under) && (h->under[i] < h->scratch[j])))
+        {
+            h->events[num_events].element = h->under[i++];
+            h->events[num_events].action  = ACTION_GUI_MOUSE_LEAVE;
+            num_events++;
+        }
+        else if ((i == h->num_under) || (h->scratch[j] < h->under[i])) { j++; }
+        else { i++; j++; }
+    }
+    
+    for (i = 0, j = 0; j < count; j++)
+    {
+        while ((i < h->num_under) && (h->under[i] < h->scratch[j])) { i++; }
+        if ((i < h->num_under) && (h->under[i] == h->scratch[j])) { continue; }
+        
+        h->events[num_events].element = h->scratch[j];
+        h->events[num_events].action  = ACTION_GUI_MOUSE_ENTER;
+        num_events++;
+    }
+    
+    unsigned int *swap = h->under;
+    h->under = h->scratch;
+    h->scratch = swap;
+    h->num_under = count;
+    
+    *n = num_events;
+    
+    return h->events;
+    
+    err_rebuild:
+        *n = 0;
+    err_bad_arg:
+        return NULL;
+}
@@ -0,0 +1,234 @@
+/*
+ 
+ state-machine/models/gui/radio.c -
+ exclusive groups of checkable elements recording the checked member
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/models/gui.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+
+#define P(x) state_machine_gui_radio_private_##x
+
+
+struct state_machine_gui_radio
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding the arrays below
+    
+    state_machine_population *p;
+    unsigned int elements;
+    unsigned int groups;
+    
+    unsigned int *group;  // per element, or STATE_MACHINE_INVALID
+    unsigned int *holder; // per group, or STATE_MACHINE_INVALID
+};
+
+
+static int P(checked)(state_machine_gui_radio *r, unsigned int e)
+{
+    unsigned int state = state_machine_population_state(r->p, e);
+    return ((state & STATE_GUI_CHECKED) == STATE_GUI_CHECKED);
+}
+
+
+static void P(update)(state_machine_gui_radio *r, unsigned int e)
+{
+    unsigned int g = r->group[e];
+    if (g == STATE_MACHINE_INVALID) { return; }
+    
+    unsigned int *holder = &r->holder[g];
+    
+    if (P(checked)(r, e))
+    {
+        if (*holder == e) { return; }
+        
+        if (*holder != STATE_MACHINE_INVALID)
+            { state_machine_population_take_action(r->p, *holder, ACTION_GUI_UNCHECK); }
+        
+        *holder = e;
+    }
+    else if (*holder == e)
+    {
+        *holder = STATE_MACHINE_INVALID;
+    }
+}
+
+
+state_machine_gui_radio *state_machine_gui_radio_new_using
+    (state_machine_population *p, unsigned int groups,
+     bse_simple_memory_manager *mgr)
+{
+    if (!p)   { X(bad_arg); }
+    if (!mgr) { X(bad_arg); }
+    
+    unsigned int elements = state_machine_population_elements(p);
+    
+    size_t size = sizeof(state_machine_gui_radio)
+        + (sizeof(unsigned int) * ((size_t) elements + (size_t) groups));
+    
+    state_machine_gui_radio *r = mgr->allocate(size, mgr->user_arg);
+    if (!r) { X(allocate_radio); }
+    
+    memcpy(&r->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    r->size     = size;
+    r->p        = p;
+    r->elements = elements;
+    r->groups   = groups;
+    r->group    = (unsigned int *) (r + 1);
+    r->holder   = r->group + elements;
+    
+    for (unsigned int e = 0; e < elements; e++) { r->group[e] = STATE_MACHINE_INVALID; }
+    for (unsigned int g = 0; g < groups; g++)   { r->holder[g] = STATE_MACHINE_INVALID; }
+    
+    return r;
+    
+    err_allocate_radio:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_gui_radio *state_machine_gui_radio_new
+    (state_machine_population *p, unsigned int groups)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_gui_radio_new_using(p, groups, &mgr);
+}
+
+
+void state_machine_gui_radio_free(state_machine_gui_radio *r)
+{
+    if (!r) { X(bad_arg); }
+    
+    r->mgr.deallocate(r, r->size, r->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+int state_machine_gui_radio_join
+    (state_machine_gui_radio *r, unsigned int element, unsigned int group)
+{
+    if (!r)                     { X(bad_arg); }
+    if (element >= r->elements) { X4(bad_arg, "invalid element", 0, element); }
+    if ((group >= r->groups) && (group != STATE_MACHINE_INVALID))
+        { X4(bad_arg, "invalid group", 0, group); }
+    
+    unsigned int old = r->group[element];
+    
+    if ((old != STATE_MACHINE_INVALID) && (r->holder[old] == element))
+        { r->holder[old] = STATE_MACHINE_INVALID; }
+    
+    r->group[element] = group;
+    
+    if ((group != STATE_MACHINE_INVALID) && P(checked)(r, element))
+    {
+        if (r->holder[group] == STATE_MACHINE_INVALID)
+            { r->holder[group] = element; }
+        else
+            { state_machine_population_take_action(r->p, element, ACTION_GUI_UNCHECK); }
+    }
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_gui_radio_holder
+    (state_machine_gui_radio *r, unsigned int group)
+{
+    if (!r)                 { X(bad_arg); }
+    if (group >= r->groups) { X4(bad_arg, "invalid group", 0, group); }
+    
+    return r->holder[group];
+    
+    err_bad_arg:
+        return STATE_MACHINE_INVALID;
+}
+
+
+unsigned int state_machine_gui_radio_take_action
+    (state_machine_gui_radio *r, unsigned int element, unsigned int action)
+{
+    if (!r) { X(bad_arg); }
+    
+    unsigned int to = state_machine_population_take_action(r->p, element, action);
+    if (to) { P(update)(r, element); }
+    
+    return to;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+size_t state_machine_gui_radio_dispatch
+    (state_machine_gui_radio *r, const state_machine_event *events, size_t n)
+{
+    size_t taken = 0;
+    
+    if (!r)            { X(bad_arg); }
+    if (n && !events)  { X(bad_arg); }
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        if (events[i].element >= r->elements) { X4(bad_arg, "invalid element", 0, events[i].element); }
+        
+        if (state_machine_gui_radio_take_action(r, events[i].element, events[i].action)) { taken++; }
+    }
+    
+    return taken;
+    
+    err_bad_arg:
+        return taken;
+}
+
+
+int state_machine_gui_radio_sync(state_machine_gui_radio *r, unsigned int element)
+{
+    if (!r)                     { X(bad_arg); }
+    if (element >= r->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    P(update)(r, element);
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
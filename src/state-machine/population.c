@@ -0,0 +1,437 @@
+/*
+ 
+ state-machine/population.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/population.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+
+#define P(x) state_machine_population_private_##x
+
+
+struct state_machine_population
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding the arrays below
+    
+    state_machine *m;
+    unsigned int states;
+    unsigned int actions;
+    unsigned int elements;
+    
+    // for each element, its current state_index
+    unsigned int *state;
+    
+    // for each state index, a list of the elements in that state, linked
+    // through next and prev and terminated by STATE_MACHINE_INVALID
+    unsigned int *head;
+    unsigned int *next;
+    unsigned int *prev;
+    
+    // for each state index, the number of elements in that state
+    unsigned int *count;
+};
+
+
+static void P(unlink)(state_machine_population *p, unsigned int element)
+{
+    unsigned int next = p->next[element];
+    unsigned int prev = p->prev[element];
+    
+    if (prev != STATE_MACHINE_INVALID) { p->next[prev] = next; }
+    else { p->head[p->state[element]] = next; }
+    
+    if (next != STATE_MACHINE_INVALID) { p->prev[next] = prev; }
+    
+    p->count[p->state[element]]--;
+}
+
+
+static void P(link)(state_machine_population *p, unsigned int element, unsigned int index)
+{
+    unsigned int next = p->head[index];
+    
+    p->state[element] = index;
+    p->next[element]  = next;
+    p->prev[element]  = STATE_MACHINE_INVALID;
+    p->head[index]    = element;
+    
+    if (next != STATE_MACHINE_INVALID) { p->prev[next] = element; }
+    
+    p->count[index]++;
+}
+
+
+static void P(move)(state_machine_population *p, unsigned int element, unsigned int index)
+{
+    if (p->state[element] == index) { return; }
+    
+    P(unlink)(p, element);
+    P(link)(p, element, index);
+}
+
+
+state_machine_population *state_machine_population_new_using
+    (state_machine *m, unsigned int elements, unsigned int initial,
+     bse_simple_memory_manager *mgr)
+{
+    if (!m)   { X(bad_arg); }
+    if (!mgr) { X(bad_arg); }
+    
+    unsigned int index = state_machine_state_index(m, initial);
+    if (index == STATE_MACHINE_INVALID) { X4(bad_arg, "invalid initial state", 0, initial); }
+    
+    unsigned int states = state_machine_states(m);
+    
+    size_t size = sizeof(state_machine_population)
+        + (sizeof(unsigned int) * ((3 * (size_t) elements) + (2 * (size_t) states)));
+    
+    state_machine_population *p = mgr->allocate(size, mgr->user_arg);
+    if (!p) { X(allocate_population); }
+    
+    memcpy(&p->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    p->size     = size;
+    p->m        = m;
+    p->states   = states;
+    p->actions  = state_machine_actions(m);
+    p->elements = elements;
+    p->state    = (unsigned int *) (p + 1);
+    p->next     = p->state + elements;
+    p->prev     = p->next + elements;
+    p->head     = p->prev + elements;
+    p->count    = p->head + states;
+    
+    for (unsigned int i = 0; i < states; i++) { p->head[i] = STATE_MACHINE_INVALID; p->count[i] = 0; }
+    for (unsigned int i = elements; i-- > 0; ) { P(link)(p, i, index); }
+    
+    return p;
+    
+    err_allocate_population:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_population *state_machine_population_new
+    (state_machine *m, unsigned int elements, unsigned int initial)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_population_new_using(m, elements, initial, &mgr);
+}
+
+
+void state_machine_population_free(state_machine_population *p)
+{
+    if (!p) { X(bad_arg); }
+    
+    p->mgr.deallocate(p, p->size, p->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+state_machine *state_machine_population_machine(state_machine_population *p)
+{
+    if (!p) { X(bad_arg); }
+    
+    return p->m;
+    
+    err_bad_arg:
+        return NULL;
+}
+
+
+unsigned int state_machine_population_elements(state_machine_population *p)
+{
+    if (!p) { X(bad_arg); }
+    
+    return p->elements;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_population_state
+    (state_machine_population *p, unsigned int element)
+{
+    if (!p)                     { X(bad_arg); }
+    if (element >= p->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    return state_machine_state_id(p->m, p->state[element]);
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_population_set_state
+    (state_machine_population *p, unsigned int element, unsigned int state)
+{
+    if (!p)                     { X(bad_arg); }
+    if (element >= p->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    unsigned int index = state_machine_state_index(p->m, state);
+    if (index == STATE_MACHINE_INVALID) { X4(bad_arg, "invalid state", 0, state); }
+    
+    P(move)(p, element, index);
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_population_take_action
+    (state_machine_population *p, unsigned int element, unsigned int action)
+{
+    if (!p)                     { X(bad_arg); }
+    if (element >= p->elements) { X4(bad_arg, "invalid element", 0, element); }
+    if (action >= p->actions)   { X4(bad_arg, "invalid action", 0, action); }
+    
+    unsigned int to = state_machine_take_action_index(p->m, p->state[element], action);
+    if (to == STATE_MACHINE_INVALID) { return 0; }
+    
+    P(move)(p, element, to);
+    
+    return state_machine_state_id(p->m, to);
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+size_t state_machine_population_dispatch
+    (state_machine_population *p, const state_machine_event *events, size_t n)
+{
+    T_SCOPE(state_machine_population_dispatch);
+    
+    size_t taken = 0;
+    
+    if (!p)            { X(bad_arg); }
+    if (n && !events)  { X(bad_arg); }
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned int element = events[i].element;
+        unsigned int action  = events[i].action;
+        
+        if (element >= p->elements) { X4(bad_arg, "invalid element", 0, element); }
+        if (action >= p->actions)   { X4(bad_arg, "invalid action", 0, action); }
+        
+        unsigned int to = state_machine_take_action_index(p->m, p->state[element], action);
+        if (to == STATE_MACHINE_INVALID) { continue; }
+        
+        P(move)(p, element, to);
+        taken++;
+    }
+    
+    return taken;
+    
+    err_bad_arg:
+        return taken;
+}
+
+
+size_t state_machine_population_query
+    (state_machine_population *p, unsigned int mask,
+     unsigned int *elements, size_t max)
+{
+    size_t found = 0;
+    
+    if (!p)                { X(bad_arg); }
+    if (max && !elements)  { X(bad_arg); }
+    
+    for (unsigned int i = 0; i < p->states; i++)
+    {
+        if (p->head[i] == STATE_MACHINE_INVALID) { continue; }
+        
+        unsigned int id = state_machine_state_id(p->m, i);
+        if ((id & mask) != mask) { continue; }
+        
+        for (unsigned int e = p->head[i]; e != STATE_MACHINE_INVALID; e = p->next[e])
+        {
+            if (found < max) { elements[found] = e; }
+            found++;
+        }
+    }
+    
+    return found;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_population_first
+    (state_machine_population *p, unsigned int state)
+{
+    if (!p) { X(bad_arg); }
+    
+    unsigned int index = state_machine_state_index(p->m, state);
+    if (index == STATE_MACHINE_INVALID) { X4(bad_arg, "invalid state", 0, state); }
+    
+    return p->head[index];
+    
+    err_bad_arg:
+        return STATE_MACHINE_INVALID;
+}
+
+
+unsigned int state_machine_population_next
+    (state_machine_population *p, unsigned int element)
+{
+    if (!p)                     { X(bad_arg); }
+    if (element >= p->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    return p->next[element];
+    
+    err_bad_arg:
+        return STATE_MACHINE_INVALID;
+}
+
+
+unsigned int state_machine_population_census
+    (state_machine_population *p, unsigned int *counts, unsigned int n)
+{
+    if (!p)              { X(bad_arg); }
+    if (n && !counts)    { X(bad_arg); }
+    
+    if (n > p->states) { n = p->states; }
+    memcpy(counts, p->count, sizeof(unsigned int) * n);
+    
+    return p->states;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_population_count
+    (state_machine_population *p, unsigned int mask)
+{
+    unsigned int count = 0;
+    
+    if (!p) { X(bad_arg); }
+    
+    for (unsigned int i = 0; i < p->states; i++)
+    {
+        if (!p->count[i]) { continue; }
+        
+        unsigned int id = state_machine_state_id(p->m, i);
+        if ((id & mask) == mask) { count += p->count[i]; }
+    }
+    
+    return count;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+static char *P(put_uint)(char *s, unsigned int x)
+{
+    char digits[16];
+    unsigned int n = 0;
+    
+    do { digits[n++] = (char) ('0' + (x % 10)); x /= 10; } while (x);
+    while (n) { *s++ = digits[--n]; }
+    
+    return s;
+}
+
+
+int state_machine_population_print_census
+    (state_machine_write_fn write, void *arg, state_machine_population *p,
+     const char *title, const char **states, const char **actions,
+     const state_machine_cluster *clusters, unsigned int num_clusters)
+{
+    if (!p)     { X(bad_arg); }
+    if (!write) { X(bad_arg); }
+    
+    // each label is the state's name (or index), a space, and the count in
+    // brackets, so the nodes are still distinct
+    size_t size = sizeof(const char *) * p->states;
+    
+    for (unsigned int i = 0; i < p->states; i++)
+    {
+        size += (states && states[i]) ? strlen(states[i]) : 10;
+        size += sizeof(" ()") + 10;
+    }
+    
+    const char **labels = p->mgr.allocate(size, p->mgr.user_arg);
+    if (!labels) { X(allocate_labels); }
+    
+    char *text = (char *) (labels + p->states);
+    
+    for (unsigned int i = 0; i < p->states; i++)
+    {
+        labels[i] = text;
+        
+        if (states && states[i])
+        {
+            size_t length = strlen(states[i]);
+            memcpy(text, states[i], length);
+            text += length;
+        }
+        else
+        {
+            text = P(put_uint)(text, i);
+        }
+        
+        *text++ = ' ';
+        *text++ = '(';
+        text = P(put_uint)(text, p->count[i]);
+        *text++ = ')';
+        *text++ = '\0';
+    }
+    
+    int result = state_machine_print_using
+        (write, arg, p->m, title, labels, actions, clusters, num_clusters);
+    
+    p->mgr.deallocate(labels, size, p->mgr.user_arg);
+    
+    if (!result) { X(print); }
+    
+    return 1;
+    
+    err_print:
+    err_allocate_labels:
+    err_bad_arg:
+        return 0;
+}
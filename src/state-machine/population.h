@@ -0,0 +1,136 @@
+/*
+ 
+ state-machine/population.h
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ A population is a set of elements (for example the buttons on a screen) that
+ all share the behaviour of one state machine. Each element is just the index
+ of its current state, so applying a batch of events to a population touches
+ one small array and one transition table.
+ 
+ The population also keeps, for each state, a list of the elements in that
+ state, moving an element between lists in O(1) on each transition. Questions
+ such as "which elements are clicked" are then answered from the lists of the
+ matching states without looking at any other element. A count of the
+ elements in each state is kept the same way, giving a census of the
+ population at any moment without a scan.
+ 
+*/
+
+#ifndef STATE_MACHINE_POPULATION_H
+#define STATE_MACHINE_POPULATION_H
+
+#ifndef BSE_BASE_H
+#   include "base.h"
+#endif
+
+#include "state-machine/state-machine.h"
+#include <stddef.h> // size_t
+
+typedef struct state_machine_population state_machine_population;
+typedef struct state_machine_event state_machine_event;
+
+// An action applied to one element of a population
+struct state_machine_event
+{
+    unsigned int element;
+    unsigned int action;
+};
+
+// Create a population of elements that all start in the given state. The
+// machine is not copied and must outlive the population.
+state_machine_population *state_machine_population_new
+    (state_machine *m, unsigned int elements, unsigned int initial);
+
+// As state_machine_population_new, but accepts a structure indicating how
+// memory should be allocated and deallocated.
+state_machine_population *state_machine_population_new_using
+    (state_machine *m, unsigned int elements, unsigned int initial,
+     bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a population
+void state_machine_population_free(state_machine_population *p);
+
+// Return the machine and the number of elements of a population
+state_machine *state_machine_population_machine(state_machine_population *p);
+unsigned int state_machine_population_elements(state_machine_population *p);
+
+// Return the state ID of an element, or 0 for an invalid element.
+unsigned int state_machine_population_state
+    (state_machine_population *p, unsigned int element);
+
+// Force an element into a given state without taking an action.
+int state_machine_population_set_state
+    (state_machine_population *p, unsigned int element, unsigned int state);
+
+// Take an action on one element. Returns the new state ID, or 0 if there is no
+// transition (in which case the element is unchanged).
+unsigned int state_machine_population_take_action
+    (state_machine_population *p, unsigned int element, unsigned int action);
+
+// Apply a batch of events in order. Events without a transition are ignored.
+// Returns the number of events that caused a transition. An invalid event
+// stops the batch at that event.
+size_t state_machine_population_dispatch
+    (state_machine_population *p, const state_machine_event *events, size_t n);
+
+// Find the elements whose state ID contains every flag of a mask
+// ((state & mask) == mask), a mask of 0 matching every element. Up to max of
+// them are stored in elements, grouped by state. Returns the number of
+// elements that match, which may be more than max. Takes time proportional to
+// the number of states plus the number of matching elements.
+size_t state_machine_population_query
+    (state_machine_population *p, unsigned int mask,
+     unsigned int *elements, size_t max);
+
+// Iterate over the elements in exactly one state: returns the first element in
+// a state, or the element after a given one in the same state, or
+// STATE_MACHINE_INVALID when there are no more. The order is unspecified and
+// changes as elements move between states, so an element must not be moved
+// while iterating from it.
+unsigned int state_machine_population_first
+    (state_machine_population *p, unsigned int state);
+unsigned int state_machine_population_next
+    (state_machine_population *p, unsigned int element);
+
+// Copy the number of elements in each state, by state index, into counts,
+// storing at most n of them. Returns the number of states in the machine.
+unsigned int state_machine_population_census
+    (state_machine_population *p, unsigned int *counts, unsigned int n);
+
+// Return the number of elements whose state ID contains every flag of a mask
+// ((state & mask) == mask), in time proportional to the number of states.
+unsigned int state_machine_population_count
+    (state_machine_population *p, unsigned int mask);
+
+// As state_machine_print_using, with each state labelled with the number of
+// elements in that state, e.g. "EHfac (12)".
+int state_machine_population_print_census
+    (state_machine_write_fn write, void *arg, state_machine_population *p,
+     const char *title, const char **states, const char **actions,
+     const state_machine_cluster *clusters, unsigned int num_clusters);
+
+#endif
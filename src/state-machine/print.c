@@ -0,0 +1,300 @@
+/*
+ 
+ state-machine/print.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/state-machine.h"
+#include <stddef.h> // NULL
+#include <stdlib.h> // qsort
+#include <string.h> // strlen, memcpy
+#include <stdio.h> // fwrite
+
+#define P(x) state_machine_print_private_##x
+
+#define STATE_MACHINE_PRINT_BUFFER 16384
+
+
+typedef struct P(writer) P(writer);
+
+struct P(writer)
+{
+    state_machine_write_fn write;
+    void *arg;
+    int failed;
+    size_t used;
+    char buffer[STATE_MACHINE_PRINT_BUFFER];
+};
+
+
+static void P(flush)(P(writer) *w)
+{
+    if (w->used && !w->failed)
+        { if (!w->write(w->buffer, w->used, w->arg)) { w->failed = 1; } }
+    
+    w->used = 0;
+}
+
+
+static void P(put_n)(P(writer) *w, const char *s, size_t n)
+{
+    while (n)
+    {
+        if (w->used == STATE_MACHINE_PRINT_BUFFER) { P(flush)(w); }
+        
+        size_t space = STATE_MACHINE_PRINT_BUFFER - w->used;
+        size_t chunk = (n < space) ? n : space;
+        
+        memcpy(w->buffer + w->used, s, chunk);
+        w->used += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+
+static void P(put)(P(writer) *w, const char *s)
+{
+    P(put_n)(w, s, strlen(s));
+}
+
+
+static void P(put_uint)(P(writer) *w, unsigned int value)
+{
+    char digits[16];
+    size_t i = sizeof(digits);
+    
+    do
+    {
+        digits[--i] = (char) ('0' + (value % 10));
+        value /= 10;
+    } while (value);
+    
+    P(put_n)(w, digits + i, sizeof(digits) - i);
+}
+
+
+// text inside a double quoted DOT string, escaping double quotes and
+// backslashes
+static void P(put_escaped)(P(writer) *w, const char *s)
+{
+    for (const char *q = s; ; q++)
+    {
+        if ((*q != '"') && (*q != '\\') && (*q != '\0')) { continue; }
+        
+        P(put_n)(w, s, (size_t) (q - s));
+        if (*q == '\0') { break; }
+        
+        P(put_n)(w, "\\", 1);
+        s = q; // the character itself starts the next run
+    }
+}
+
+
+// a double quoted DOT identifier
+static void P(put_quoted)(P(writer) *w, const char *s)
+{
+    P(put_n)(w, "\"", 1);
+    P(put_escaped)(w, s);
+    P(put_n)(w, "\"", 1);
+}
+
+
+static void P(put_state)(P(writer) *w, const char **states, unsigned int index)
+{
+    if (states && states[index]) { P(put_quoted)(w, states[index]); return; }
+    
+    P(put_n)(w, "\"", 1);
+    P(put_uint)(w, index);
+    P(put_n)(w, "\"", 1);
+}
+
+
+// an edge to a target state by an action, sorted by target and then action
+typedef struct P(edge) P(edge);
+
+struct P(edge)
+{
+    unsigned int to;
+    unsigned int action;
+};
+
+
+static int P(compare)(const void *a, const void *b)
+{
+    const P(edge) *x = a;
+    const P(edge) *y = b;
+    
+    if (x->to != y->to) { return (x->to > y->to) - (x->to < y->to); }
+    return (x->action > y->action) - (x->action < y->action);
+}
+
+
+static int P(write_stream)(const char *data, size_t size, void *arg)
+{
+    return (fwrite(data, 1, size, (FILE *) arg) == size);
+}
+
+
+int state_machine_print_using
+    (state_machine_write_fn write, void *arg, state_machine *m,
+     const char *title, const char **states, const char **actions,
+     const state_machine_cluster *clusters, unsigned int num_clusters)
+{
+    P(writer) *w = NULL;
+    P(edge) *edges = NULL;
+    
+    if (!write)                     { X(bad_arg); }
+    if (!m)                         { X(bad_arg); }
+    if (!title)                     { X(bad_arg); }
+    if (!actions)                   { X(bad_arg); }
+    if (num_clusters && !clusters)  { X(bad_arg); }
+    
+    unsigned int num_states  = state_machine_states(m);
+    unsigned int num_actions = state_machine_actions(m);
+    
+    // working memory comes from the machine's own memory manager
+    size_t edges_size = sizeof(P(edge)) * (num_actions ? num_actions : 1);
+    
+    w = state_machine_allocate(m, sizeof(P(writer)));
+    if (!w) { X(allocate); }
+    
+    edges = state_machine_allocate(m, edges_size);
+    if (!edges) { X(allocate); }
+    
+    w->write  = write;
+    w->arg    = arg;
+    w->failed = 0;
+    w->used   = 0;
+    
+    P(put)(w, "digraph ");
+    P(put_quoted)(w, title);
+    P(put)(w, " {\n");
+    
+    for (unsigned int c = 0; c < num_clusters; c++)
+    {
+        P(put)(w, "    subgraph \"cluster_");
+        P(put_uint)(w, c);
+        P(put)(w, "\" {\n        label=");
+        P(put_quoted)(w, clusters[c].label ? clusters[c].label : "");
+        P(put)(w, "\n");
+        
+        for (unsigned int i = 0; i < num_states; i++)
+        {
+            unsigned int id = state_machine_state_id(m, i);
+            if (!id) { continue; }
+            
+            // the first matching cluster only
+            unsigned int first = 0;
+            while ((first < num_clusters) && ((id & clusters[first].flag) != clusters[first].flag))
+                { first++; }
+            if (first != c) { continue; }
+            
+            P(put)(w, "        ");
+            P(put_state)(w, states, i);
+            P(put)(w, "\n");
+        }
+        
+        P(put)(w, "    }\n");
+    }
+    
+    for (unsigned int i = 0; i < num_states; i++)
+    {
+        unsigned int n = 0;
+        
+        for (unsigned int j = 0; j < num_actions; j++)
+        {
+            unsigned int to = state_machine_take_action_index(m, i, j);
+            if (to >= num_states) { continue; }
+            
+            edges[n].to     = to;
+            edges[n].action = j;
+            n++;
+        }
+        
+        qsort(edges, n, sizeof(P(edge)), P(compare));
+        
+        // one edge per target, labelled with every action that leads there
+        for (unsigned int e = 0; e < n; e++)
+        {
+            if ((e == 0) || (edges[e].to != edges[e - 1].to))
+            {
+                P(put)(w, "    ");
+                P(put_state)(w, states, i);
+                P(put)(w, " -> ");
+                P(put_state)(w, states, edges[e].to);
+                P(put)(w, " [ label=\"");
+            }
+            else
+            {
+                P(put)(w, ", ");
+            }
+            
+            P(put_escaped)(w, actions[edges[e].action]);
+            
+            if ((e + 1 == n) || (edges[e + 1].to != edges[e].to))
+                { P(put)(w, "\" ]\n"); }
+        }
+    }
+    
+    P(put)(w, "}\n");
+    P(flush)(w);
+    
+    int ok = !w->failed;
+    
+    state_machine_deallocate(m, edges, edges_size);
+    state_machine_deallocate(m, w, sizeof(P(writer)));
+    
+    if (!ok) { X(write); }
+    
+    return 1;
+    
+    err_write:
+        return 0;
+    
+    err_allocate:
+        state_machine_deallocate(m, edges, edges_size);
+        state_machine_deallocate(m, w, sizeof(P(writer)));
+    err_bad_arg:
+        return 0;
+}
+
+
+void state_machine_print
+    (FILE *stream, state_machine *m,
+     const char *title, const char **states, const char **actions)
+{
+    if (!stream) { X(bad_arg); }
+    
+    state_machine_print_using(P(write_stream), stream, m, title, states, actions, NULL, 0);
+    fflush(stream);
+    
+    err_bad_arg:
+        return;
+}
@@ -0,0 +1,280 @@
+/*
+ 
+ state-machine/registry.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/registry.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+
+#define P(x) state_machine_registry_private_##x
+
+
+struct state_machine_registry
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding everything below
+    
+    unsigned int types;
+    unsigned int actions;
+    
+    // states of type t are rows offset[t] to offset[t + 1] - 1 of the arena
+    unsigned int *offset;
+    
+    // map row -> state_id
+    unsigned int *state_id;
+    
+    // lookup index: for each type, in its rows, the state IDs of the type in
+    // ascending order, and for each the state index it maps to
+    unsigned int *index_id;
+    unsigned int *index_of;
+    
+    // for each row, map actions -> state index local to the row's type
+    unsigned int *transitions;
+};
+
+
+state_machine_registry *state_machine_registry_new_using
+    (state_machine **machines, unsigned int types, bse_simple_memory_manager *mgr)
+{
+    if (!machines) { X(bad_arg); }
+    if (!types)    { X(bad_arg); }
+    if (!mgr)      { X(bad_arg); }
+    
+    unsigned int actions = 0;
+    size_t rows = 0;
+    
+    for (unsigned int t = 0; t < types; t++)
+    {
+        if (!machines[t]) { X4(bad_arg, "null machine", 0, t); }
+        
+        unsigned int a = state_machine_actions(machines[t]);
+        if (t == 0) { actions = a; }
+        if (a != actions) { X4(bad_arg, "machines must share an alphabet", 0, t); }
+        
+        rows += state_machine_states(machines[t]);
+    }
+    
+    size_t size = sizeof(state_machine_registry)
+        + (sizeof(unsigned int) * (types + 1u))
+        + (sizeof(unsigned int) * rows * 3)
+        + (sizeof(unsigned int) * rows * actions);
+    
+    state_machine_registry *r = mgr->allocate(size, mgr->user_arg);
+    if (!r) { X(allocate_registry); }
+    
+    memcpy(&r->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    r->size        = size;
+    r->types       = types;
+    r->actions     = actions;
+    r->offset      = (unsigned int *) (r + 1);
+    r->state_id    = r->offset + types + 1;
+    r->index_id    = r->state_id + rows;
+    r->index_of    = r->index_id + rows;
+    r->transitions = r->index_of + rows;
+    
+    unsigned int row = 0;
+    
+    for (unsigned int t = 0; t < types; t++)
+    {
+        state_machine *m = machines[t];
+        unsigned int states = state_machine_states(m);
+        
+        r->offset[t] = row;
+        
+        for (unsigned int i = 0; i < states; i++, row++)
+        {
+            unsigned int id = state_machine_state_id(m, i);
+            r->state_id[row] = id;
+            
+            // insert after any equal ID, so a repeated ID finds its lowest index
+            unsigned int k = row;
+            while ((k > r->offset[t]) && (r->index_id[k - 1] > id))
+            {
+                r->index_id[k] = r->index_id[k - 1];
+                r->index_of[k] = r->index_of[k - 1];
+                k--;
+            }
+            
+            r->index_id[k] = id;
+            r->index_of[k] = i;
+            
+            unsigned int *to = &r->transitions[(size_t) row * actions];
+            for (unsigned int a = 0; a < actions; a++)
+                { to[a] = state_machine_take_action_index(m, i, a); }
+        }
+    }
+    
+    r->offset[types] = row;
+    
+    return r;
+    
+    err_allocate_registry:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_registry *state_machine_registry_new
+    (state_machine **machines, unsigned int types)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_registry_new_using(machines, types, &mgr);
+}
+
+
+void state_machine_registry_free(state_machine_registry *r)
+{
+    if (!r) { X(bad_arg); }
+    
+    r->mgr.deallocate(r, r->size, r->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+int state_machine_registry_element_init
+    (state_machine_registry *r, state_machine_registry_element *e,
+     unsigned int type, unsigned int state)
+{
+    if (!r)               { X(bad_arg); }
+    if (!e)               { X(bad_arg); }
+    if (type >= r->types) { X4(bad_arg, "invalid type", 0, type); }
+    if (!state)           { X2(bad_arg, "state must be non-zero"); }
+    
+    // the first entry of the type's lookup index not less than the state
+    unsigned int lo = r->offset[type];
+    unsigned int hi = r->offset[type + 1];
+    
+    while (lo < hi)
+    {
+        unsigned int mid = lo + ((hi - lo) / 2);
+        if (r->index_id[mid] < state) { lo = mid + 1; } else { hi = mid; }
+    }
+    
+    if ((lo == r->offset[type + 1]) || (r->index_id[lo] != state))
+        { X4(bad_arg, "invalid state", 0, state); }
+    
+    e->type  = type;
+    e->state = r->index_of[lo];
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+static int P(valid)(state_machine_registry *r, const state_machine_registry_element *e)
+{
+    return (e->type < r->types)
+        && (e->state < (r->offset[e->type + 1] - r->offset[e->type]));
+}
+
+
+unsigned int state_machine_registry_state
+    (state_machine_registry *r, const state_machine_registry_element *e)
+{
+    if (!r)              { X(bad_arg); }
+    if (!e)              { X(bad_arg); }
+    if (!P(valid)(r, e)) { X(bad_arg); }
+    
+    return r->state_id[r->offset[e->type] + e->state];
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_registry_take_action
+    (state_machine_registry *r, state_machine_registry_element *e,
+     unsigned int action)
+{
+    if (!r)                   { X(bad_arg); }
+    if (!e)                   { X(bad_arg); }
+    if (!P(valid)(r, e))      { X(bad_arg); }
+    if (action >= r->actions) { X4(bad_arg, "invalid action", 0, action); }
+    
+    unsigned int base = r->offset[e->type];
+    unsigned int to = r->transitions[((size_t) (base + e->state) * r->actions) + action];
+    if (to == STATE_MACHINE_INVALID) { return 0; }
+    
+    e->state = to;
+    
+    return r->state_id[base + to];
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+size_t state_machine_registry_dispatch
+    (state_machine_registry *r, state_machine_registry_element *elements,
+     unsigned int num_elements, const state_machine_event *events, size_t n)
+{
+    size_t taken = 0;
+    
+    if (!r)                          { X(bad_arg); }
+    if (num_elements && !elements)   { X(bad_arg); }
+    if (n && !events)                { X(bad_arg); }
+    
+    const unsigned int *offset      = r->offset;
+    const unsigned int *transitions = r->transitions;
+    unsigned int actions            = r->actions;
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned int element = events[i].element;
+        unsigned int action  = events[i].action;
+        
+        if (element >= num_elements) { X4(bad_arg, "invalid element", 0, element); }
+        if (action >= actions)       { X4(bad_arg, "invalid action", 0, action); }
+        
+        state_machine_registry_element *e = &elements[element];
+        if (!P(valid)(r, e)) { X4(bad_arg, "invalid element state", 0, element); }
+        
+        unsigned int to = transitions[((size_t) (offset[e->type] + e->state) * actions) + action];
+        if (to == STATE_MACHINE_INVALID) { continue; }
+        
+        e->state = to;
+        taken++;
+    }
+    
+    return taken;
+    
+    err_bad_arg:
+        return taken;
+}
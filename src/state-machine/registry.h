@@ -0,0 +1,98 @@
+/*
+ 
+ state-machine/registry.h
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ A registry packs the transition tables of many machine types (for example a
+ button, a checkbox and a slider) that share one alphabet of actions into a
+ single contiguous block, addressed through a small table of per-type offsets.
+ An element of a mixed population is then just a (type, state index) pair and
+ dispatching events over mixed elements reads from one block of memory instead
+ of following a different pointer for each element.
+ 
+ The registry is a snapshot: changing a machine after the registry has been
+ created has no effect on the registry.
+ 
+*/
+
+#ifndef STATE_MACHINE_REGISTRY_H
+#define STATE_MACHINE_REGISTRY_H
+
+#ifndef BSE_BASE_H
+#   include "base.h"
+#endif
+
+#include "state-machine/state-machine.h"
+#include "state-machine/population.h" // state_machine_event
+#include <stddef.h> // size_t
+
+typedef struct state_machine_registry state_machine_registry;
+typedef struct state_machine_registry_element state_machine_registry_element;
+
+// An element of a mixed population
+struct state_machine_registry_element
+{
+    unsigned int type;  // index into the machines given to the registry
+    unsigned int state; // state index within that machine
+};
+
+// Create a registry from an array of machines which must all have the same
+// number of actions. Machine i is identified by type i.
+state_machine_registry *state_machine_registry_new
+    (state_machine **machines, unsigned int types);
+
+// As state_machine_registry_new, but accepts a structure indicating how memory
+// should be allocated and deallocated.
+state_machine_registry *state_machine_registry_new_using
+    (state_machine **machines, unsigned int types, bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a registry
+void state_machine_registry_free(state_machine_registry *r);
+
+// Initialise an element of a given type in a given state (by ID).
+int state_machine_registry_element_init
+    (state_machine_registry *r, state_machine_registry_element *e,
+     unsigned int type, unsigned int state);
+
+// Return the state ID of an element, or 0 if the element is invalid.
+unsigned int state_machine_registry_state
+    (state_machine_registry *r, const state_machine_registry_element *e);
+
+// Take an action on an element. Returns the new state ID, or 0 if there is no
+// transition (in which case the element is unchanged).
+unsigned int state_machine_registry_take_action
+    (state_machine_registry *r, state_machine_registry_element *e,
+     unsigned int action);
+
+// Apply a batch of events in order to an array of num_elements mixed
+// elements. Events without a transition are ignored. Returns the number of
+// events that caused a transition. An invalid event, including one for an
+// element whose type or state is out of range, stops the batch.
+size_t state_machine_registry_dispatch
+    (state_machine_registry *r, state_machine_registry_element *elements,
+     unsigned int num_elements, const state_machine_event *events, size_t n);
+
+#endif
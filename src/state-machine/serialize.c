@@ -0,0 +1,256 @@
+/*
+ 
+ state-machine/serialize.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ Format: the 7 bytes "SMMODEL" followed by a version byte (1), then unsigned
+ LEB128 varints: the number of states and of actions, the ID of each state
+ (0 for a slot without a state), and then for each state in turn, for each
+ action, the ID of the target state (0 for no transition). If any state has a
+ non-zero payload, the payload of each state follows.
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/state-machine.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy, memcmp
+
+#define P(x) state_machine_serialize_private_##x
+
+#define STATE_MACHINE_SERIALIZE_BUFFER 4096
+#define STATE_MACHINE_SERIALIZE_MAGIC "SMMODEL\1"
+#define STATE_MACHINE_SERIALIZE_MAGIC_SIZE 8
+
+
+typedef struct P(writer) P(writer);
+
+struct P(writer)
+{
+    state_machine_write_fn write;
+    void *arg;
+    int failed;
+    size_t used;
+    unsigned char buffer[STATE_MACHINE_SERIALIZE_BUFFER];
+};
+
+
+static void P(flush)(P(writer) *w)
+{
+    if (w->used && !w->failed)
+        { if (!w->write((const char *) w->buffer, w->used, w->arg)) { w->failed = 1; } }
+    
+    w->used = 0;
+}
+
+
+static void P(put_varint)(P(writer) *w, unsigned int value)
+{
+    if (w->used > STATE_MACHINE_SERIALIZE_BUFFER - 5) { P(flush)(w); }
+    
+    while (value >= 0x80)
+    {
+        w->buffer[w->used++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    
+    w->buffer[w->used++] = (unsigned char) value;
+}
+
+
+// returns NULL if the varint is truncated or too long
+static const unsigned char *P(get_varint)
+    (const unsigned char *in, const unsigned char *end, unsigned int *value)
+{
+    unsigned int result = 0;
+    
+    for (unsigned int shift = 0; shift < 35; shift += 7)
+    {
+        if (in == end) { return NULL; }
+        
+        unsigned int byte = *in++;
+        result |= (byte & 0x7F) << shift;
+        
+        if (byte < 0x80) { *value = result; return in; }
+    }
+    
+    return NULL;
+}
+
+
+int state_machine_save
+    (state_machine_write_fn write, void *arg, state_machine *m)
+{
+    P(writer) w;
+    
+    if (!write) { X(bad_arg); }
+    if (!m)     { X(bad_arg); }
+    
+    unsigned int states  = state_machine_states(m);
+    unsigned int actions = state_machine_actions(m);
+    
+    w.write  = write;
+    w.arg    = arg;
+    w.failed = 0;
+    w.used   = STATE_MACHINE_SERIALIZE_MAGIC_SIZE;
+    
+    memcpy(w.buffer, STATE_MACHINE_SERIALIZE_MAGIC, STATE_MACHINE_SERIALIZE_MAGIC_SIZE);
+    
+    P(put_varint)(&w, states);
+    P(put_varint)(&w, actions);
+    
+    for (unsigned int i = 0; i < states; i++)
+        { P(put_varint)(&w, state_machine_state_id(m, i)); }
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        for (unsigned int j = 0; j < actions; j++)
+        {
+            unsigned int to = state_machine_take_action_index(m, i, j);
+            P(put_varint)(&w, (to == STATE_MACHINE_INVALID) ? 0 : state_machine_state_id(m, to));
+        }
+    }
+    
+    unsigned int payloads = 0;
+    
+    for (unsigned int i = 0; i < states; i++)
+        { payloads |= state_machine_payload_index(m, i); }
+    
+    if (payloads)
+    {
+        for (unsigned int i = 0; i < states; i++)
+            { P(put_varint)(&w, state_machine_payload_index(m, i)); }
+    }
+    
+    P(flush)(&w);
+    if (w.failed) { X(write); }
+    
+    return 1;
+    
+    err_write:
+    err_bad_arg:
+        return 0;
+}
+
+
+state_machine *state_machine_load_using
+    (const void *data, size_t size, bse_simple_memory_manager *mgr)
+{
+    T_SCOPE(state_machine_load_using);
+    
+    state_machine *m = NULL;
+    unsigned int states, actions;
+    
+    if (!data)  { X(bad_arg); }
+    if (!mgr)   { X(bad_arg); }
+    
+    if ((size < STATE_MACHINE_SERIALIZE_MAGIC_SIZE)
+     || memcmp(data, STATE_MACHINE_SERIALIZE_MAGIC, STATE_MACHINE_SERIALIZE_MAGIC_SIZE))
+        { X2(bad_arg, "not a serialized machine, or an unsupported version"); }
+    
+    const unsigned char *in  = (const unsigned char *) data + STATE_MACHINE_SERIALIZE_MAGIC_SIZE;
+    const unsigned char *end = (const unsigned char *) data + size;
+    
+    in = P(get_varint)(in, end, &states);  if (!in) { X2(bad_arg, "truncated"); }
+    in = P(get_varint)(in, end, &actions); if (!in) { X2(bad_arg, "truncated"); }
+    
+    // every state and transition takes at least one byte
+    if ((size_t) (end - in) < states) { X2(bad_arg, "truncated"); }
+    if (actions && (((size_t) (end - in) - states) / actions < states)) { X2(bad_arg, "truncated"); }
+    
+    m = state_machine_new_using(states, actions, mgr);
+    if (!m) { X(new); }
+    
+    // state IDs, which are kept to look up transitions below
+    const unsigned char *ids = in;
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int id;
+        in = P(get_varint)(in, end, &id); if (!in) { X2(malformed, "truncated"); }
+        
+        if (id && !state_machine_add_state(m, id)) { X2(malformed, "bad state"); }
+    }
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int from = 0;
+        ids = P(get_varint)(ids, end, &from);
+        
+        for (unsigned int j = 0; j < actions; j++)
+        {
+            unsigned int to;
+            in = P(get_varint)(in, end, &to); if (!in) { X2(malformed, "truncated"); }
+            
+            if (!to) { continue; }
+            if (!from) { X2(malformed, "transition from an empty slot"); }
+            
+            if (!state_machine_add_transition(m, j, from, to)) { X2(malformed, "bad transition"); }
+        }
+    }
+    
+    // optional payloads
+    if (in != end)
+    {
+        ids = (const unsigned char *) data + STATE_MACHINE_SERIALIZE_MAGIC_SIZE;
+        ids = P(get_varint)(ids, end, &states);
+        ids = P(get_varint)(ids, end, &actions);
+        
+        for (unsigned int i = 0; i < states; i++)
+        {
+            unsigned int id = 0, payload;
+            ids = P(get_varint)(ids, end, &id);
+            in  = P(get_varint)(in, end, &payload); if (!in) { X2(malformed, "truncated"); }
+            
+            if (!payload) { continue; }
+            if (!id) { X2(malformed, "payload of an empty slot"); }
+            
+            if (!state_machine_set_payload(m, id, payload)) { X2(malformed, "bad payload"); }
+        }
+    }
+    
+    if (in != end) { X2(malformed, "trailing data"); }
+    
+    return m;
+    
+    err_malformed:
+        state_machine_free(m);
+    err_new:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine *state_machine_load(const void *data, size_t size)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_load_using(data, size, &mgr);
+}
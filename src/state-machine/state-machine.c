@@ -33,85 +33,914 @@
 #include "state-machine/state-machine.h"
 #include <stddef.h> // NULL
 #include <limits.h> // UINT_MAX
+#include <stdint.h> // SIZE_MAX
 #include <string.h> // memcpy
-#include <stdio.h> // printf
+#include <stdlib.h> // qsort
 #include <assert.h>
 
+#ifdef BSE_LINUX
+#   include <pthread.h>
+#   include <unistd.h> // sysconf
+#endif
+
 #define P(x) state_machine_private_##x
 
 
+// All of a machine lives in one allocation, in this order:
+//     struct state_machine
+//     state_id[states]
+//     index_id[states], index_of[states]
+//     transitions[states * stride] (aligned to STATE_MACHINE_TABLE_ALIGN, or
+//         to STATE_MACHINE_CACHE_LINE for a machine from state_machine_new_aligned)
+//
+// Each row of transitions has a column after the last action holding the
+// payload of its state (see state_machine_set_payload), so that the payload
+// of a state shares a cache line with the transitions out of it. For an
+// aligned machine this column usually falls in the padding of the row.
+//
+// A frozen machine with the sparse layout (see state_machine_freeze) has no
+// transitions table. In its place, in compressed sparse row form:
+//     row_start[states + 1]
+//     edge_action[edges], edge_to[edges]
+// where the edges of state i are row_start[i] to row_start[i + 1] - 1, sorted
+// by action.
+//
+// A frozen machine indexes its tables by action class (actions that behave
+// identically in every state share a class) instead of by action. Then, where
+// there are fewer classes than actions, after the lookup index comes
+//     action_class[actions]
+// and each of the layouts below has a column per class instead of per action.
+//
+// With the rows layout, transitions holds only the distinct rows, followed by
+//     row_of[states]
+// mapping each state_index to its row in transitions.
+//
+// With the defaults layout, each action has a default target and a list of
+// exceptions, sorted by state_index:
+//     col_default[actions]
+//     exc_start[actions + 1]
+//     exc_state[exceptions], exc_to[exceptions]
+//
+// The sparse and defaults layouts have no rows, so their tables are followed
+// by the payloads of the states:
+//     payload[states]
+//
+// A clone (see state_machine_clone_cow) shares the state IDs, lookup index
+// and rows of its base machine. Its allocation holds only
+//     struct state_machine
+//     row[states]
+// pointing each state_index at its row, either in the base's transitions or,
+// once the clone has modified it, in a copy allocated separately.
+#define STATE_MACHINE_TABLE_ALIGN 16
+
 struct state_machine
 {
     bse_simple_memory_manager mgr;
+    bse_aligned_memory_manager aligned_mgr; // used instead if alignment > 0
+    size_t alignment;
+    size_t size; // of the whole allocation
     
     unsigned int states;
     unsigned int actions;
+    unsigned int stride; // row width of transitions (> actions, see payloads)
+    unsigned int count; // number of states added so far
     
     // map state_index -> state_id
     unsigned int *state_id;
     
-    // for each state_index, map actions -> state_index
+    // lookup index: the state IDs added so far in ascending order, and for
+    // each the state_index it maps to
+    unsigned int *index_id;
+    unsigned int *index_of;
+    
+    int layout; // STATE_MACHINE_LAYOUT_*
+    int frozen; // if set, the machine may not be modified
+    
+    // tables are indexed by action class rather than by action if this map
+    // from action -> class is present (frozen machines only)
+    unsigned int columns; // number of action classes
+    unsigned int *action_class;
+    
+    // for each state_index (or distinct row), map actions -> state_index
     unsigned int *transitions;
+    
+    // sparse layout only
+    unsigned int edges;
+    unsigned int *row_start;
+    unsigned int *edge_action;
+    unsigned int *edge_to;
+    
+    // rows layout only
+    unsigned int distinct_rows;
+    unsigned int *row_of;
+    
+    // defaults layout only
+    unsigned int exceptions;
+    unsigned int *col_default;
+    unsigned int *exc_start;
+    unsigned int *exc_state;
+    unsigned int *exc_to;
+    
+    // sparse and defaults layouts only; the others keep payloads in the rows
+    unsigned int *payload;
+    
+    // clone layout only
+    state_machine *base;
+    unsigned int **row;
+    unsigned int copied; // number of rows copied from the base
+    
+    // number of clones sharing this machine's rows, which may not be modified
+    // while there are any
+    unsigned int clones;
 };
 
 
-static void *P(new)(state_machine *m, size_t size)
+static size_t P(align)(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+
+// Row width of a dense table with a column for each action and one for the
+// payload, padding each row to a multiple of alignment
+static unsigned int P(stride)(unsigned int actions, size_t alignment)
+{
+    if (!alignment) { return actions + 1; }
+    
+    unsigned int line = (unsigned int) (alignment / sizeof(unsigned int));
+    return ((actions + line) / line) * line;
+}
+
+
+// Compute the offsets of each table within the block and the block size
+static size_t P(offsets)
+    (unsigned int states, unsigned int stride, size_t table_align,
+     size_t *offset_ids, size_t *offset_index, size_t *offset_table)
+{
+    *offset_ids   = P(align)(sizeof(state_machine), sizeof(unsigned int));
+    *offset_index = *offset_ids + (sizeof(unsigned int) * states);
+    *offset_table = P(align)(*offset_index + (2 * sizeof(unsigned int) * states),
+                             table_align);
+    
+    return *offset_table + (sizeof(unsigned int) * states * stride);
+}
+
+
+static size_t P(size)
+    (unsigned int states, unsigned int stride, size_t table_align)
+{
+    size_t ids, index, table;
+    return P(offsets)(states, stride, table_align, &ids, &index, &table);
+}
+
+
+// Whether the block P(size) computes fits in a size_t, as it may not on a
+// 32-bit target even when states * stride fits in an unsigned int
+static int P(fits)(unsigned int states, unsigned int stride, size_t table_align)
+{
+    size_t fixed = sizeof(state_machine) + table_align;
+    size_t per_state = sizeof(unsigned int) * ((size_t) stride + 3u);
+    
+    return states <= ((SIZE_MAX - fixed) / per_state);
+}
+
+
+// Lay out a machine in a block of memory of the size given by P(size)
+static state_machine *P(place)
+    (char *block, unsigned int states, unsigned int actions,
+     unsigned int stride, size_t table_align)
+{
+    size_t offset_ids, offset_index, offset_table;
+    
+    state_machine *m = (state_machine *) block;
+    
+    m->size    = P(offsets)(states, stride, table_align,
+                            &offset_ids, &offset_index, &offset_table);
+    m->states  = states;
+    m->actions = actions;
+    m->stride  = stride;
+    
+    m->state_id    = (unsigned int *) (block + offset_ids);
+    m->index_id    = (unsigned int *) (block + offset_index);
+    m->index_of    = m->index_id + states;
+    m->transitions = (unsigned int *) (block + offset_table);
+    
+    m->layout       = STATE_MACHINE_LAYOUT_DENSE;
+    m->frozen       = 0;
+    m->columns      = actions;
+    m->action_class = NULL;
+    m->edges       = 0;
+    m->row_start   = NULL;
+    m->edge_action = NULL;
+    m->edge_to     = NULL;
+    
+    m->distinct_rows = 0;
+    m->row_of        = NULL;
+    
+    m->exceptions  = 0;
+    m->col_default = NULL;
+    m->exc_start   = NULL;
+    m->exc_state   = NULL;
+    m->exc_to      = NULL;
+    m->payload     = NULL;
+    
+    m->base   = NULL;
+    m->row    = NULL;
+    m->copied = 0;
+    m->clones = 0;
+    
+    return m;
+}
+
+
+// Branch-light search of n sorted keys: find the last key <= the given key,
+// then check that it is an exact match. Returns its position or UINT_MAX.
+static unsigned int P(search)
+    (const unsigned int *keys, unsigned int n, unsigned int key)
+{
+    if (!n) { return UINT_MAX; }
+    
+    const unsigned int *base = keys;
+    
+    while (n > 1)
+    {
+        unsigned int half = n >> 1;
+        base = (base[half] <= key) ? (base + half) : base;
+        n -= half;
+    }
+    
+    if (*base != key) { return UINT_MAX; }
+    
+    return (unsigned int) (base - keys);
+}
+
+
+// map (state_index, action) -> state_index for any layout
+static unsigned int P(lookup)
+    (const state_machine *m, unsigned int index, unsigned int action)
+{
+    unsigned int lo, i;
+    
+    if (m->action_class) { action = m->action_class[action]; }
+    
+    switch (m->layout)
+    {
+        case STATE_MACHINE_LAYOUT_DENSE:
+            return m->transitions[(index * m->stride) + action];
+        
+        case STATE_MACHINE_LAYOUT_ROWS:
+            return m->transitions[(m->row_of[index] * m->stride) + action];
+        
+        case STATE_MACHINE_LAYOUT_CLONE:
+            return m->row[index][action];
+        
+        case STATE_MACHINE_LAYOUT_SPARSE:
+            lo = m->row_start[index];
+            i  = P(search)(m->edge_action + lo, m->row_start[index + 1] - lo, action);
+            return (i == UINT_MAX) ? STATE_MACHINE_INVALID : m->edge_to[lo + i];
+        
+        default: // STATE_MACHINE_LAYOUT_DEFAULTS
+            lo = m->exc_start[action];
+            i  = P(search)(m->exc_state + lo, m->exc_start[action + 1] - lo, index);
+            return (i == UINT_MAX) ? m->col_default[action] : m->exc_to[lo + i];
+    }
+}
+
+
+// the payload of a state_index for any layout
+static unsigned int *P(payload)(const state_machine *m, unsigned int index)
+{
+    switch (m->layout)
+    {
+        case STATE_MACHINE_LAYOUT_DENSE:
+            return &m->transitions[(index * m->stride) + m->columns];
+        
+        case STATE_MACHINE_LAYOUT_ROWS:
+            return &m->transitions[(m->row_of[index] * m->stride) + m->columns];
+        
+        case STATE_MACHINE_LAYOUT_CLONE:
+            return &m->row[index][m->columns];
+        
+        default: // STATE_MACHINE_LAYOUT_SPARSE, STATE_MACHINE_LAYOUT_DEFAULTS
+            return &m->payload[index];
+    }
+}
+
+
+state_machine *state_machine_new_using
+    (unsigned int states, unsigned int actions, bse_simple_memory_manager *mgr)
+{
+    T_SCOPE(state_machine_new_using);
+    
+    if (!mgr) { X(bad_arg); }
+    if (actions == UINT_MAX) { X2(bad_arg, "table too large"); }
+    
+    unsigned int stride = P(stride)(actions, 0);
+    if (states > UINT_MAX / stride) { X2(bad_arg, "table too large"); }
+    if (!P(fits)(states, stride, STATE_MACHINE_TABLE_ALIGN)) { X2(bad_arg, "table too large"); }
+    
+    size_t size = P(size)(states, stride, STATE_MACHINE_TABLE_ALIGN);
+    
+    char *block = mgr->allocate(size, mgr->user_arg);
+    if (!block) { X(allocate_state_machine); }
+    
+    state_machine *m = P(place)(block, states, actions, stride, STATE_MACHINE_TABLE_ALIGN);
+    memcpy(&m->mgr, mgr, sizeof(bse_simple_memory_manager));
+    m->alignment = 0;
+    
+    state_machine_clear(m);
+    
+    return m;
+    
+    err_allocate_state_machine:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine *state_machine_new(unsigned int states, unsigned int actions)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_new_using(states, actions, &mgr);
+}
+
+
+state_machine *state_machine_new_aligned
+    (unsigned int states, unsigned int actions, bse_aligned_memory_manager *mgr)
+{
+    T_SCOPE(state_machine_new_aligned);
+    
+    bse_aligned_memory_manager default_mgr;
+    
+    if (!mgr)
+    {
+        default_mgr.allocate   = bse_default_aligned_malloc;
+        default_mgr.deallocate = bse_default_aligned_free;
+        default_mgr.user_arg   = NULL;
+        mgr = &default_mgr;
+    }
+    
+    const unsigned int line = (unsigned int) (STATE_MACHINE_CACHE_LINE / sizeof(unsigned int));
+    if (actions > UINT_MAX - line) { X2(bad_arg, "table too large"); }
+    
+    unsigned int stride = P(stride)(actions, STATE_MACHINE_CACHE_LINE);
+    if (states > UINT_MAX / stride) { X2(bad_arg, "table too large"); }
+    if (!P(fits)(states, stride, STATE_MACHINE_CACHE_LINE)) { X2(bad_arg, "table too large"); }
+    
+    size_t alignment = STATE_MACHINE_CACHE_LINE;
+    size_t size = P(size)(states, stride, alignment);
+    
+    char *block = mgr->allocate(size, alignment, mgr->user_arg);
+    if (!block) { X(allocate_state_machine); }
+    
+    state_machine *m = P(place)(block, states, actions, stride, alignment);
+    memcpy(&m->aligned_mgr, mgr, sizeof(bse_aligned_memory_manager));
+    m->alignment = alignment;
+    
+    state_machine_clear(m);
+    
+    return m;
+    
+    err_allocate_state_machine:
+    err_bad_arg:
+        return NULL;
+}
+
+
+// allocate memory the same way as a given machine
+static char *P(allocate_like)(const state_machine *m, size_t size)
+{
+    if (m->alignment)
+        { return m->aligned_mgr.allocate(size, m->alignment, m->aligned_mgr.user_arg); }
+    
+    return m->mgr.allocate(size, m->mgr.user_arg);
+}
+
+
+static void P(free_like)(const state_machine *m, void *memory, size_t size)
+{
+    if (!memory) { return; }
+    
+    if (m->alignment)
+        { m->aligned_mgr.deallocate(memory, size, m->alignment, m->aligned_mgr.user_arg); }
+    else
+        { m->mgr.deallocate(memory, size, m->mgr.user_arg); }
+}
+
+
+// whether a clone's row for a state_index is still the base's
+static int P(shared_row)(const state_machine *m, unsigned int index)
+{
+    return m->row[index] == &m->base->transitions[index * m->stride];
+}
+
+
+// The row of a state_index of a machine that may be modified, copying it
+// first if the machine is a clone sharing it. Returns NULL on failure to
+// allocate.
+static unsigned int *P(writable_row)(state_machine *m, unsigned int index)
+{
+    if (m->layout != STATE_MACHINE_LAYOUT_CLONE)
+        { return &m->transitions[index * m->stride]; }
+    
+    if (P(shared_row)(m, index))
+    {
+        size_t size = sizeof(unsigned int) * m->stride;
+        
+        unsigned int *row = (unsigned int *) P(allocate_like)(m, size);
+        if (!row) { return NULL; }
+        
+        memcpy(row, m->row[index], size);
+        m->row[index] = row;
+        m->copied++;
+    }
+    
+    return m->row[index];
+}
+
+
+// While freezing, the source machine is read through its action classes: the
+// columns of the new tables, each represented by its first action.
+typedef struct P(source) P(source);
+
+struct P(source)
+{
+    const state_machine *m;
+    unsigned int columns;
+    const unsigned int *first_action; // [columns]
+};
+
+
+static unsigned int P(source_lookup)
+    (const P(source) *src, unsigned int index, unsigned int column)
+{
+    return P(lookup)(src->m, index, src->first_action[column]);
+}
+
+
+static unsigned int P(row_hash)(const P(source) *src, unsigned int index)
+{
+    unsigned int h = 2166136261u;
+    
+    for (unsigned int c = 0; c < src->columns; c++)
+        { h = (h ^ P(source_lookup)(src, index, c)) * 16777619u; }
+    
+    return (h ^ *P(payload)(src->m, index)) * 16777619u;
+}
+
+
+static int P(row_equal)(const P(source) *src, unsigned int i, unsigned int j)
+{
+    if (*P(payload)(src->m, i) != *P(payload)(src->m, j)) { return 0; }
+    
+    for (unsigned int c = 0; c < src->columns; c++)
+    {
+        if (P(source_lookup)(src, i, c) != P(source_lookup)(src, j, c))
+            { return 0; }
+    }
+    
+    return 1;
+}
+
+
+static unsigned int P(column_hash)(const state_machine *m, unsigned int action)
+{
+    unsigned int h = 2166136261u;
+    
+    for (unsigned int i = 0; i < m->states; i++)
+        { h = (h ^ P(lookup)(m, i, action)) * 16777619u; }
+    
+    return h;
+}
+
+
+static int P(column_equal)(const state_machine *m, unsigned int a, unsigned int b)
+{
+    for (unsigned int i = 0; i < m->states; i++)
+        { if (P(lookup)(m, i, a) != P(lookup)(m, i, b)) { return 0; } }
+    
+    return 1;
+}
+
+
+// Group n things into classes of equal things, as with byte classes in a
+// regular expression engine. For each thing, class_of receives the number of
+// its class, and for each class, first receives its first thing. Returns the
+// number of classes or UINT_MAX on failure to allocate memory.
+static unsigned int P(classify)
+    (const state_machine *m, unsigned int n,
+     unsigned int (*hash)(const void *arg, unsigned int i),
+     int (*equal)(const void *arg, unsigned int i, unsigned int j),
+     const void *arg, unsigned int *class_of, unsigned int *first)
+{
+    unsigned int slots = 1;
+    while (slots < 2 * n) { slots <<= 1; }
+    
+    size_t size = sizeof(unsigned int) * slots;
+    unsigned int *table = (unsigned int *) P(allocate_like)(m, size);
+    if (!table) { return UINT_MAX; }
+    
+    for (unsigned int i = 0; i < slots; i++) { table[i] = UINT_MAX; }
+    
+    unsigned int classes = 0;
+    
+    for (unsigned int i = 0; i < n; i++)
+    {
+        unsigned int slot = hash(arg, i) & (slots - 1);
+        
+        while ((table[slot] != UINT_MAX) && !equal(arg, first[table[slot]], i))
+            { slot = (slot + 1) & (slots - 1); }
+        
+        if (table[slot] == UINT_MAX)
+        {
+            table[slot] = classes;
+            first[classes++] = i;
+        }
+        
+        class_of[i] = table[slot];
+    }
+    
+    P(free_like)(m, table, size);
+    
+    return classes;
+}
+
+
+static unsigned int P(classify_row_hash)(const void *arg, unsigned int i)
+    { return P(row_hash)((const P(source) *) arg, i); }
+
+static int P(classify_row_equal)(const void *arg, unsigned int i, unsigned int j)
+    { return P(row_equal)((const P(source) *) arg, i, j); }
+
+static unsigned int P(classify_column_hash)(const void *arg, unsigned int i)
+    { return P(column_hash)((const state_machine *) arg, i); }
+
+static int P(classify_column_equal)(const void *arg, unsigned int i, unsigned int j)
+    { return P(column_equal)((const state_machine *) arg, i, j); }
+
+
+static int P(compare)(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return (x > y) - (x < y);
+}
+
+
+// For each column, choose the most common target as the default. Returns the
+// number of exceptions to the defaults or UINT_MAX on failure to allocate.
+static unsigned int P(column_defaults)(const P(source) *src, unsigned int *col_default)
+{
+    const state_machine *m = src->m;
+    
+    size_t size = sizeof(unsigned int) * (m->states ? m->states : 1);
+    unsigned int *column = (unsigned int *) P(allocate_like)(m, size);
+    if (!column) { return UINT_MAX; }
+    
+    unsigned int exceptions = 0;
+    
+    for (unsigned int c = 0; c < src->columns; c++)
+    {
+        for (unsigned int i = 0; i < m->states; i++)
+            { column[i] = P(source_lookup)(src, i, c); }
+        
+        qsort(column, m->states, sizeof(unsigned int), P(compare));
+        
+        unsigned int best = STATE_MACHINE_INVALID, best_run = 0;
+        
+        for (unsigned int i = 0, run = 0; i < m->states; i++)
+        {
+            run = ((i > 0) && (column[i] == column[i - 1])) ? (run + 1) : 1;
+            if (run > best_run) { best_run = run; best = column[i]; }
+        }
+        
+        col_default[c] = best;
+        exceptions += m->states - best_run;
+    }
+    
+    P(free_like)(m, column, size);
+    
+    return exceptions;
+}
+
+
+state_machine *state_machine_freeze(state_machine *m, int layout)
+{
+    T_SCOPE(state_machine_freeze);
+    
+    unsigned int *row_of = NULL;
+    unsigned int *first_state = NULL;
+    unsigned int *class_of = NULL;
+    unsigned int *first_action = NULL;
+    unsigned int *col_default = NULL;
+    size_t states_size = 0, actions_size = 0;
+    
+    if (!m) { X(bad_arg); }
+    
+    // scratch space for finding action classes, distinct rows and defaults
+    states_size  = sizeof(unsigned int) * (m->states ? m->states : 1);
+    actions_size = sizeof(unsigned int) * (m->actions ? m->actions : 1);
+    
+    row_of       = (unsigned int *) P(allocate_like)(m, states_size);
+    first_state  = (unsigned int *) P(allocate_like)(m, states_size);
+    class_of     = (unsigned int *) P(allocate_like)(m, actions_size);
+    first_action = (unsigned int *) P(allocate_like)(m, actions_size);
+    col_default  = (unsigned int *) P(allocate_like)(m, actions_size);
+    
+    if (!row_of || !first_state || !class_of || !first_action || !col_default)
+        { X(allocate_scratch); }
+    
+    // actions with identical columns share a column of the new tables
+    unsigned int columns = P(classify)(m, m->actions,
+        P(classify_column_hash), P(classify_column_equal), m,
+        class_of, first_action);
+    if (columns == UINT_MAX) { X(allocate_scratch); }
+    
+    P(source) src;
+    src.m            = m;
+    src.columns      = columns;
+    src.first_action = first_action;
+    
+    unsigned int distinct = P(classify)(m, m->states,
+        P(classify_row_hash), P(classify_row_equal), &src,
+        row_of, first_state);
+    if (distinct == UINT_MAX) { X(allocate_scratch); }
+    
+    unsigned int exceptions = P(column_defaults)(&src, col_default);
+    if (exceptions == UINT_MAX) { X(allocate_scratch); }
+    
+    unsigned int edges = 0;
+    
+    for (unsigned int i = 0; i < m->states; i++)
+    {
+        for (unsigned int c = 0; c < columns; c++)
+            { if (P(source_lookup)(&src, i, c) != STATE_MACHINE_INVALID) { edges++; } }
+    }
+    
+    // the action class map is only needed if there are fewer classes than
+    // actions; it sits before the tables so that they keep their alignment
+    size_t table_align = m->alignment ? m->alignment : STATE_MACHINE_TABLE_ALIGN;
+    unsigned int stride = P(stride)(columns, m->alignment);
+    size_t map_size = (columns < m->actions) ? (sizeof(unsigned int) * m->actions) : 0;
+    size_t offset_map = P(size)(m->states, 0, sizeof(unsigned int));
+    size_t base = P(align)(offset_map + map_size, table_align);
+    
+    size_t size_dense    = base
+        + (sizeof(unsigned int) * m->states * stride);
+    size_t size_sparse   = base
+        + (sizeof(unsigned int) * (m->states + 1u))
+        + (2 * sizeof(unsigned int) * edges)
+        + (sizeof(unsigned int) * m->states);
+    size_t size_rows     = base
+        + (sizeof(unsigned int) * distinct * stride)
+        + (sizeof(unsigned int) * m->states);
+    size_t size_defaults = base
+        + (sizeof(unsigned int) * ((2u * columns) + 1u))
+        + (2 * sizeof(unsigned int) * exceptions)
+        + (sizeof(unsigned int) * m->states);
+    
+    // The dense layout has the fastest lookup, so prefer it unless another
+    // layout is less than half the size. Of the others, the rows layout is
+    // the fastest and is preferred unless the smallest is much smaller.
+    if (layout == STATE_MACHINE_LAYOUT_AUTO)
+    {
+        size_t smallest = size_sparse;
+        layout = STATE_MACHINE_LAYOUT_SPARSE;
+        
+        if (size_defaults < smallest)
+            { smallest = size_defaults; layout = STATE_MACHINE_LAYOUT_DEFAULTS; }
+        
+        if (size_rows <= smallest + (smallest / 4))
+            { smallest = size_rows; layout = STATE_MACHINE_LAYOUT_ROWS; }
+        
+        if (smallest >= size_dense / 2)
+            { layout = STATE_MACHINE_LAYOUT_DENSE; }
+    }
+    
+    size_t size;
+    
+    switch (layout)
+    {
+        case STATE_MACHINE_LAYOUT_DENSE:    size = size_dense;    break;
+        case STATE_MACHINE_LAYOUT_SPARSE:   size = size_sparse;   break;
+        case STATE_MACHINE_LAYOUT_ROWS:     size = size_rows;     break;
+        case STATE_MACHINE_LAYOUT_DEFAULTS: size = size_defaults; break;
+        default: X4(bad_arg, "invalid layout", 0, layout);
+    }
+    
+    char *block = P(allocate_like)(m, size);
+    if (!block) { X(allocate_state_machine); }
+    
+    unsigned int *tables = (unsigned int *) (block + base);
+    
+    state_machine *f = P(place)(block, m->states, m->actions, 0, table_align);
+    
+    memcpy(&f->mgr, &m->mgr, sizeof(bse_simple_memory_manager));
+    memcpy(&f->aligned_mgr, &m->aligned_mgr, sizeof(bse_aligned_memory_manager));
+    f->alignment   = m->alignment;
+    f->size        = size;
+    f->count       = m->count;
+    f->layout      = layout;
+    f->columns     = columns;
+    f->transitions = NULL;
+    
+    memcpy(f->state_id, m->state_id, sizeof(unsigned int) * m->states);
+    memcpy(f->index_id, m->index_id, sizeof(unsigned int) * m->count);
+    memcpy(f->index_of, m->index_of, sizeof(unsigned int) * m->count);
+    
+    if (map_size)
+    {
+        f->action_class = (unsigned int *) (block + offset_map);
+        memcpy(f->action_class, class_of, map_size);
+    }
+    
+    if ((layout == STATE_MACHINE_LAYOUT_DENSE) || (layout == STATE_MACHINE_LAYOUT_ROWS))
+    {
+        // a dense table of every row, or of only the first of each distinct row
+        unsigned int rows = m->states;
+        
+        f->stride      = stride;
+        f->transitions = tables;
+        
+        if (layout == STATE_MACHINE_LAYOUT_ROWS)
+        {
+            rows = distinct;
+            
+            f->distinct_rows = distinct;
+            f->row_of        = tables + (distinct * stride);
+            memcpy(f->row_of, row_of, sizeof(unsigned int) * m->states);
+        }
+        
+        for (unsigned int r = 0; r < rows; r++)
+        {
+            unsigned int i = (layout == STATE_MACHINE_LAYOUT_ROWS) ? first_state[r] : r;
+            unsigned int *row = &f->transitions[r * stride];
+            
+            for (unsigned int c = 0; c < stride; c++)
+            {
+                row[c] = (c < columns)
+                    ? P(source_lookup)(&src, i, c)
+                    : STATE_MACHINE_INVALID;
+            }
+            
+            row[columns] = *P(payload)(m, i);
+        }
+    }
+    else if (layout == STATE_MACHINE_LAYOUT_SPARSE)
+    {
+        f->edges       = edges;
+        f->row_start   = tables;
+        f->edge_action = f->row_start + m->states + 1;
+        f->edge_to     = f->edge_action + edges;
+        
+        unsigned int e = 0;
+        
+        for (unsigned int i = 0; i < m->states; i++)
+        {
+            f->row_start[i] = e;
+            
+            for (unsigned int c = 0; c < columns; c++)
+            {
+                unsigned int to = P(source_lookup)(&src, i, c);
+                if (to == STATE_MACHINE_INVALID) { continue; }
+                
+                f->edge_action[e] = c;
+                f->edge_to[e]     = to;
+                e++;
+            }
+        }
+        
+        f->row_start[m->states] = e;
+        f->payload = f->edge_to + edges;
+    }
+    else // STATE_MACHINE_LAYOUT_DEFAULTS
+    {
+        f->exceptions  = exceptions;
+        f->col_default = tables;
+        f->exc_start   = f->col_default + columns;
+        f->exc_state   = f->exc_start + columns + 1;
+        f->exc_to      = f->exc_state + exceptions;
+        
+        memcpy(f->col_default, col_default, sizeof(unsigned int) * columns);
+        
+        unsigned int e = 0;
+        
+        for (unsigned int c = 0; c < columns; c++)
+        {
+            f->exc_start[c] = e;
+            
+            for (unsigned int i = 0; i < m->states; i++)
+            {
+                unsigned int to = P(source_lookup)(&src, i, c);
+                if (to == col_default[c]) { continue; }
+                
+                f->exc_state[e] = i;
+                f->exc_to[e]    = to;
+                e++;
+            }
+        }
+        
+        f->exc_start[columns] = e;
+        f->payload = f->exc_to + exceptions;
+    }
+    
+    if (f->payload)
+    {
+        for (unsigned int i = 0; i < m->states; i++)
+            { f->payload[i] = *P(payload)(m, i); }
+    }
+    
+    f->frozen = 1;
+    
+    P(free_like)(m, col_default, actions_size);
+    P(free_like)(m, first_action, actions_size);
+    P(free_like)(m, class_of, actions_size);
+    P(free_like)(m, first_state, states_size);
+    P(free_like)(m, row_of, states_size);
+    
+    return f;
+    
+    err_allocate_state_machine:
+    err_allocate_scratch:
+        P(free_like)(m, col_default, actions_size);
+        P(free_like)(m, first_action, actions_size);
+        P(free_like)(m, class_of, actions_size);
+        P(free_like)(m, first_state, states_size);
+        P(free_like)(m, row_of, states_size);
+    err_bad_arg:
+        return NULL;
+}
+
+
+unsigned int state_machine_action_classes(state_machine *m)
+{
+    if (!m) { X(bad_arg); }
+    
+    return m->columns;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_action_class(state_machine *m, unsigned int action)
 {
-    if (!size) { return NULL; }
-    return m->mgr.allocate(size, m->mgr.user_arg);
+    if (!m)                   { X(bad_arg); }
+    if (action >= m->actions) { X4(bad_arg, "invalid action", 0, action); }
+    
+    return m->action_class ? m->action_class[action] : action;
+    
+    err_bad_arg:
+        return STATE_MACHINE_INVALID;
 }
 
 
-static void P(free)(state_machine *m, void *memory, size_t size)
+size_t state_machine_memory(state_machine *m)
 {
-    if (!memory) { return; }
-    m->mgr.deallocate(memory, size, m->mgr.user_arg);
+    if (!m) { X(bad_arg); }
+    
+    return m->size + (sizeof(unsigned int) * m->stride * m->copied);
+    
+    err_bad_arg:
+        return 0;
 }
 
 
-state_machine *state_machine_new_using
-    (unsigned int states, unsigned int actions, bse_simple_memory_manager *mgr)
+void *state_machine_allocate(state_machine *m, size_t size)
 {
-    if (!mgr) { X(bad_arg); }
-    
-    state_machine *m = mgr->allocate(sizeof(state_machine), mgr->user_arg);
-    if (!m) { X(allocate_state_machine); }
-    
-    memcpy(&m->mgr, mgr, sizeof(bse_simple_memory_manager));
-    
-    m->states  = states;
-    m->actions = actions;
+    if (!m)    { X(bad_arg); }
+    if (!size) { X(bad_arg); }
     
-    m->state_id    = NULL;
-    m->transitions = NULL;
+    return P(allocate_like)(m, size);
     
-    m->state_id = P(new)(m, sizeof(unsigned int) * states);
-    if (!m->state_id) { X(allocate_state_ids); }
-    
-    m->transitions = P(new)(m, sizeof(unsigned int) * states * actions);
-    if (!m->transitions) { X(allocate_transitions); }
-    
-    state_machine_clear(m);
+    err_bad_arg:
+        return NULL;
+}
+
+
+void state_machine_deallocate(state_machine *m, void *memory, size_t size)
+{
+    if (!m) { X(bad_arg); }
     
-    return m;
+    P(free_like)(m, memory, size);
     
-    err_allocate_transitions:
-    err_allocate_state_ids:
-        state_machine_free(m);
-    err_allocate_state_machine:
     err_bad_arg:
-        return NULL;
+        return;
 }
 
 
-state_machine *state_machine_new(unsigned int states, unsigned int actions)
+int state_machine_layout(state_machine *m)
 {
-    bse_simple_memory_manager mgr;
-    mgr.allocate   = bse_default_malloc;
-    mgr.deallocate = bse_default_free;
-    mgr.user_arg   = NULL;
+    if (!m) { X(bad_arg); }
     
-    return state_machine_new_using(states, actions, &mgr);
+    return m->layout;
+    
+    err_bad_arg:
+        return 0;
 }
 
 
@@ -119,9 +948,21 @@ void state_machine_free(state_machine *m)
 {
     if (!m) { X(bad_arg); }
     
-    P(free)(m, m->transitions, sizeof(unsigned int) * m->states * m->actions);
-    P(free)(m, m->state_id, sizeof(unsigned int) * m->states);
-    P(free)(m, m, sizeof(state_machine));
+    if (m->layout == STATE_MACHINE_LAYOUT_CLONE)
+    {
+        for (unsigned int i = 0; i < m->states; i++)
+        {
+            if (!P(shared_row)(m, i))
+                { P(free_like)(m, m->row[i], sizeof(unsigned int) * m->stride); }
+        }
+        
+        m->base->clones--;
+    }
+    
+    if (m->alignment)
+        { m->aligned_mgr.deallocate(m, m->size, m->alignment, m->aligned_mgr.user_arg); }
+    else
+        { m->mgr.deallocate(m, m->size, m->mgr.user_arg); }
     
     err_bad_arg:
         return;
@@ -130,14 +971,22 @@ void state_machine_free(state_machine *m)
 
 int state_machine_clear(state_machine *m)
 {
-    if (!m) { X(bad_arg); }
+    if (!m)        { X(bad_arg); }
+    if (m->frozen) { X2(bad_arg, "machine is frozen"); }
+    if (m->base)   { X2(bad_arg, "a clone shares the states of its base"); }
+    if (m->clones) { X2(bad_arg, "machine is shared by clones"); }
+    
+    m->count = 0;
     
     for (unsigned int i = 0; i < m->states; i++)
         { m->state_id[i] = 0; }
         
-    for (unsigned int i = 0; i < m->states * m->actions; i++)
+    for (unsigned int i = 0; i < m->states * m->stride; i++)
         { m->transitions[i] = STATE_MACHINE_INVALID; }
     
+    for (unsigned int i = 0; i < m->states; i++)
+        { *P(payload)(m, i) = 0; }
+    
     return 1;
     
     err_bad_arg:
@@ -145,20 +994,51 @@ int state_machine_clear(state_machine *m)
 }
 
 
+// position in the lookup index of the first entry with an ID >= state_id
+static unsigned int P(lower_bound)(state_machine *m, unsigned int state_id)
+{
+    unsigned int lo = 0;
+    unsigned int hi = m->count;
+    
+    while (lo < hi)
+    {
+        unsigned int mid = lo + ((hi - lo) / 2);
+        if (m->index_id[mid] < state_id) { lo = mid + 1; } else { hi = mid; }
+    }
+    
+    return lo;
+}
+
+
 int state_machine_add_state(state_machine *m, unsigned int state)
 {
     if (!m)                { X(bad_arg); }
+    if (m->frozen)         { X2(bad_arg, "machine is frozen"); }
+    if (m->base)           { X2(bad_arg, "a clone shares the states of its base"); }
+    if (m->clones)         { X2(bad_arg, "machine is shared by clones"); }
     if (state == 0)        { X2(bad_arg, "state must be non-zero"); }
     
-    unsigned int top_state = STATE_MACHINE_INVALID;
-    for (unsigned int i = 0; i < m->states; i++)
-        { if (m->state_id[i] == 0) { top_state = i; break; } }
-    
-    if (top_state >= m->states) { X(state_machine_full); }
+    if (m->count >= m->states) { X(state_machine_full); }
     
     // the added state_id is mapped to the index top_state
+    unsigned int top_state = m->count;
     m->state_id[top_state] = state;
     
+    // insert into the lookup index after any equal IDs, so that a repeated
+    // state ID keeps mapping to its lowest index
+    unsigned int pos = P(lower_bound)(m, state + 1);
+    if (state == UINT_MAX) { pos = m->count; }
+    
+    for (unsigned int i = m->count; i > pos; i--)
+    {
+        m->index_id[i] = m->index_id[i - 1];
+        m->index_of[i] = m->index_of[i - 1];
+    }
+    
+    m->index_id[pos] = state;
+    m->index_of[pos] = top_state;
+    m->count++;
+    
     return 1;
     
     err_state_machine_full:
@@ -171,10 +1051,10 @@ static unsigned int P(state_index)(state_machine *m, unsigned int state_id)
 {
     assert(m);
     
-    for (unsigned int i = 0; i < m->states; i++)
-    {
-        if (m->state_id[i] == state_id) { return i; }
-    }
+    unsigned int pos = P(lower_bound)(m, state_id);
+    
+    if ((pos < m->count) && (m->index_id[pos] == state_id))
+        { return m->index_of[pos]; }
     
     return STATE_MACHINE_INVALID;
 }
@@ -183,7 +1063,9 @@ static unsigned int P(state_index)(state_machine *m, unsigned int state_id)
 int state_machine_add_transition
     (state_machine *m, unsigned int action, unsigned int from, unsigned int to)
 {
-    if (!m) { X(bad_arg); }
+    if (!m)        { X(bad_arg); }
+    if (m->frozen) { X2(bad_arg, "machine is frozen"); }
+    if (m->clones) { X2(bad_arg, "machine is shared by clones"); }
     unsigned int a = P(state_index)(m, from);
     unsigned int b = P(state_index)(m, to);
     
@@ -191,10 +1073,14 @@ int state_machine_add_transition
     if (b >= m->states)       { X4(bad_arg, "invalid to state",   0, to); }
     if (action >= m->actions) { X4(bad_arg, "invalid action",     0, action); }
     
-    m->transitions[(a * m->actions) + action] = b;
+    unsigned int *row = P(writable_row)(m, a);
+    if (!row) { X(allocate_row); }
+    
+    row[action] = b;
     
     return 1;
     
+    err_allocate_row:
     err_bad_arg:
         return 0;
 }
@@ -203,20 +1089,26 @@ int state_machine_add_transition
 int state_machine_add_transition_from_all_states
     (state_machine *m, unsigned int action, unsigned int to, unsigned int mask)
 {
-    if (!m)                                { X(bad_arg); }
-    if (P(state_index)(m, to) > m->states) { X2(bad_arg, "invalid to state"); }
-    if (action >= m->actions)              { X2(bad_arg, "invalid action"); }
+    if (!m)                                 { X(bad_arg); }
+    if (m->frozen)                          { X2(bad_arg, "machine is frozen"); }
+    if (m->clones)                          { X2(bad_arg, "machine is shared by clones"); }
+    if (P(state_index)(m, to) >= m->states) { X2(bad_arg, "invalid to state"); }
+    if (action >= m->actions)               { X2(bad_arg, "invalid action"); }
     
     for (unsigned int i = 0; i < m->states; i++)
     {
         unsigned int state = m->state_id[i];
+        if (!state) { continue; }
         if ((mask & state) != mask) { continue; }
         
-        assert(state_machine_add_transition(m, action, state, to));
+        if (!state_machine_add_transition(m, action, state, to))
+            { X(add_transition); }
     }
     
     return 1;
     
+    err_add_transition:
+        W("the state of the state_machine is now indeterminate");
     err_bad_arg:
         return 0;
 }
@@ -226,12 +1118,17 @@ int state_machine_add_transition_from_all_states_replacing
     (state_machine *m, unsigned int action,
      unsigned int replace, unsigned int with, unsigned int mask)
 {
+    T_SCOPE(state_machine_add_transition_from_all_states_replacing);
+    
     if (!m)                                { X(bad_arg); }
+    if (m->frozen)                         { X2(bad_arg, "machine is frozen"); }
+    if (m->clones)                         { X2(bad_arg, "machine is shared by clones"); }
     if (action >= m->actions)              { X2(bad_arg, "invalid action"); }
     
     for (unsigned int i = 0; i < m->states; i++)
     {
         unsigned int state = m->state_id[i];
+        if (!state) { continue; }
         if ((mask & state) != mask) { continue; }
         
         unsigned int to = (state & ~replace) | with;
@@ -243,7 +1140,198 @@ int state_machine_add_transition_from_all_states_replacing
     return 1;
     
     err_state_machine_add_transition:
-        printf("Note that the state of the state_machine is now indeterminate\n");
+        W("the state of the state_machine is now indeterminate");
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_add_rules
+    (state_machine *m, const state_machine_rule *rules, size_t num_rules)
+{
+    T_SCOPE(state_machine_add_rules);
+    
+    if (!m)                   { X(bad_arg); }
+    if (num_rules && !rules)  { X(bad_arg); }
+    if (m->frozen)            { X2(bad_arg, "machine is frozen"); }
+    if (m->clones)            { X2(bad_arg, "machine is shared by clones"); }
+    
+    for (size_t r = 0; r < num_rules; r++)
+    {
+        const state_machine_rule *rule = &rules[r];
+        if (rule->action >= m->actions) { X4(bad_arg, "invalid action", 0, r); }
+        
+        for (unsigned int i = 0; i < m->states; i++)
+        {
+            unsigned int state = m->state_id[i];
+            if (!state) { continue; }
+            if ((state & rule->mask) != rule->match) { continue; }
+            
+            unsigned int to = (state & ~rule->replace) | rule->with;
+            
+            if (!state_machine_add_transition(m, rule->action, state, to))
+                { X4(state_machine_add_transition, "in rule", 0, r); }
+        }
+    }
+    
+    return 1;
+    
+    err_state_machine_add_transition:
+        W("the state of the state_machine is now indeterminate");
+    err_bad_arg:
+        return 0;
+}
+
+
+// Fewest states worth giving a thread of its own in add_rules_parallel
+#define STATE_MACHINE_PARALLEL_MIN_STATES 1024
+
+// A range of rows of a machine to apply a list of rules to
+typedef struct P(rules_job) P(rules_job);
+
+struct P(rules_job)
+{
+    state_machine *m;
+    const state_machine_rule *rules;
+    size_t num_rules;
+    unsigned int first; // state_index
+    unsigned int last; // one past
+    
+    size_t failed_rule; // the first rule with an invalid target, or num_rules
+    
+#   ifdef BSE_LINUX
+        pthread_t thread;
+        int started;
+#   endif
+};
+
+
+// Applies every rule to each row in turn. A row only depends on its own
+// state, and the last matching rule for an action wins either way, so this
+// gives the same rows as applying each rule to every state in turn.
+static void *P(apply_rules)(void *arg)
+{
+    P(rules_job) *job = (P(rules_job) *) arg;
+    state_machine *m = job->m;
+    
+    for (unsigned int i = job->first; i < job->last; i++)
+    {
+        unsigned int state = m->state_id[i];
+        if (!state) { continue; }
+        
+        unsigned int *row = &m->transitions[(size_t) i * m->stride];
+        
+        for (size_t r = 0; r < job->num_rules; r++)
+        {
+            const state_machine_rule *rule = &job->rules[r];
+            if ((state & rule->mask) != rule->match) { continue; }
+            
+            unsigned int to = P(state_index)(m, (state & ~rule->replace) | rule->with);
+            
+            if (to >= m->states)
+            {
+                if (r < job->failed_rule) { job->failed_rule = r; }
+                break;
+            }
+            
+            row[rule->action] = to;
+        }
+    }
+    
+    return NULL;
+}
+
+
+int state_machine_add_rules_parallel
+    (state_machine *m, const state_machine_rule *rules, size_t num_rules,
+     unsigned int threads)
+{
+    T_SCOPE(state_machine_add_rules_parallel);
+    
+    P(rules_job) *jobs = NULL;
+    size_t jobs_size = 0;
+    
+    if (!m)                   { X(bad_arg); }
+    if (num_rules && !rules)  { X(bad_arg); }
+    if (m->frozen)            { X2(bad_arg, "machine is frozen"); }
+    if (m->clones)            { X2(bad_arg, "machine is shared by clones"); }
+    
+    // copying rows of a clone allocates, so is not done in parallel
+    if (m->layout == STATE_MACHINE_LAYOUT_CLONE)
+        { return state_machine_add_rules(m, rules, num_rules); }
+    
+    for (size_t r = 0; r < num_rules; r++)
+    {
+        if (rules[r].action >= m->actions) { X4(bad_arg, "invalid action", 0, r); }
+    }
+    
+#   ifdef BSE_LINUX
+        if (!threads)
+        {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = (n > 0) ? (unsigned int) n : 1;
+        }
+#   else
+        threads = 1;
+#   endif
+    
+    unsigned int most = m->count / STATE_MACHINE_PARALLEL_MIN_STATES;
+    if (threads > most) { threads = most; }
+    if (!threads) { threads = 1; }
+    
+    jobs_size = sizeof(P(rules_job)) * threads;
+    jobs = (P(rules_job) *) P(allocate_like)(m, jobs_size);
+    if (!jobs) { X(allocate_jobs); }
+    
+    for (unsigned int t = 0; t < threads; t++)
+    {
+        P(rules_job) *job = &jobs[t];
+        
+        job->m            = m;
+        job->rules        = rules;
+        job->num_rules    = num_rules;
+        job->first        = (unsigned int) (((unsigned long long) m->count * t) / threads);
+        job->last         = (unsigned int) (((unsigned long long) m->count * (t + 1)) / threads);
+        job->failed_rule  = num_rules;
+    }
+    
+    // the calling thread takes the first range, and any that could not get
+    // a thread of their own
+#   ifdef BSE_LINUX
+        for (unsigned int t = 1; t < threads; t++)
+        {
+            jobs[t].started = !pthread_create(&jobs[t].thread, NULL, P(apply_rules), &jobs[t]);
+        }
+        
+        P(apply_rules)(&jobs[0]);
+        
+        for (unsigned int t = 1; t < threads; t++)
+        {
+            if (jobs[t].started) { pthread_join(jobs[t].thread, NULL); }
+            else                 { P(apply_rules)(&jobs[t]); }
+        }
+#   else
+        P(apply_rules)(&jobs[0]);
+#   endif
+    
+    // report the rule state_machine_add_rules would have failed in
+    size_t failed_rule = num_rules;
+    
+    for (unsigned int t = 0; t < threads; t++)
+    {
+        if (jobs[t].failed_rule < failed_rule) { failed_rule = jobs[t].failed_rule; }
+    }
+    
+    P(free_like)(m, jobs, jobs_size);
+    jobs = NULL;
+    
+    if (failed_rule < num_rules) { X4(invalid_target, "in rule", 0, failed_rule); }
+    
+    return 1;
+    
+    err_invalid_target:
+        W("the state of the state_machine is now indeterminate");
+    err_allocate_jobs:
     err_bad_arg:
         return 0;
 }
@@ -257,7 +1345,7 @@ unsigned int state_machine_take_action
     unsigned int from = P(state_index)(m, state);
     if (from >= m->states) { X4(bad_arg, "invalid state", 0, state); }
     
-    unsigned int to = m->transitions[(from * m->actions) + action];
+    unsigned int to = P(lookup)(m, from, action);
     if (to >= m->states) { return 0; }
     
     return m->state_id[to];
@@ -278,51 +1366,152 @@ unsigned int state_machine_state_index(state_machine *m, unsigned int state)
 }
 
 
-void state_machine_print
-    (FILE *stream, state_machine *m,
-     const char *title, const char **states, const char **actions)
+unsigned int state_machine_states(state_machine *m)
+{
+    if (!m) { X(bad_arg); }
+    
+    return m->states;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_actions(state_machine *m)
+{
+    if (!m) { X(bad_arg); }
+    
+    return m->actions;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_state_id(state_machine *m, unsigned int index)
+{
+    if (!m)                 { X(bad_arg); }
+    if (index >= m->states) { X4(bad_arg, "invalid state index", 0, index); }
+    
+    return m->state_id[index];
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_take_action_index
+    (state_machine *m, unsigned int index, unsigned int action)
+{
+    DEBUG_ASSERT(m);
+    DEBUG_ASSERT(index < m->states);
+    DEBUG_ASSERT(action < m->actions);
+    
+    return P(lookup)(m, index, action);
+}
+
+
+int state_machine_set_payload
+    (state_machine *m, unsigned int state, unsigned int payload)
 {
-    if (!stream)  { X(bad_arg); }
-    if (!m)       { X(bad_arg); }
-    if (!title)   { X(bad_arg); }
-    if (!actions) { X(bad_arg); }
+    if (!m)        { X(bad_arg); }
+    if (m->frozen) { X2(bad_arg, "machine is frozen"); }
+    if (m->clones) { X2(bad_arg, "machine is shared by clones"); }
     
-    printf("digraph \"%s\" {\n", title);
+    unsigned int index = P(state_index)(m, state);
+    if (index >= m->states) { X4(bad_arg, "invalid state", 0, state); }
+    
+    unsigned int *row = P(writable_row)(m, index);
+    if (!row) { X(allocate_row); }
+    
+    row[m->columns] = payload;
+    
+    return 1;
+    
+    err_allocate_row:
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_payload(state_machine *m, unsigned int state)
+{
+    if (!m) { X(bad_arg); }
+    
+    unsigned int index = P(state_index)(m, state);
+    if (index >= m->states) { X4(bad_arg, "invalid state", 0, state); }
+    
+    return *P(payload)(m, index);
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_take_action_payload
+    (state_machine *m, unsigned int state, unsigned int action, unsigned int *payload)
+{
+    if (!m)                   { X(bad_arg); }
+    if (action >= m->actions) { X2(bad_arg, "invalid action"); }
+    
+    unsigned int from = P(state_index)(m, state);
+    if (from >= m->states) { X4(bad_arg, "invalid state", 0, state); }
+    
+    unsigned int to = P(lookup)(m, from, action);
+    if (to >= m->states) { return 0; }
+    
+    if (payload) { *payload = *P(payload)(m, to); }
+    
+    return m->state_id[to];
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_payload_index(state_machine *m, unsigned int index)
+{
+    DEBUG_ASSERT(m);
+    DEBUG_ASSERT(index < m->states);
+    
+    return *P(payload)(m, index);
+}
+
+
+state_machine *state_machine_clone_cow(state_machine *m)
+{
+    T_SCOPE(state_machine_clone_cow);
+    
+    if (!m) { X(bad_arg); }
+    if ((m->layout != STATE_MACHINE_LAYOUT_DENSE) || m->action_class)
+        { X2(bad_arg, "only a machine with a dense table of actions can be cloned"); }
+    
+    size_t offset_row = P(align)(sizeof(state_machine), sizeof(unsigned int *));
+    size_t size = offset_row + (sizeof(unsigned int *) * m->states);
+    
+    char *block = P(allocate_like)(m, size);
+    if (!block) { X(allocate_state_machine); }
+    
+    state_machine *c = (state_machine *) block;
+    memcpy(c, m, sizeof(state_machine));
+    
+    c->size        = size;
+    c->layout      = STATE_MACHINE_LAYOUT_CLONE;
+    c->frozen      = 0;
+    c->transitions = NULL;
+    c->base        = m;
+    c->row         = (unsigned int **) (block + offset_row);
+    c->copied      = 0;
+    c->clones      = 0;
     
     for (unsigned int i = 0; i < m->states; i++)
-    {
-        unsigned int offset = i * m->actions;
-        
-        for (unsigned int j = 0; j < m->actions; j++, offset++)
-        {
-            unsigned int to = m->transitions[offset];
-            if (to >= m->states) { continue; }
-            
-            const char *string_from = NULL;
-            const char *string_to = NULL;
-            
-            char string_from_id[11];
-            char string_to_id[11];
-            
-            sprintf(string_from_id, "%u", i);
-            sprintf(string_to_id,   "%u", to);
-            
-            if (states)
-            {
-                string_from = states[i];
-                string_to   = states[to];
-            }
-            
-            if (!string_from) { string_from = string_from_id; }
-            if (!string_to)   { string_to   = string_to_id; }
-            
-            printf("    \"%s\" -> \"%s\" [ label=\"%s\" ]\n",
-                   string_from, string_to, actions[j]);
-        }
-    }
+        { c->row[i] = &m->transitions[i * m->stride]; }
     
-    printf("}\n");
+    m->clones++;
     
+    return c;
+    
+    err_allocate_state_machine:
     err_bad_arg:
-        return;
+        return NULL;
 }
@@ -41,7 +41,46 @@
 
 #define STATE_MACHINE_INVALID UINT_MAX
 
+// The alignment, in bytes, of the tables of machines created with
+// state_machine_new_aligned, and the multiple their rows are padded to.
+// Must be a power of two and a multiple of sizeof(unsigned int).
+#ifndef STATE_MACHINE_CACHE_LINE
+#   define STATE_MACHINE_CACHE_LINE 64
+#endif
+
+// Layouts of the transition table of a machine (see state_machine_freeze)
+#define STATE_MACHINE_LAYOUT_AUTO     0
+#define STATE_MACHINE_LAYOUT_DENSE    1 // states * actions table
+#define STATE_MACHINE_LAYOUT_SPARSE   2 // compressed sparse rows
+#define STATE_MACHINE_LAYOUT_ROWS     3 // each distinct row stored once
+#define STATE_MACHINE_LAYOUT_DEFAULTS 4 // per-action default and exceptions
+#define STATE_MACHINE_LAYOUT_CLONE    5 // rows shared with another machine
+
 typedef struct state_machine state_machine;
+typedef struct state_machine_rule state_machine_rule;
+
+// A rule describes a set of transitions for one action. It applies to every
+// state where ((state & mask) == match) and leads from each such state to
+// ((state & ~replace) | with). An ordered list of rules is applied first to
+// last, so later rules replace the transitions of earlier ones.
+struct state_machine_rule
+{
+    unsigned int action;
+    unsigned int mask;
+    unsigned int match;
+    unsigned int replace;
+    unsigned int with;
+};
+
+// Initialisers for a state_machine_rule equivalent to, in turn,
+// state_machine_add_transition, state_machine_add_transition_from_all_states
+// and state_machine_add_transition_from_all_states_replacing.
+#define STATE_MACHINE_RULE_TRANSITION(action, from, to) \
+    { (action), UINT_MAX, (from), UINT_MAX, (to) }
+#define STATE_MACHINE_RULE_FROM_ALL_STATES(action, to, mask) \
+    { (action), (mask), (mask), UINT_MAX, (to) }
+#define STATE_MACHINE_RULE_REPLACING(action, replace, with, mask) \
+    { (action), (mask), (mask), (replace), (with) }
 
 // Create a state machine that will hold a given number of unique states
 // and a certain size alphabet of actions. For best results the number of
@@ -54,6 +93,62 @@ state_machine *state_machine_new(unsigned int states, unsigned int actions);
 state_machine *state_machine_new_using
     (unsigned int states, unsigned int actions, bse_simple_memory_manager *mgr);
 
+// As state_machine_new_using, but the transition table is aligned to
+// STATE_MACHINE_CACHE_LINE bytes and each row of the table is padded to a
+// multiple of that size, so that a row never straddles more cache lines than
+// it must and can be loaded with aligned vector instructions. The memory
+// manager may be NULL to use a default aligned allocator.
+state_machine *state_machine_new_aligned
+    (unsigned int states, unsigned int actions, bse_aligned_memory_manager *mgr);
+
+// Create a read-only copy of a machine with its transitions stored in the
+// given layout, allocated the same way as the original. The dense layout has
+// the fastest lookup. The sparse layout stores only the transitions that
+// exist, so its size scales with the number of transitions rather than with
+// states * actions. The rows layout stores each distinct row once, which suits
+// machines built from mask rules where many states behave alike. The defaults
+// layout stores, for each action, the most common target and a list of the
+// states that differ from it. STATE_MACHINE_LAYOUT_AUTO picks the smallest,
+// favouring the rows layout, and only if it is less than half the size of the
+// dense layout. The original machine is unchanged and may be freed. Functions
+// that modify a frozen machine fail.
+state_machine *state_machine_freeze(state_machine *m, int layout);
+
+// A frozen machine stores a column of transitions for each class of actions
+// that behave identically in every state, rather than for each action, and
+// keeps a small map from actions to classes. These return the number of
+// classes and the class of an action (for a machine that has not been frozen,
+// every action is its own class).
+unsigned int state_machine_action_classes(state_machine *m);
+unsigned int state_machine_action_class(state_machine *m, unsigned int action);
+
+// Create a copy-on-write clone of a machine, allocated the same way: a variant
+// that shares the states and the rows of the transition table of the
+// original, and copies a row only when a transition or payload of that state
+// is changed. A clone costs a pointer per state plus its changed rows, so
+// many variants of one model cost memory and time in proportion to their
+// differences. States cannot be added to a clone and it cannot be cleared.
+// The original must outlive its clones and cannot be modified while it has
+// any. Only machines with the dense layout and no action classes (i.e. not
+// frozen, or frozen without merging any actions) can be cloned. Freezing a
+// clone gives an independent machine.
+state_machine *state_machine_clone_cow(state_machine *m);
+
+// Returns the number of bytes of memory used by a machine (for a clone, only
+// the memory that is not shared)
+size_t state_machine_memory(state_machine *m);
+
+// Allocate and free working memory with the memory manager a machine was
+// created with, for functions that build temporary data from a machine.
+// Returns NULL on failure.
+void *state_machine_allocate(state_machine *m, size_t size);
+void state_machine_deallocate(state_machine *m, void *memory, size_t size);
+
+// Returns the layout of a machine's transition table. Machines that have not
+// been frozen use STATE_MACHINE_LAYOUT_DENSE, except for clones, which use
+// STATE_MACHINE_LAYOUT_CLONE.
+int state_machine_layout(state_machine *m);
+
 // Frees the memory associated with a state machine
 void state_machine_free(state_machine *m);
 
@@ -87,6 +182,23 @@ int state_machine_add_transition_from_all_states_replacing
     (state_machine *m, unsigned int action,
      unsigned int replace, unsigned int with, unsigned int mask);
 
+// Apply an ordered list of rules to every state in the machine, first to last.
+// The target of every matching transition must already be a state in the
+// machine. Any existing transitions will be replaced.
+int state_machine_add_rules
+    (state_machine *m, const state_machine_rule *rules, size_t num_rules);
+
+// As state_machine_add_rules, but for machines with many states: the states
+// are divided into ranges of rows between a number of threads (0 for one per
+// processor), each applying every rule in order to its own rows, so the
+// result is the same. Every rule is checked before any is applied. If the
+// target of a transition is not a state, the machine is left indeterminate.
+// Uses one thread where threads are unavailable, and for small machines. A
+// clone is built by state_machine_add_rules instead.
+int state_machine_add_rules_parallel
+    (state_machine *m, const state_machine_rule *rules, size_t num_rules,
+     unsigned int threads);
+
 // Return the resulting state when an action is taken from a specific state of
 // a specific machine. If there is no transition, 0 is returned.
 unsigned int state_machine_take_action
@@ -99,13 +211,88 @@ unsigned int state_machine_take_action
 // an image or something similar.
 unsigned int state_machine_state_index(state_machine *m, unsigned int state);
 
+// Return the number of states and the number of actions that the machine was
+// created to hold.
+unsigned int state_machine_states(state_machine *m);
+unsigned int state_machine_actions(state_machine *m);
+
+// The inverse of state_machine_state_index: given an index >= 0 and < the
+// number of states, return the state ID or 0 if no state has that index.
+unsigned int state_machine_state_id(state_machine *m, unsigned int index);
+
+// As state_machine_take_action, but works directly with state indexes instead
+// of IDs, avoiding a state lookup. Returns STATE_MACHINE_INVALID if there is no
+// transition. This is the fast path for dispatching over many elements.
+unsigned int state_machine_take_action_index
+    (state_machine *m, unsigned int index, unsigned int action);
+
+// Attach a payload to a state: a number chosen by the caller, such as a sprite,
+// style or cursor, saving a separate lookup table indexed by state. The
+// payload is stored in the state's row of the transition table, in the same
+// cache line as the transitions out of the state. Every payload is initially
+// 0. Payloads are kept by state_machine_freeze, but a frozen machine's
+// payloads cannot be changed.
+int state_machine_set_payload
+    (state_machine *m, unsigned int state, unsigned int payload);
+
+// Return the payload of a state, or 0 for an invalid state.
+unsigned int state_machine_payload(state_machine *m, unsigned int state);
+
+// As state_machine_take_action, also storing the payload of the resulting
+// state in payload (if not NULL and there is a transition).
+unsigned int state_machine_take_action_payload
+    (state_machine *m, unsigned int state, unsigned int action, unsigned int *payload);
+
+// As state_machine_payload, but works directly with a state index (see
+// state_machine_take_action_index).
+unsigned int state_machine_payload_index(state_machine *m, unsigned int index);
+
 // prints output in DOT (graph description language) format
 // for a states and actions array of pointers to null terminated strings
 // the number of elements in both arrays being exactly the number of states
 // and actions specified in state_machine_new
 // the states array is optional and may also contain null strings
+// parallel edges (several actions between the same two states) are merged
+// into one edge labelled with every action
+// double quotes and backslashes in state names and action labels are escaped
 void state_machine_print
     (FILE *stream, state_machine *m,
      const char *title, const char **states, const char **actions);
 
+// Receives output from state_machine_print_using. Returns zero on failure.
+typedef int (*state_machine_write_fn)(const char *data, size_t size, void *arg);
+
+// Groups the states whose IDs contain a flag ((state & flag) == flag) into a
+// labelled subgraph cluster. A state goes in the first cluster it matches.
+typedef struct state_machine_cluster state_machine_cluster;
+
+struct state_machine_cluster
+{
+    unsigned int flag;
+    const char *label;
+};
+
+// As state_machine_print, but output is buffered and passed to a function in
+// large blocks, and states may optionally be grouped into clusters (clusters
+// may be NULL). Its working memory comes from the machine's memory manager.
+// Returns zero on failure, including if the function fails.
+int state_machine_print_using
+    (state_machine_write_fn write, void *arg, state_machine *m,
+     const char *title, const char **states, const char **actions,
+     const state_machine_cluster *clusters, unsigned int num_clusters);
+
+// Serializes a machine to a compact binary format, passing it to a write
+// function (see state_machine_write_fn). Returns zero on failure.
+int state_machine_save
+    (state_machine_write_fn write, void *arg, state_machine *m);
+
+// Creates a new (unfrozen) machine from the output of state_machine_save.
+// Returns NULL if the data is malformed.
+state_machine *state_machine_load(const void *data, size_t size);
+
+// As state_machine_load, but accepts a structure indicating how memory should
+// be allocated and deallocated.
+state_machine *state_machine_load_using
+    (const void *data, size_t size, bse_simple_memory_manager *mgr);
+
 #endif
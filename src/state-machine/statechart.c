@@ -0,0 +1,483 @@
+/*
+ 
+ state-machine/statechart.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/statechart.h"
+#include <stddef.h> // NULL
+#include <limits.h> // CHAR_BIT, UINT_MAX
+
+#define P(x) state_machine_statechart_private_##x
+
+// flags do not share bits, so there can be at most one state per bit
+#define STATE_MACHINE_STATECHART_MAX_STATES (sizeof(unsigned int) * CHAR_BIT)
+
+#define HISTORY_ANY (STATE_MACHINE_STATECHART_HISTORY | STATE_MACHINE_STATECHART_DEEP_HISTORY)
+
+
+// The chart with states indexed in the order given. An implicit exclusive
+// root, with flag 0, is the parent of the top-level states.
+typedef struct P(chart) P(chart);
+
+struct P(chart)
+{
+    unsigned int n;
+    unsigned int root; // == n
+    
+    unsigned int flag[STATE_MACHINE_STATECHART_MAX_STATES + 1];
+    unsigned int parent[STATE_MACHINE_STATECHART_MAX_STATES + 1];
+    unsigned int type[STATE_MACHINE_STATECHART_MAX_STATES + 1];
+    unsigned int children[STATE_MACHINE_STATECHART_MAX_STATES + 1]; // OR of flags
+    
+    const state_machine_statechart_transition *transitions;
+    size_t num_transitions;
+    
+    // for each transition, the state indexes of from and to
+    unsigned int *from;
+    unsigned int *to;
+};
+
+
+static unsigned int P(find)(P(chart) *c, unsigned int flag)
+{
+    if (!flag) { return c->root; }
+    
+    for (unsigned int i = 0; i < c->n; i++)
+        { if (c->flag[i] == flag) { return i; } }
+    
+    return STATE_MACHINE_INVALID;
+}
+
+
+// is a a proper ancestor of i?
+static int P(is_ancestor)(P(chart) *c, unsigned int a, unsigned int i)
+{
+    while (i != c->root)
+    {
+        i = c->parent[i];
+        if (i == a) { return 1; }
+    }
+    
+    return 0;
+}
+
+
+static int P(is_active)(P(chart) *c, unsigned int id, unsigned int i)
+{
+    for (; i != c->root; i = c->parent[i])
+        { if (!(id & c->flag[i])) { return 0; } }
+    
+    return 1;
+}
+
+
+// Enter a state and complete its configuration by default entry, where an
+// exclusive state resumes the child it remembers if it has a history (or if
+// restore is set by an enclosing deep history) or else enters its first child.
+static unsigned int P(enter)(P(chart) *c, unsigned int id, unsigned int i, int restore)
+{
+    id |= c->flag[i];
+    if (!c->children[i]) { return id; }
+    
+    unsigned int first = (i == c->root) ? 0 : i + 1; // children follow parents
+    
+    if (c->type[i] & STATE_MACHINE_STATECHART_PARALLEL)
+    {
+        for (unsigned int j = first; j < c->n; j++)
+            { if (c->parent[j] == i) { id = P(enter)(c, id, j, restore); } }
+        
+        return id;
+    }
+    
+    unsigned int chosen = STATE_MACHINE_INVALID;
+    
+    if (restore || (c->type[i] & HISTORY_ANY))
+    {
+        for (unsigned int j = first; (j < c->n) && (chosen == STATE_MACHINE_INVALID); j++)
+            { if ((c->parent[j] == i) && (id & c->flag[j])) { chosen = j; } }
+    }
+    
+    if (chosen == STATE_MACHINE_INVALID)
+    {
+        for (unsigned int j = first; (j < c->n) && (chosen == STATE_MACHINE_INVALID); j++)
+            { if (c->parent[j] == i) { chosen = j; } }
+    }
+    
+    // forget any other child remembered by a history
+    id &= ~(c->children[i] & ~c->flag[chosen]);
+    
+    return P(enter)(c, id, chosen, restore || (c->type[i] & STATE_MACHINE_STATECHART_DEEP_HISTORY));
+}
+
+
+// The state containing all the states that a transition exits and enters (its
+// domain): the nearest exclusive proper ancestor of both its source and target.
+static unsigned int P(domain)(P(chart) *c, unsigned int from, unsigned int to)
+{
+    unsigned int a = (from == c->root) ? c->root : c->parent[from];
+    
+    while ((a != c->root)
+        && (!P(is_ancestor)(c, a, to) || (c->type[a] & STATE_MACHINE_STATECHART_PARALLEL)))
+        { a = c->parent[a]; }
+    
+    return a;
+}
+
+
+// the flags of the active states inside a domain
+static unsigned int P(exit_set)(P(chart) *c, unsigned int id, unsigned int domain)
+{
+    unsigned int exits = 0;
+    
+    for (unsigned int i = 0; i < c->n; i++)
+    {
+        if (P(is_ancestor)(c, domain, i) && P(is_active)(c, id, i))
+            { exits |= c->flag[i]; }
+    }
+    
+    return exits;
+}
+
+
+static unsigned int P(transition)(P(chart) *c, unsigned int id, size_t t)
+{
+    unsigned int from = c->from[t];
+    unsigned int to   = c->to[t];
+    unsigned int domain = P(domain)(c, from, to);
+    unsigned int exits  = P(exit_set)(c, id, domain);
+    
+    // exit, keeping the flags of states remembered by an exited history
+    unsigned int next = id & ~exits;
+    
+    for (unsigned int i = 0; i < c->n; i++)
+    {
+        if (!(exits & c->flag[i])) { continue; }
+        
+        for (unsigned int a = c->parent[i]; (a != domain); a = c->parent[a])
+        {
+            int remembers = (a == c->parent[i])
+                ? (c->type[a] & HISTORY_ANY)
+                : (c->type[a] & STATE_MACHINE_STATECHART_DEEP_HISTORY);
+            
+            if (remembers) { next |= c->flag[i]; break; }
+        }
+    }
+    
+    // enter each state from the domain down to the target, entering the other
+    // children of parallel states on the way by default
+    unsigned int path[STATE_MACHINE_STATECHART_MAX_STATES];
+    unsigned int depth = 0;
+    
+    for (unsigned int i = to; i != domain; i = c->parent[i]) { path[depth++] = i; }
+    
+    while (depth--)
+    {
+        unsigned int i = path[depth];
+        unsigned int p = c->parent[i];
+        
+        if (c->type[p] & STATE_MACHINE_STATECHART_PARALLEL)
+        {
+            for (unsigned int j = p + 1; j < c->n; j++)
+                { if ((c->parent[j] == p) && (j != i)) { next = P(enter)(c, next, j, 0); } }
+        }
+        else
+        {
+            next &= ~c->children[p];
+        }
+        
+        next |= c->flag[i];
+    }
+    
+    return P(enter)(c, next, to, 0);
+}
+
+
+static unsigned int P(depth)(P(chart) *c, unsigned int i)
+{
+    unsigned int depth = 0;
+    for (; i != c->root; i = c->parent[i]) { depth++; }
+    return depth;
+}
+
+
+// The state after taking an action, or 0 if there is no transition. For each
+// active simple state, the innermost state enclosing it (or itself) that
+// handles the action gives a candidate transition. Candidates from more deeply
+// nested sources are considered first (then in the order of the simple
+// states), and a candidate is selected unless it would exit states that an
+// already selected transition exits, so an inner transition takes priority
+// over a conflicting outer one. The selected transitions are then taken in
+// that order.
+static unsigned int P(step)(P(chart) *c, unsigned int id, unsigned int action)
+{
+    size_t candidate[STATE_MACHINE_STATECHART_MAX_STATES];
+    unsigned int depth[STATE_MACHINE_STATECHART_MAX_STATES];
+    unsigned int num_candidates = 0;
+    
+    for (unsigned int leaf = 0; leaf < c->n; leaf++)
+    {
+        if (c->children[leaf] || !P(is_active)(c, id, leaf)) { continue; }
+        
+        size_t t = c->num_transitions;
+        
+        for (unsigned int i = leaf; (i != c->root) && (t == c->num_transitions); i = c->parent[i])
+        {
+            for (size_t k = 0; k < c->num_transitions; k++)
+            {
+                if ((c->from[k] == i) && (c->transitions[k].action == action)) { t = k; break; }
+            }
+        }
+        
+        if (t == c->num_transitions) { continue; }
+        
+        unsigned int duplicate = 0;
+        for (unsigned int k = 0; k < num_candidates; k++) { duplicate |= (candidate[k] == t); }
+        if (duplicate) { continue; }
+        
+        // insert after every candidate at least as deep (a stable sort)
+        unsigned int d = P(depth)(c, c->from[t]);
+        unsigned int pos = num_candidates;
+        
+        for (; (pos > 0) && (depth[pos - 1] < d); pos--)
+        {
+            candidate[pos] = candidate[pos - 1];
+            depth[pos]     = depth[pos - 1];
+        }
+        
+        candidate[pos] = t;
+        depth[pos]     = d;
+        num_candidates++;
+    }
+    
+    unsigned int num_selected = 0;
+    unsigned int exited = 0;
+    
+    for (unsigned int k = 0; k < num_candidates; k++)
+    {
+        size_t t = candidate[k];
+        
+        unsigned int exits = P(exit_set)(c, id, P(domain)(c, c->from[t], c->to[t]));
+        if (exits & exited) { continue; }
+        
+        exited |= exits;
+        candidate[num_selected++] = t;
+    }
+    
+    if (!num_selected) { return 0; }
+    
+    for (unsigned int k = 0; k < num_selected; k++) { id = P(transition)(c, id, candidate[k]); }
+    
+    return id;
+}
+
+
+// open addressing set of state IDs (zero marks an empty slot)
+static int P(insert)(unsigned int *set, unsigned int mask, unsigned int state)
+{
+    unsigned int i = (state * 2654435761u) & mask;
+    
+    while (set[i])
+    {
+        if (set[i] == state) { return 0; }
+        i = (i + 1) & mask;
+    }
+    
+    set[i] = state;
+    return 1;
+}
+
+
+state_machine *state_machine_statechart_compile_using
+    (const state_machine_statechart_state *states, size_t num_states,
+     const state_machine_statechart_transition *transitions, size_t num_transitions,
+     unsigned int actions, unsigned int max_states, unsigned int *initial,
+     bse_simple_memory_manager *mgr)
+{
+    P(chart) c;
+    state_machine *m = NULL;
+    unsigned int *indexes = NULL;
+    unsigned int *queue = NULL;
+    unsigned int *set = NULL;
+    unsigned int set_size = 1;
+    
+    if (!states || !num_states)             { X2(bad_arg, "need a state"); }
+    if (num_transitions && !transitions)    { X(bad_arg); }
+    if (!max_states)                        { X(bad_arg); }
+    if (!mgr)                               { X(bad_arg); }
+    
+    if (num_states > STATE_MACHINE_STATECHART_MAX_STATES)
+        { X2(bad_arg, "too many states for their flags not to share bits"); }
+    
+    c.n    = (unsigned int) num_states;
+    c.root = c.n;
+    c.flag[c.root]     = 0;
+    c.parent[c.root]   = c.root;
+    c.type[c.root]     = STATE_MACHINE_STATECHART_EXCLUSIVE;
+    c.children[c.root] = 0;
+    
+    unsigned int used = 0;
+    
+    for (unsigned int i = 0; i < c.n; i++)
+    {
+        unsigned int flag = states[i].flag;
+        
+        if (!flag)          { X2(bad_arg, "state flag must be non-zero"); }
+        if (flag & used)    { X4(bad_arg, "state flags must not share bits", 0, flag); }
+        used |= flag;
+        
+        c.flag[i]     = flag;
+        c.type[i]     = states[i].type;
+        c.children[i] = 0;
+        
+        c.n = i; // parents must come before children
+        c.parent[i] = P(find)(&c, states[i].parent);
+        c.n = (unsigned int) num_states;
+        
+        if (c.parent[i] == STATE_MACHINE_INVALID)
+            { X4(bad_arg, "parent must be listed before the state", 0, flag); }
+        
+        c.children[c.parent[i]] |= flag;
+    }
+    
+    for (unsigned int i = 0; i < c.n; i++)
+    {
+        if ((c.type[i] & STATE_MACHINE_STATECHART_PARALLEL) && (c.type[i] & HISTORY_ANY))
+            { X4(bad_arg, "a parallel state cannot have a history", 0, c.flag[i]); }
+    }
+    
+    indexes = mgr->allocate(sizeof(unsigned int) * 2 * (num_transitions ? num_transitions : 1), mgr->user_arg);
+    if (!indexes) { X(allocate); }
+    
+    c.transitions     = transitions;
+    c.num_transitions = num_transitions;
+    c.from            = indexes;
+    c.to              = indexes + num_transitions;
+    
+    for (size_t t = 0; t < num_transitions; t++)
+    {
+        if (transitions[t].action >= actions) { X4(bad_arg, "invalid action", 0, transitions[t].action); }
+        
+        c.from[t] = P(find)(&c, transitions[t].from);
+        c.to[t]   = P(find)(&c, transitions[t].to);
+        
+        if ((c.from[t] == STATE_MACHINE_INVALID) || (c.from[t] == c.root))
+            { X4(bad_arg, "unknown transition source", 0, transitions[t].from); }
+        if ((c.to[t] == STATE_MACHINE_INVALID) || (c.to[t] == c.root))
+            { X4(bad_arg, "unknown transition target", 0, transitions[t].to); }
+    }
+    
+    // the set of seen states is a power of two at least twice max_states
+    if (max_states > (UINT_MAX / 4) + 1) { X2(bad_arg, "max_states too large"); }
+    
+    while (set_size < 2u * max_states) { set_size <<= 1; }
+    
+    queue = mgr->allocate(sizeof(unsigned int) * max_states, mgr->user_arg);
+    if (!queue) { X(allocate); }
+    
+    set = mgr->allocate(sizeof(unsigned int) * set_size, mgr->user_arg);
+    if (!set) { X(allocate); }
+    
+    for (unsigned int i = 0; i < set_size; i++) { set[i] = 0; }
+    
+    unsigned int count = 0;
+    unsigned int start = P(enter)(&c, 0, c.root, 0);
+    
+    P(insert)(set, set_size - 1, start);
+    queue[count++] = start;
+    
+    // breadth first search; queue doubles as the list of discovered states
+    for (unsigned int head = 0; head < count; head++)
+    {
+        for (unsigned int a = 0; a < actions; a++)
+        {
+            unsigned int to = P(step)(&c, queue[head], a);
+            if (!to) { continue; }
+            
+            if (!P(insert)(set, set_size - 1, to)) { continue; }
+            if (count >= max_states) { X4(too_many_states, "limit", 0, max_states); }
+            queue[count++] = to;
+        }
+    }
+    
+    m = state_machine_new_using(count, actions, mgr);
+    if (!m) { X(state_machine_new_using); }
+    
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (!state_machine_add_state(m, queue[i])) { X(state_machine_add_state); }
+    }
+    
+    for (unsigned int i = 0; i < count; i++)
+    {
+        for (unsigned int a = 0; a < actions; a++)
+        {
+            unsigned int to = P(step)(&c, queue[i], a);
+            if (!to) { continue; }
+            
+            if (!state_machine_add_transition(m, a, queue[i], to))
+                { X(state_machine_add_transition); }
+        }
+    }
+    
+    if (initial) { *initial = start; }
+    
+    mgr->deallocate(set, sizeof(unsigned int) * set_size, mgr->user_arg);
+    mgr->deallocate(queue, sizeof(unsigned int) * max_states, mgr->user_arg);
+    mgr->deallocate(indexes, sizeof(unsigned int) * 2 * (num_transitions ? num_transitions : 1), mgr->user_arg);
+    
+    return m;
+    
+    err_state_machine_add_transition:
+    err_state_machine_add_state:
+        state_machine_free(m);
+    err_state_machine_new_using:
+    err_too_many_states:
+    err_allocate:
+        if (set) { mgr->deallocate(set, sizeof(unsigned int) * set_size, mgr->user_arg); }
+        if (queue) { mgr->deallocate(queue, sizeof(unsigned int) * max_states, mgr->user_arg); }
+    err_bad_arg:
+        if (indexes) { mgr->deallocate(indexes, sizeof(unsigned int) * 2 * (num_transitions ? num_transitions : 1), mgr->user_arg); }
+        return NULL;
+}
+
+
+state_machine *state_machine_statechart_compile
+    (const state_machine_statechart_state *states, size_t num_states,
+     const state_machine_statechart_transition *transitions, size_t num_transitions,
+     unsigned int actions, unsigned int max_states, unsigned int *initial)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_statechart_compile_using
+        (states, num_states, transitions, num_transitions, actions, max_states, initial, &mgr);
+}
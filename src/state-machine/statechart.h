@@ -0,0 +1,101 @@
+/*
+ 
+ state-machine/statechart.h
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ A statechart describes behaviour with nested states: an exclusive state has
+ exactly one active child (the first child listed, on entry, unless it has a
+ history), a parallel state has every child active at once (orthogonal
+ regions), and a transition from a state applies to all its descendants unless
+ a more deeply nested active state handles the same action.
+ 
+ A statechart is compiled ahead of time into an ordinary state machine, so it
+ costs nothing when actions are taken. Each state of the chart is identified by
+ a flag and flags must not share bits. The ID of a compiled state is the OR of
+ the flags of the active chart states (a state is active if its flag and the
+ flags of all its ancestors are set), plus the flags that a history state
+ remembers while it is inactive, in the same style as the hand-written models.
+ 
+*/
+
+#ifndef STATE_MACHINE_STATECHART_H
+#define STATE_MACHINE_STATECHART_H
+
+#ifndef BSE_BASE_H
+#   include "base.h"
+#endif
+
+#include "state-machine/state-machine.h"
+#include <stddef.h> // size_t
+
+// Types of a statechart state (a state with no children is a simple state)
+#define STATE_MACHINE_STATECHART_EXCLUSIVE    0 // one active child
+#define STATE_MACHINE_STATECHART_PARALLEL     1 // every child active
+#define STATE_MACHINE_STATECHART_HISTORY      2 // re-entry resumes the last child
+#define STATE_MACHINE_STATECHART_DEEP_HISTORY 4 // ... and its descendants
+
+typedef struct state_machine_statechart_state state_machine_statechart_state;
+typedef struct state_machine_statechart_transition state_machine_statechart_transition;
+
+// A state identified by a flag, inside the state with the flag parent (or at
+// the top level if parent is 0). A parent must be listed before its children.
+// History applies to exclusive states only.
+struct state_machine_statechart_state
+{
+    unsigned int flag;
+    unsigned int parent;
+    unsigned int type;
+};
+
+// When the action is taken in the state with the flag from, or any of its
+// descendants, exit from and enter to. Where several transitions of the same
+// state handle an action, the first listed is used.
+struct state_machine_statechart_transition
+{
+    unsigned int action;
+    unsigned int from;
+    unsigned int to;
+};
+
+// Compile a statechart over an alphabet of actions into a new state machine
+// holding every compiled state reachable from the initial state (the first
+// top-level state, entered by default), which is stored in initial (may be
+// NULL). Fails if the chart is invalid or reaches more than max_states states.
+// max_states may be at most UINT_MAX / 4 + 1.
+state_machine *state_machine_statechart_compile
+    (const state_machine_statechart_state *states, size_t num_states,
+     const state_machine_statechart_transition *transitions, size_t num_transitions,
+     unsigned int actions, unsigned int max_states, unsigned int *initial);
+
+// As state_machine_statechart_compile, but accepts a structure indicating how
+// memory should be allocated and deallocated.
+state_machine *state_machine_statechart_compile_using
+    (const state_machine_statechart_state *states, size_t num_states,
+     const state_machine_statechart_transition *transitions, size_t num_transitions,
+     unsigned int actions, unsigned int max_states, unsigned int *initial,
+     bse_simple_memory_manager *mgr);
+
+#endif
@@ -0,0 +1,463 @@
+/*
+ 
+ state-machine/timers.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/timers.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy
+#include <limits.h> // ULLONG_MAX
+
+#define P(x) state_machine_timers_private_##x
+
+#define STATE_MACHINE_TIMERS_LEVELS 4
+#define STATE_MACHINE_TIMERS_BITS   6
+#define STATE_MACHINE_TIMERS_SLOTS  (1u << STATE_MACHINE_TIMERS_BITS)
+#define STATE_MACHINE_TIMERS_MASK   (STATE_MACHINE_TIMERS_SLOTS - 1)
+#define STATE_MACHINE_TIMERS_BUCKETS (STATE_MACHINE_TIMERS_LEVELS * STATE_MACHINE_TIMERS_SLOTS)
+#define STATE_MACHINE_TIMERS_RANGE  (1ull << (STATE_MACHINE_TIMERS_BITS * STATE_MACHINE_TIMERS_LEVELS))
+
+
+typedef struct P(timer) P(timer);
+
+struct P(timer)
+{
+    unsigned long long expiry;
+    unsigned int action;
+    unsigned int bucket; // STATE_MACHINE_INVALID when not pending
+    unsigned int next;   // doubly linked list of elements in a bucket
+    unsigned int prev;
+};
+
+
+typedef struct P(timeout) P(timeout);
+
+struct P(timeout)
+{
+    unsigned long long delay; // 0 for none
+    unsigned int action;
+};
+
+
+struct state_machine_timers
+{
+    bse_simple_memory_manager mgr;
+    size_t size; // of the single allocation holding everything below
+    
+    state_machine_population *p;
+    state_machine *m;
+    unsigned int elements;
+    unsigned int states;
+    unsigned int actions;
+    
+    unsigned long long next; // the next tick to process
+    
+    unsigned long long occupied[STATE_MACHINE_TIMERS_LEVELS]; // bit per slot
+    unsigned int head[STATE_MACHINE_TIMERS_BUCKETS];
+    
+    P(timer) *timer;     // for each element
+    P(timeout) *timeout; // for each state index
+};
+
+
+static void P(remove)(state_machine_timers *w, unsigned int element)
+{
+    P(timer) *t = &w->timer[element];
+    if (t->bucket == STATE_MACHINE_INVALID) { return; }
+    
+    if (t->prev != STATE_MACHINE_INVALID) { w->timer[t->prev].next = t->next; }
+    else                                  { w->head[t->bucket] = t->next; }
+    
+    if (t->next != STATE_MACHINE_INVALID) { w->timer[t->next].prev = t->prev; }
+    
+    if (w->head[t->bucket] == STATE_MACHINE_INVALID)
+    {
+        unsigned int level = t->bucket / STATE_MACHINE_TIMERS_SLOTS;
+        unsigned int slot  = t->bucket % STATE_MACHINE_TIMERS_SLOTS;
+        w->occupied[level] &= ~(1ull << slot);
+    }
+    
+    t->bucket = STATE_MACHINE_INVALID;
+}
+
+
+// file a pending timer in the lowest level whose range reaches its expiry
+static void P(insert)(state_machine_timers *w, unsigned int element)
+{
+    P(timer) *t = &w->timer[element];
+    
+    unsigned long long expiry = t->expiry;
+    if (expiry < w->next) { expiry = w->next; }
+    
+    unsigned long long delta = expiry - w->next;
+    if (delta >= STATE_MACHINE_TIMERS_RANGE) { expiry = w->next + STATE_MACHINE_TIMERS_RANGE - 1; delta = STATE_MACHINE_TIMERS_RANGE - 1; }
+    
+    unsigned int level = 0;
+    while (delta >= (1ull << (STATE_MACHINE_TIMERS_BITS * (level + 1)))) { level++; }
+    
+    unsigned int slot = (unsigned int) (expiry >> (STATE_MACHINE_TIMERS_BITS * level)) & STATE_MACHINE_TIMERS_MASK;
+    unsigned int bucket = (level * STATE_MACHINE_TIMERS_SLOTS) + slot;
+    
+    t->bucket = bucket;
+    t->prev   = STATE_MACHINE_INVALID;
+    t->next   = w->head[bucket];
+    
+    if (t->next != STATE_MACHINE_INVALID) { w->timer[t->next].prev = element; }
+    
+    w->head[bucket] = element;
+    w->occupied[level] |= (1ull << slot);
+}
+
+
+static void P(schedule)
+    (state_machine_timers *w, unsigned int element, unsigned int action,
+     unsigned long long delay)
+{
+    P(remove)(w, element);
+    
+    P(timer) *t = &w->timer[element];
+    t->action = action;
+    t->expiry = w->next + delay - 1; // the current tick is w->next - 1
+    
+    P(insert)(w, element);
+}
+
+
+// detach the list of a bucket and return its first element
+static unsigned int P(take)(state_machine_timers *w, unsigned int level, unsigned int slot)
+{
+    unsigned int bucket = (level * STATE_MACHINE_TIMERS_SLOTS) + slot;
+    unsigned int first = w->head[bucket];
+    
+    w->head[bucket] = STATE_MACHINE_INVALID;
+    w->occupied[level] &= ~(1ull << slot);
+    
+    for (unsigned int i = first; i != STATE_MACHINE_INVALID; i = w->timer[i].next)
+        { w->timer[i].bucket = STATE_MACHINE_INVALID; }
+    
+    return first;
+}
+
+
+// arm or cancel the timeout of the state an element is now in
+static void P(enter)(state_machine_timers *w, unsigned int element)
+{
+    unsigned int id = state_machine_population_state(w->p, element);
+    unsigned int index = state_machine_state_index(w->m, id);
+    
+    P(timeout) *timeout = &w->timeout[index];
+    
+    if (timeout->delay) { P(schedule)(w, element, timeout->action, timeout->delay); }
+    else                { P(remove)(w, element); }
+}
+
+
+state_machine_timers *state_machine_timers_new_using
+    (state_machine_population *p, unsigned long long now,
+     bse_simple_memory_manager *mgr)
+{
+    if (!p)   { X(bad_arg); }
+    if (!mgr) { X(bad_arg); }
+    
+    state_machine *m = state_machine_population_machine(p);
+    unsigned int elements = state_machine_population_elements(p);
+    unsigned int states = state_machine_states(m);
+    
+    size_t size = sizeof(state_machine_timers)
+        + (sizeof(P(timer)) * elements)
+        + (sizeof(P(timeout)) * states);
+    
+    state_machine_timers *w = mgr->allocate(size, mgr->user_arg);
+    if (!w) { X(allocate_timers); }
+    
+    memcpy(&w->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    w->size     = size;
+    w->p        = p;
+    w->m        = m;
+    w->elements = elements;
+    w->states   = states;
+    w->actions  = state_machine_actions(m);
+    w->next     = now + 1;
+    w->timer    = (P(timer) *) (w + 1);
+    w->timeout  = (P(timeout) *) (w->timer + elements);
+    
+    for (unsigned int i = 0; i < STATE_MACHINE_TIMERS_LEVELS; i++) { w->occupied[i] = 0; }
+    for (unsigned int i = 0; i < STATE_MACHINE_TIMERS_BUCKETS; i++) { w->head[i] = STATE_MACHINE_INVALID; }
+    
+    for (unsigned int i = 0; i < elements; i++)
+    {
+        w->timer[i].bucket = STATE_MACHINE_INVALID;
+        w->timer[i].next   = STATE_MACHINE_INVALID;
+        w->timer[i].prev   = STATE_MACHINE_INVALID;
+    }
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        w->timeout[i].delay  = 0;
+        w->timeout[i].action = 0;
+    }
+    
+    return w;
+    
+    err_allocate_timers:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_timers *state_machine_timers_new
+    (state_machine_population *p, unsigned long long now)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_timers_new_using(p, now, &mgr);
+}
+
+
+void state_machine_timers_free(state_machine_timers *w)
+{
+    if (!w) { X(bad_arg); }
+    
+    w->mgr.deallocate(w, w->size, w->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+int state_machine_timers_set_timeout
+    (state_machine_timers *w, unsigned int state, unsigned int action,
+     unsigned long long delay)
+{
+    if (!w)                     { X(bad_arg); }
+    if (action >= w->actions)   { X4(bad_arg, "invalid action", 0, action); }
+    
+    unsigned int index = state_machine_state_index(w->m, state);
+    if (index == STATE_MACHINE_INVALID) { X4(bad_arg, "invalid state", 0, state); }
+    
+    w->timeout[index].delay  = delay;
+    w->timeout[index].action = action;
+    
+    for (unsigned int i = 0; i < w->elements; i++)
+    {
+        if (state_machine_population_state(w->p, i) == state) { P(enter)(w, i); }
+    }
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_timers_arm
+    (state_machine_timers *w, unsigned int element, unsigned int action,
+     unsigned long long delay)
+{
+    if (!w)                     { X(bad_arg); }
+    if (element >= w->elements) { X4(bad_arg, "invalid element", 0, element); }
+    if (action >= w->actions)   { X4(bad_arg, "invalid action", 0, action); }
+    if (!delay)                 { X2(bad_arg, "delay must be at least 1"); }
+    
+    P(schedule)(w, element, action, delay);
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_timers_cancel(state_machine_timers *w, unsigned int element)
+{
+    if (!w)                     { X(bad_arg); }
+    if (element >= w->elements) { X4(bad_arg, "invalid element", 0, element); }
+    
+    P(remove)(w, element);
+    
+    return 1;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+unsigned int state_machine_timers_take_action
+    (state_machine_timers *w, unsigned int element, unsigned int action)
+{
+    if (!w) { X(bad_arg); }
+    
+    unsigned int to = state_machine_population_take_action(w->p, element, action);
+    if (to) { P(enter)(w, element); }
+    
+    return to;
+    
+    err_bad_arg:
+        return 0;
+}
+
+
+size_t state_machine_timers_dispatch
+    (state_machine_timers *w, const state_machine_event *events, size_t n)
+{
+    size_t taken = 0;
+    
+    if (!w)            { X(bad_arg); }
+    if (n && !events)  { X(bad_arg); }
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned int element = events[i].element;
+        unsigned int action  = events[i].action;
+        
+        if (element >= w->elements) { X4(bad_arg, "invalid element", 0, element); }
+        if (action >= w->actions)   { X4(bad_arg, "invalid action", 0, action); }
+        
+        if (state_machine_timers_take_action(w, element, action)) { taken++; }
+    }
+    
+    return taken;
+    
+    err_bad_arg:
+        return taken;
+}
+
+
+// the index of the lowest set bit of a non-zero word
+static unsigned int P(lowest)(unsigned long long bits)
+{
+#   ifdef __GNUC__
+        return (unsigned int) __builtin_ctzll(bits);
+#   else
+        unsigned int i = 0;
+        for (; !(bits & 1); bits >>= 1) { i++; }
+        return i;
+#   endif
+}
+
+
+// The first tick, from a given one on, at which a bucket of the wheel is due:
+// a slot of level 0 expires, or a slot of a higher level moves down. Returns
+// ULLONG_MAX if no timer is pending. Between the two nothing happens, so the
+// wheel can skip there directly.
+static unsigned long long P(next_event)(state_machine_timers *w, unsigned long long from)
+{
+    unsigned long long best = ULLONG_MAX;
+    
+    for (unsigned int level = 0; level < STATE_MACHINE_TIMERS_LEVELS; level++)
+    {
+        unsigned long long bits = w->occupied[level];
+        if (!bits) { continue; }
+        
+        unsigned int shift = STATE_MACHINE_TIMERS_BITS * level;
+        unsigned long long lap = 1ull << (shift + STATE_MACHINE_TIMERS_BITS);
+        unsigned long long start = from & ~(lap - 1);
+        unsigned int slot = (unsigned int) (from >> shift) & STATE_MACHINE_TIMERS_MASK;
+        
+        // a slot is processed at the start of its span of ticks, so the
+        // current slot is still to come only if that is now
+        int aligned = !(from & ((1ull << shift) - 1));
+        unsigned long long ahead = bits & ~((aligned ? (1ull << slot) : (2ull << slot)) - 1);
+        
+        unsigned long long at = ahead
+            ? start + ((unsigned long long) P(lowest)(ahead) << shift)
+            : start + lap + ((unsigned long long) P(lowest)(bits) << shift);
+        
+        if (at < best) { best = at; }
+    }
+    
+    return best;
+}
+
+
+size_t state_machine_timers_tick(state_machine_timers *w, unsigned long long now)
+{
+    size_t fired = 0;
+    
+    if (!w) { X(bad_arg); }
+    
+    while (w->next <= now)
+    {
+        // go straight to the next tick with anything to do
+        unsigned long long tick = P(next_event)(w, w->next);
+        if (tick > now) { w->next = now + 1; break; }
+        
+        w->next = tick;
+        
+        // at the start of each lap of a level, move the timers of the next
+        // slot of the level above down, highest level first
+        if (!(tick & STATE_MACHINE_TIMERS_MASK))
+        {
+            unsigned int top = 1;
+            while ((top < STATE_MACHINE_TIMERS_LEVELS - 1)
+                && !((tick >> (STATE_MACHINE_TIMERS_BITS * top)) & STATE_MACHINE_TIMERS_MASK))
+                { top++; }
+            
+            for (unsigned int level = top; level >= 1; level--)
+            {
+                unsigned int slot = (unsigned int) (tick >> (STATE_MACHINE_TIMERS_BITS * level)) & STATE_MACHINE_TIMERS_MASK;
+                unsigned int i = P(take)(w, level, slot);
+                
+                while (i != STATE_MACHINE_INVALID)
+                {
+                    unsigned int next = w->timer[i].next;
+                    P(insert)(w, i);
+                    i = next;
+                }
+            }
+        }
+        
+        unsigned int slot = (unsigned int) tick & STATE_MACHINE_TIMERS_MASK;
+        unsigned int i = P(take)(w, 0, slot);
+        
+        // the timers expire in this tick; taking their actions may arm new
+        // timers, which are due at least one tick later
+        w->next = tick + 1;
+        
+        while (i != STATE_MACHINE_INVALID)
+        {
+            unsigned int next = w->timer[i].next;
+            
+            fired++;
+            state_machine_timers_take_action(w, i, w->timer[i].action);
+            
+            i = next;
+        }
+    }
+    
+    return fired;
+    
+    err_bad_arg:
+        return fired;
+}
@@ -0,0 +1,104 @@
+/*
+ 
+ state-machine/timers.h
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ A timer wheel schedules timed actions for the elements of a population, for
+ things like hover delays, long presses and key repeat. A state can be given a
+ timeout: when an element enters the state a timer is armed, any transition
+ out of the state cancels it, and if it expires its action is taken. Timers
+ can also be armed and cancelled directly.
+ 
+ Each element has at most one pending timer. Arming and cancelling cost O(1),
+ and a tick fires every expired timer in order of expiry, at a cost that grows
+ with the number of expirations rather than the number of pending timers or
+ of ticks that pass (idle ticks are skipped using a bitmap per level). The
+ wheel has four levels of 64 slots; timers further than 64^4 ticks away are
+ parked in the last slot and rescheduled as time passes.
+ 
+ Actions must be taken through the timer wheel (rather than directly on the
+ population) for state timeouts to follow the elements' states.
+ 
+*/
+
+#ifndef STATE_MACHINE_TIMERS_H
+#define STATE_MACHINE_TIMERS_H
+
+#ifndef BSE_BASE_H
+#   include "base.h"
+#endif
+
+#include "state-machine/state-machine.h"
+#include "state-machine/population.h"
+#include <stddef.h> // size_t
+
+typedef struct state_machine_timers state_machine_timers;
+
+// Create a timer wheel for a population at the time now, in ticks of any unit
+// (e.g. milliseconds). The population must outlive the timer wheel.
+state_machine_timers *state_machine_timers_new
+    (state_machine_population *p, unsigned long long now);
+
+// As state_machine_timers_new, but accepts a structure indicating how memory
+// should be allocated and deallocated.
+state_machine_timers *state_machine_timers_new_using
+    (state_machine_population *p, unsigned long long now,
+     bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a timer wheel
+void state_machine_timers_free(state_machine_timers *w);
+
+// When an element enters a state, take an action after delay ticks unless it
+// leaves the state first. A delay of 0 removes the timeout. Elements already
+// in the state are armed from now.
+int state_machine_timers_set_timeout
+    (state_machine_timers *w, unsigned int state, unsigned int action,
+     unsigned long long delay);
+
+// Take an action on an element after delay (at least 1) ticks, replacing any
+// pending timer of the element.
+int state_machine_timers_arm
+    (state_machine_timers *w, unsigned int element, unsigned int action,
+     unsigned long long delay);
+
+// Cancel the pending timer of an element, if any.
+int state_machine_timers_cancel(state_machine_timers *w, unsigned int element);
+
+// As state_machine_population_take_action, also arming or cancelling the
+// element's timer when it changes state (or when a transition leads back to
+// the same state, which restarts its timeout).
+unsigned int state_machine_timers_take_action
+    (state_machine_timers *w, unsigned int element, unsigned int action);
+
+// As state_machine_population_dispatch, through state_machine_timers_take_action.
+size_t state_machine_timers_dispatch
+    (state_machine_timers *w, const state_machine_event *events, size_t n);
+
+// Advance time to now, taking the action of every timer that expires at or
+// before now. Returns the number of timers that fired.
+size_t state_machine_timers_tick(state_machine_timers *w, unsigned long long now);
+
+#endif
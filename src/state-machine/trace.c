@@ -0,0 +1,437 @@
+/*
+ 
+ state-machine/trace.c
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+*/
+
+#define BSE_EXPOSE_MEMORY_MANAGER
+#include "base.h" // eXceptions
+#include "state-machine/trace.h"
+#include <stddef.h> // NULL
+#include <string.h> // memcpy, memcmp, memset
+#include <stdio.h> // FILE
+#include <errno.h>
+
+#ifdef BSE_LINUX
+#   include <fcntl.h> // open
+#   include <unistd.h> // close
+#   include <sys/mman.h> // mmap
+#   include <sys/stat.h> // fstat
+#endif
+
+#define P(x) state_machine_trace_private_##x
+
+#define STATE_MACHINE_TRACE_BUFFER 65536
+#define STATE_MACHINE_TRACE_MAGIC "SMTRACE\1"
+#define STATE_MACHINE_TRACE_MAGIC_SIZE 8
+#define STATE_MACHINE_TRACE_MAX_EVENT 15 // three 5-byte varints
+
+// Replay applies events in runs of at most this many, tracking the elements
+// of a run in an open addressing set of STATE_MACHINE_TRACE_SEEN slots
+#define STATE_MACHINE_TRACE_RUN 256
+#define STATE_MACHINE_TRACE_SEEN 1024 // a power of two > STATE_MACHINE_TRACE_RUN
+
+
+struct state_machine_trace
+{
+    bse_simple_memory_manager mgr;
+    
+    state_machine_write_fn write;
+    void *arg;
+    int failed;
+    
+    unsigned int element; // of the previous event
+    size_t used;
+    unsigned char buffer[STATE_MACHINE_TRACE_BUFFER];
+};
+
+
+static unsigned char *P(put_varint)(unsigned char *out, unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    
+    *out++ = (unsigned char) value;
+    
+    return out;
+}
+
+
+// returns NULL if the varint is truncated or too long
+static const unsigned char *P(get_varint)
+    (const unsigned char *in, const unsigned char *end, unsigned int *value)
+{
+    unsigned int result = 0;
+    
+    for (unsigned int shift = 0; shift < 35; shift += 7)
+    {
+        if (in == end) { return NULL; }
+        
+        unsigned int byte = *in++;
+        if ((shift == 28) && (byte > 0x0F)) { return NULL; } // over 32 bits
+        
+        result |= (byte & 0x7F) << shift;
+        
+        if (byte < 0x80) { *value = result; return in; }
+    }
+    
+    return NULL;
+}
+
+
+state_machine_trace *state_machine_trace_new_using
+    (state_machine_write_fn write, void *arg, bse_simple_memory_manager *mgr)
+{
+    if (!write) { X(bad_arg); }
+    if (!mgr)   { X(bad_arg); }
+    
+    state_machine_trace *t = mgr->allocate(sizeof(state_machine_trace), mgr->user_arg);
+    if (!t) { X(allocate_trace); }
+    
+    memcpy(&t->mgr, mgr, sizeof(bse_simple_memory_manager));
+    
+    t->write   = write;
+    t->arg     = arg;
+    t->failed  = 0;
+    t->element = 0;
+    t->used    = STATE_MACHINE_TRACE_MAGIC_SIZE;
+    
+    memcpy(t->buffer, STATE_MACHINE_TRACE_MAGIC, STATE_MACHINE_TRACE_MAGIC_SIZE);
+    
+    return t;
+    
+    err_allocate_trace:
+    err_bad_arg:
+        return NULL;
+}
+
+
+state_machine_trace *state_machine_trace_new
+    (state_machine_write_fn write, void *arg)
+{
+    bse_simple_memory_manager mgr;
+    mgr.allocate   = bse_default_malloc;
+    mgr.deallocate = bse_default_free;
+    mgr.user_arg   = NULL;
+    
+    return state_machine_trace_new_using(write, arg, &mgr);
+}
+
+
+void state_machine_trace_free(state_machine_trace *t)
+{
+    if (!t) { X(bad_arg); }
+    
+    t->mgr.deallocate(t, sizeof(state_machine_trace), t->mgr.user_arg);
+    
+    err_bad_arg:
+        return;
+}
+
+
+int state_machine_trace_flush(state_machine_trace *t)
+{
+    if (!t)         { X(bad_arg); }
+    if (t->failed)  { X2(write, "an earlier write failed"); }
+    
+    if (t->used && !t->write((const char *) t->buffer, t->used, t->arg))
+        { t->failed = 1; X(write); }
+    
+    t->used = 0;
+    
+    return 1;
+    
+    err_write:
+    err_bad_arg:
+        return 0;
+}
+
+
+int state_machine_trace_record
+    (state_machine_trace *t, unsigned int element, unsigned int action,
+     unsigned int state)
+{
+    if (!t) { X(bad_arg); }
+    
+    if (t->used > STATE_MACHINE_TRACE_BUFFER - STATE_MACHINE_TRACE_MAX_EVENT)
+        { if (!state_machine_trace_flush(t)) { X(flush); } }
+    
+    if (t->failed) { X2(write, "an earlier write failed"); }
+    
+    // zigzag encoding keeps small steps in either direction small
+    unsigned int delta = element - t->element;
+    unsigned int zigzag = (delta << 1) ^ (0u - (delta >> 31));
+    
+    unsigned char *out = t->buffer + t->used;
+    out = P(put_varint)(out, zigzag);
+    out = P(put_varint)(out, action);
+    out = P(put_varint)(out, state);
+    
+    t->used = (size_t) (out - t->buffer);
+    t->element = element;
+    
+    return 1;
+    
+    err_write:
+    err_flush:
+    err_bad_arg:
+        return 0;
+}
+
+
+size_t state_machine_trace_dispatch
+    (state_machine_trace *t, state_machine_population *p,
+     const state_machine_event *events, size_t n)
+{
+    size_t taken = 0;
+    
+    if (!t)            { X(bad_arg); }
+    if (!p)            { X(bad_arg); }
+    if (n && !events)  { X(bad_arg); }
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned int element = events[i].element;
+        unsigned int action  = events[i].action;
+        
+        if (state_machine_population_take_action(p, element, action)) { taken++; }
+        
+        unsigned int state = state_machine_population_state(p, element);
+        if (!state) { X2(bad_arg, "invalid event"); }
+        
+        if (!state_machine_trace_record(t, element, action, state)) { X(record); }
+    }
+    
+    return taken;
+    
+    err_record:
+    err_bad_arg:
+        return taken;
+}
+
+
+// open addressing set of the elements of a run (slots hold element + 1, so
+// that zero marks an empty slot). Returns zero if the element is already in.
+static int P(mark)(unsigned int *seen, unsigned int element)
+{
+    unsigned int mask = STATE_MACHINE_TRACE_SEEN - 1;
+    unsigned int i = (element * 2654435761u) & mask;
+    
+    while (seen[i])
+    {
+        if (seen[i] == element + 1) { return 0; }
+        i = (i + 1) & mask;
+    }
+    
+    seen[i] = element + 1;
+    return 1;
+}
+
+
+int state_machine_trace_replay
+    (const void *data, size_t size, state_machine_population *p,
+     state_machine_divergence_fn divergence, void *arg, size_t *divergences)
+{
+    size_t count = 0;
+    
+    if (!data && size)  { X(bad_arg); }
+    if (!p)             { X(bad_arg); }
+    
+    if ((size < STATE_MACHINE_TRACE_MAGIC_SIZE)
+     || memcmp(data, STATE_MACHINE_TRACE_MAGIC, STATE_MACHINE_TRACE_MAGIC_SIZE))
+        { X2(bad_trace, "not a trace, or an unsupported version"); }
+    
+    state_machine *m = state_machine_population_machine(p);
+    unsigned int elements = state_machine_population_elements(p);
+    unsigned int actions  = state_machine_actions(m);
+    
+    const unsigned char *in  = (const unsigned char *) data + STATE_MACHINE_TRACE_MAGIC_SIZE;
+    const unsigned char *end = (const unsigned char *) data + size;
+    
+    state_machine_event run[STATE_MACHINE_TRACE_RUN];
+    unsigned int recorded[STATE_MACHINE_TRACE_RUN];
+    unsigned int seen[STATE_MACHINE_TRACE_SEEN];
+    
+    const char *invalid = NULL; // why decoding stopped, if the trace is bad
+    unsigned int detail = 0;
+    unsigned int element = 0; // of the last event decoded
+    size_t first = 0; // position in the trace of the first event of a run
+    
+    while ((in != end) && !invalid)
+    {
+        size_t n = 0;
+        memset(seen, 0, sizeof(seen));
+        
+        // Decode a run of events for distinct elements, so that after one
+        // batch dispatch each element is in the state its event left it in.
+        // An event for an element already in the run starts the next run.
+        while ((in != end) && (n < STATE_MACHINE_TRACE_RUN))
+        {
+            unsigned int zigzag, action, state;
+            const unsigned char *next = in;
+            
+            next = P(get_varint)(next, end, &zigzag);
+            if (next) { next = P(get_varint)(next, end, &action); }
+            if (next) { next = P(get_varint)(next, end, &state); }
+            if (!next) { invalid = "truncated event"; break; }
+            
+            unsigned int to = element + ((zigzag >> 1) ^ (0u - (zigzag & 1)));
+            
+            if (to >= elements)    { invalid = "invalid element"; detail = to; break; }
+            if (action >= actions) { invalid = "invalid action"; detail = action; break; }
+            if (!P(mark)(seen, to)) { break; }
+            
+            run[n].element = to;
+            run[n].action  = action;
+            recorded[n]    = state;
+            n++;
+            
+            element = to;
+            in = next;
+        }
+        
+        state_machine_population_dispatch(p, run, n);
+        
+        for (size_t i = 0; i < n; i++)
+        {
+            unsigned int replayed = state_machine_population_state(p, run[i].element);
+            if (replayed == recorded[i]) { continue; }
+            
+            count++;
+            if (divergence)
+            {
+                divergence(first + i, run[i].element, run[i].action,
+                           recorded[i], replayed, arg);
+            }
+            
+            // resynchronise, so that one difference is not reported repeatedly
+            if (state_machine_state_index(m, recorded[i]) != STATE_MACHINE_INVALID)
+                { state_machine_population_set_state(p, run[i].element, recorded[i]); }
+        }
+        
+        first += n;
+    }
+    
+    if (invalid) { X4(bad_trace, invalid, 0, detail); }
+    
+    if (divergences) { *divergences = count; }
+    
+    return 1;
+    
+    err_bad_trace:
+        if (divergences) { *divergences = count; }
+    err_bad_arg:
+        return 0;
+}
+
+
+#ifdef BSE_LINUX
+
+int state_machine_trace_replay_file
+    (const char *path, state_machine_population *p,
+     state_machine_divergence_fn divergence, void *arg, size_t *divergences)
+{
+    int result = 0;
+    void *data = MAP_FAILED;
+    struct stat info;
+    
+    if (!path) { X(bad_arg); }
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { X3(open, path, errno); }
+    
+    if (fstat(fd, &info) < 0) { X3(stat, path, errno); }
+    
+    size_t size = (size_t) info.st_size;
+    if (!size) { X2(stat, "empty trace"); }
+    
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) { X3(map, path, errno); }
+    
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    
+    result = state_machine_trace_replay(data, size, p, divergence, arg, divergences);
+    
+    munmap(data, size);
+    close(fd);
+    
+    return result;
+    
+    err_map:
+    err_stat:
+        close(fd);
+    err_open:
+    err_bad_arg:
+        return 0;
+}
+
+#else
+
+int state_machine_trace_replay_file
+    (const char *path, state_machine_population *p,
+     state_machine_divergence_fn divergence, void *arg, size_t *divergences)
+{
+    int result = 0;
+    unsigned char *data = NULL;
+    long end = 0;
+    
+    if (!path) { X(bad_arg); }
+    
+    FILE *f = fopen(path, "rb");
+    if (!f) { X3(open, path, errno); }
+    
+    if (fseek(f, 0, SEEK_END))  { X3(read, path, errno); }
+    end = ftell(f);
+    if (end <= 0)               { X2(read, "empty trace"); }
+    if (fseek(f, 0, SEEK_SET))  { X3(read, path, errno); }
+    
+    size_t size = (size_t) end;
+    
+    data = bse_default_malloc(size, NULL);
+    if (!data) { X(read); }
+    
+    if (fread(data, 1, size, f) != size) { X3(read, path, errno); }
+    
+    result = state_machine_trace_replay(data, size, p, divergence, arg, divergences);
+    
+    bse_default_free(data, size, NULL);
+    fclose(f);
+    
+    return result;
+    
+    err_read:
+        if (data) { bse_default_free(data, (size_t) end, NULL); }
+        fclose(f);
+    err_open:
+    err_bad_arg:
+        return 0;
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ 
+ state-machine/trace.h
+ 
+ ------------------------------------------------------------------------------
+ 
+ Copyright (c) 2014 Ben Golightly <golightly.ben@googlemail.com>
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ 
+ ------------------------------------------------------------------------------
+ 
+ A trace is a compact binary record of the events applied to a population and
+ the state each event left its element in. A trace recorded in production can
+ be replayed offline against a new version of a model, reporting every event
+ where the recomputed state differs from the recorded one.
+ 
+ Format: the 7 bytes "SMTRACE" followed by a version byte (1), then for each
+ event three unsigned LEB128 varints: the zigzag-encoded difference between
+ its element and the previous event's element (starting from 0), its action,
+ and the resulting state ID. Typical events take 3 to 5 bytes.
+ 
+*/
+
+#ifndef STATE_MACHINE_TRACE_H
+#define STATE_MACHINE_TRACE_H
+
+#ifndef BSE_BASE_H
+#   include "base.h"
+#endif
+
+#include "state-machine/state-machine.h"
+#include "state-machine/population.h"
+#include <stddef.h> // size_t
+
+typedef struct state_machine_trace state_machine_trace;
+
+// Called by a replay for each event whose recomputed state differs from the
+// recorded state. Event is the position of the event in the trace.
+typedef void (*state_machine_divergence_fn)
+    (size_t event, unsigned int element, unsigned int action,
+     unsigned int recorded, unsigned int replayed, void *arg);
+
+// Create a trace writer. Encoded events are buffered and passed to the write
+// function in large blocks (see state_machine_write_fn).
+state_machine_trace *state_machine_trace_new
+    (state_machine_write_fn write, void *arg);
+
+// As state_machine_trace_new, but accepts a structure indicating how memory
+// should be allocated and deallocated.
+state_machine_trace *state_machine_trace_new_using
+    (state_machine_write_fn write, void *arg, bse_simple_memory_manager *mgr);
+
+// Frees the memory associated with a trace writer, without flushing it.
+void state_machine_trace_free(state_machine_trace *t);
+
+// Record that an action taken on an element left it in a given state.
+// Returns zero on failure, including if an earlier write failed.
+int state_machine_trace_record
+    (state_machine_trace *t, unsigned int element, unsigned int action,
+     unsigned int state);
+
+// As state_machine_population_dispatch, but also records every event and the
+// state it left its element in.
+size_t state_machine_trace_dispatch
+    (state_machine_trace *t, state_machine_population *p,
+     const state_machine_event *events, size_t n);
+
+// Pass any buffered events to the write function. Returns zero on failure.
+int state_machine_trace_flush(state_machine_trace *t);
+
+// Replay a trace held in memory against a population, which should be in the
+// same initial state as the recorded one. Events are applied in batches with
+// state_machine_population_dispatch. After a divergence the element is
+// put back in the recorded state, if the machine has it, so that each
+// difference is reported once. The divergence function may be NULL and the
+// number of divergences is stored in divergences (may be NULL).
+// Returns zero if the trace is malformed or refers to an invalid element or
+// action, in which case the events up to that point have been applied.
+int state_machine_trace_replay
+    (const void *data, size_t size, state_machine_population *p,
+     state_machine_divergence_fn divergence, void *arg, size_t *divergences);
+
+// As state_machine_trace_replay, for a trace file, which is memory mapped
+// where supported.
+int state_machine_trace_replay_file
+    (const char *path, state_machine_population *p,
+     state_machine_divergence_fn divergence, void *arg, size_t *divergences);
+
+#endif
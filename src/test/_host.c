@@ -38,6 +38,10 @@
  * _test.h TEST_FAIL changed to accept a string and TEST_FAIL_FATAL added
  * _host.c add usage and parse argc for --verbose
  
+ 20261019:
+ * _host.c -j N runs up to N tests at once (on Linux), capturing the output of
+   each and printing it in plan order
+ 
 */
 
 /* Test cases may call a function with invalid input or state and verify that
@@ -48,6 +52,37 @@
  * and the ID of the test is also included as a command line argument.
  * e.g. test-linux64 --verbose test_1 test_2 test_3 */
 
+/* Tests may also be run in parallel with -j N, e.g. test-linux64 -j 8, where
+ * N is the most tests to run at once (0 for the number of processors). Each
+ * test still runs in its own forked process, with its output collected
+ * through a pipe and printed once it and the tests before it have finished,
+ * so the output is the same as running the tests one at a time. */
+
+#include "base.h" // __STRING
+
+typedef struct test_case test_case;
+
+struct test_case
+{
+    int (*fp)(void);
+    const char *name;
+    const char *desc;
+};
+
+#define V(a)
+#define T(a, b) int a(void);
+#include "_plan.h"
+#undef T
+
+static const test_case plan[] =
+{
+#   define T(a, b) { a, __STRING(a), b },
+#   include "_plan.h"
+#   undef T
+};
+
+#define NUM_TESTS (sizeof(plan) / sizeof(plan[0]))
+
 
 #ifdef BSE_WINDOWS
 
@@ -58,6 +93,18 @@
 #include "base.h"       // X (exception)
 #include "test/_test.h"
 
+int processors(void)
+{
+    return 1;
+}
+
+
+int parallel(int jobs, int argc, char *argv[], int verbose)
+{
+    (void) jobs; (void) argc; (void) argv; (void) verbose;
+    return -1; // unsupported: run the tests one at a time
+}
+
 int run(int (*fp)(void), int verbose)
 {
     bse_quiet_exceptions = (0 == verbose); // suppress all errors from src/base.c
@@ -73,14 +120,20 @@ int run(int (*fp)(void), int verbose)
 
 #include <sys/types.h>  // pid_t
 #include <sys/wait.h>   // waitpid
+#include <poll.h>       // poll
 #include <stdio.h>      // printf
 #include <stdlib.h>     // _Exit
-#include <unistd.h>     // fork
+#include <unistd.h>     // fork, pipe, dup2
 #include <errno.h>
 #include <string.h>     // strlen
 #include "base.h"       // X (exception)
 #include "test/_test.h"
 
+int listed(int argc, char *argv[], const char *key);
+int contains(int argc, char *argv[], const char *key);
+void header(const char *name, const char *desc, int verbose);
+int test(int (*fp)(void), const char *name, const char *desc, int verbose);
+
 
 int run(int (*fp)(void), int verbose)
 {
@@ -127,10 +180,249 @@ int run(int (*fp)(void), int verbose)
     err_fork:
         return 0;
 }
+
+
+// A test running in parallel and its output so far
+typedef struct job job;
+
+struct job
+{
+    pid_t pid;
+    int fd; // read end of the pipe of its output, or -1 after end of file
+    int finished;
+    int status;
+    char *out;
+    size_t used;
+    size_t size;
+};
+
+
+static int start(job *j, int (*fp)(void), int verbose)
+{
+    int fds[2];
+    
+    if (-1 == pipe(fds)) { X3(pipe, "could not create a pipe", errno); }
+    
+    fflush(stdout);
+    fflush(stderr);
+    
+    pid_t pid = fork();
+    
+    if (pid == -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        X3(fork, "could not fork", errno);
+    }
+    else if (pid == 0) // in child
+    {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        
+        bse_quiet_exceptions = (0 == verbose); // suppress all errors from src/base.c
+        int result = fp();
+        bse_quiet_exceptions = 0; // turn error reporting back on
+        
+        fflush(stdout);
+        fflush(stderr);
+        _Exit(result);
+    }
+    
+    close(fds[1]);
+    
+    j->pid = pid;
+    j->fd  = fds[0];
+    
+    return 1;
+    
+    err_fork:
+    err_pipe:
+        return 0;
+}
+
+
+// Read what is available of a job's output. Returns 0 on failure.
+static int collect(job *j)
+{
+    if (j->used == j->size)
+    {
+        size_t size = j->size ? (2 * j->size) : 4096;
+        char *out = realloc(j->out, size);
+        if (!out) { X(realloc); }
+        
+        j->out  = out;
+        j->size = size;
+    }
+    
+    ssize_t got = read(j->fd, j->out + j->used, j->size - j->used);
+    
+    if (got < 0)
+    {
+        if (errno == EINTR) { return 1; }
+        X3(read, "could not read the output of a test", errno);
+    }
+    
+    if (got > 0) { j->used += (size_t) got; return 1; }
+    
+    // end of file: the child is exiting
+    close(j->fd);
+    j->fd = -1;
+    
+    while (-1 == waitpid(j->pid, &j->status, 0))
+        { if (errno != EINTR) { X3(wait, "could not wait for a test", errno); } }
+    
+    j->finished = 1;
+    
+    return 1;
+    
+    err_wait:
+    err_read:
+    err_realloc:
+        return 0;
+}
+
+
+int processors(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int) n : 1;
+}
+
+
+// Run the tests of the plan, up to a number at once. Returns non-zero if every
+// test passed, or -1 if the tests could not be run in parallel at all. If a
+// test cannot be started while none are running, the rest are run one at a
+// time as without -j.
+int parallel(int jobs, int argc, char *argv[], int verbose)
+{
+    job *j = calloc(NUM_TESTS, sizeof(job));
+    struct pollfd *fds = calloc(NUM_TESTS, sizeof(struct pollfd));
+    size_t *which = calloc(NUM_TESTS, sizeof(size_t));
+    
+    int pass = 1;
+    int serial = 0; // set once the rest of the tests are to be run one at a time
+    size_t started = 0, printed = 0, running = 0;
+    
+    if (!j || !fds || !which) { X(calloc); }
+    
+    for (size_t i = 0; i < NUM_TESTS; i++) { j[i].fd = -1; }
+    
+    while (printed < NUM_TESTS)
+    {
+        while ((running < (size_t) jobs) && (started < NUM_TESTS))
+        {
+            const test_case *t = &plan[started];
+            int v = verbose && listed(argc, argv, t->name);
+            
+            if (!start(&j[started], t->fp, v))
+            {
+                if (!started) { X(start); }
+                if (!running) { serial = 1; } // nothing to wait for
+                break; // otherwise try again when a running test finishes
+            }
+            
+            started++;
+            running++;
+        }
+        
+        // print the finished tests that come next in the plan
+        while ((printed < started) && j[printed].finished)
+        {
+            job *done = &j[printed];
+            const test_case *t = &plan[printed];
+            
+            header(t->name, t->desc, verbose && contains(argc, argv, t->name));
+            fwrite(done->out, 1, done->used, stdout);
+            fflush(stdout);
+            
+            int result = 0;
+            
+            if (WIFEXITED(done->status))
+                { result = (int) WEXITSTATUS(done->status); }
+            else
+                { W("child process terminated abnormally"); }
+            
+            pass = result && pass;
+            
+            free(done->out);
+            done->out = NULL;
+            printed++;
+        }
+        
+        // every test started so far has finished and been printed
+        if (serial)
+        {
+            W("could not start a test in parallel, running the rest one at a time");
+            
+            for (; started < NUM_TESTS; started++)
+            {
+                const test_case *t = &plan[started];
+                
+                pass = test(t->fp, t->name, t->desc,
+                    verbose && contains(argc, argv, t->name)) && pass;
+            }
+            
+            printed = started;
+            break;
+        }
+        
+        if (!running) { continue; }
+        
+        nfds_t n = 0;
+        
+        for (size_t i = printed; i < started; i++)
+        {
+            if (j[i].fd == -1) { continue; }
+            
+            fds[n].fd      = j[i].fd;
+            fds[n].events  = POLLIN;
+            fds[n].revents = 0;
+            which[n++]     = i;
+        }
+        
+        if (-1 == poll(fds, n, -1))
+        {
+            if (errno == EINTR) { continue; }
+            X3(poll, "could not wait for the output of tests", errno);
+        }
+        
+        for (nfds_t k = 0; k < n; k++)
+        {
+            if (!fds[k].revents) { continue; }
+            
+            job *r = &j[which[k]];
+            if (!collect(r)) { X(collect); }
+            if (r->finished) { running--; }
+        }
+    }
+    
+    free(which);
+    free(fds);
+    free(j);
+    
+    return pass;
+    
+    err_collect:
+    err_poll:
+    err_start:
+        for (size_t i = printed; i < started; i++)
+        {
+            if (j[i].fd != -1) { close(j[i].fd); }
+            if (!j[i].finished) { waitpid(j[i].pid, NULL, 0); }
+            free(j[i].out);
+        }
+    err_calloc:
+        free(which);
+        free(fds);
+        free(j);
+        return (started ? 0 : -1);
+}
 #endif
 
 
-int test(int (*fp)(void), const char *name, const char *desc, int verbose)
+void header(const char *name, const char *desc, int verbose)
 {
     char align[16];
     size_t i = strlen(name);
@@ -144,6 +436,12 @@ int test(int (*fp)(void), const char *name, const char *desc, int verbose)
     printf("[%s]%s Testing %s ... ", name, align, desc);
     if (verbose) { printf("VERBOSE\n"); }
     fflush(stdout);
+}
+
+
+int test(int (*fp)(void), const char *name, const char *desc, int verbose)
+{
+    header(name, desc, verbose);
     
     return (run(fp, verbose));
 }
@@ -187,44 +485,73 @@ void result(Result r)
 }
 
 
-int contains(int argc, char *argv[], const char *key)
+int listed(int argc, char *argv[], const char *key)
 {
     for (int i = 1; i < argc; i++)
     {
-        if (0 == strcmp(argv[i], key)) { printf("contains %s\n", key); return 1; }
+        if (0 == strcmp(argv[i], key)) { return 1; }
     }
     
     return 0;
 }
 
 
+int contains(int argc, char *argv[], const char *key)
+{
+    if (listed(argc, argv, key)) { printf("contains %s\n", key); return 1; }
+    
+    return 0;
+}
+
+
 int main(int argc, char *argv[])
 {
     int pass = 1;
     int mode_verbose = 0;
+    int mode_usage = 0;
+    int jobs = 1;
+    int arg = 1;
     
-    if (argc >= 2)
+    if ((argc >= 2) && (0 == strcmp(argv[1], "-j")))
     {
-        if (0 == strcmp(argv[1], "--verbose"))
-        {
-            mode_verbose = 1;
-        }
-        else
-        {
-            printf("Usage: %s [--verbose [TESTS]]\n", argv[0]);
-            return EXIT_FAILURE;
-        }
+        char *end = NULL;
+        long n = (argc >= 3) ? strtol(argv[2], &end, 10) : -1;
+        
+        if (!end || (*end != '\0') || (n < 0) || (n > 1024)) { mode_usage = 1; }
+        else if (n > 0) { jobs = (int) n; }
+        else { jobs = processors(); }
+        
+        arg = 3;
     }
     
-#   define V(a) \
-        
+    if (argc > arg)
+    {
+        if (0 == strcmp(argv[arg], "--verbose")) { mode_verbose = 1; }
+        else { mode_usage = 1; }
+    }
     
-#   define T(a, b) \
-        int a(void); \
-        pass = test(a, __STRING(a), b, \
-            mode_verbose && contains(argc, argv, __STRING(a))) && pass;
-        
-#   include "_plan.h"
+    if (mode_usage)
+    {
+        printf("Usage: %s [-j N] [--verbose [TESTS]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    int parallel_pass = (jobs > 1) ? parallel(jobs, argc, argv, mode_verbose) : -1;
+    
+    if (parallel_pass >= 0)
+    {
+        pass = parallel_pass;
+    }
+    else
+    {
+        for (size_t i = 0; i < NUM_TESTS; i++)
+        {
+            const test_case *t = &plan[i];
+            
+            pass = test(t->fp, t->name, t->desc,
+                mode_verbose && contains(argc, argv, t->name)) && pass;
+        }
+    }
     
     fflush(stdout);
     if (pass)
@@ -3,5 +3,27 @@
 #ifndef BSE_ECLIPSE // stop the IDE from choking on the X Macro technique
 
 T(test_state_machine_1, "model behaviour")
+T(test_state_machine_new_using, "single-block allocation and state lookup")
+T(test_state_machine_lazy, "lazy rule-based machine")
+T(test_state_machine_freeze, "frozen table layouts")
+T(test_state_machine_aligned, "cache-line aligned tables")
+T(test_state_machine_payload, "per-state payloads")
+T(test_state_machine_clone, "copy-on-write clones")
+T(test_state_machine_add_rules_parallel, "parallel rule expansion")
+T(test_state_machine_registry, "mixed machine registry")
+T(test_state_machine_population_query, "population state queries")
+T(test_state_machine_population_census, "population census")
+T(test_state_machine_print, "buffered DOT export")
+T(test_state_machine_trace, "binary trace record and replay")
+T(test_state_machine_save, "model save and load")
+T(test_state_machine_statechart, "hierarchical statecharts")
+T(test_state_machine_timers, "timer wheel")
+T(test_state_machine_gui_hit, "gui hit testing")
+T(test_state_machine_gui_focus, "gui focus manager")
+T(test_state_machine_gui_radio, "gui checkboxes and radio groups")
+T(test_state_machine_timing, "scoped timers")
+#ifdef BSE_ASYNC_EXCEPTIONS
+T(test_state_machine_async_exceptions, "asynchronous error output")
+#endif
 
 #endif
@@ -0,0 +1,126 @@
+// BSAG 2014 public domain
+
+// Builds and runs the header-only C++ front-ends, so that a change to the C
+// headers they include cannot break them unnoticed. Exits non-zero on failure.
+
+#include "state-machine/coroutine.hpp"
+#include "state-machine/constexpr.hpp"
+
+#include <cstdio>
+
+static int failures = 0;
+
+#define CHECK(x) \
+    if (!(x)) { std::fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #x); failures++; }
+
+
+// A lamp: OFF and ON are state flags, and BASE is set in every state
+enum { BASE = 1, ON = 2 };
+enum { TOGGLE, NUM_ACTIONS };
+
+
+// A flow that turns the lamp back off each time it comes on
+static sm::flow auto_off(sm::population &p, unsigned int element, unsigned int *count)
+{
+    for (;;)
+    {
+        unsigned int state = co_await p.until(element, ON);
+        if (!(state & ON)) { co_return; }
+        
+        (*count)++;
+        p.take_action(element, TOGGLE);
+    }
+}
+
+
+static void test_coroutine()
+{
+    sm::machine m(state_machine_new(2, NUM_ACTIONS));
+    
+    CHECK(state_machine_add_state(m.get(), BASE));
+    CHECK(state_machine_add_state(m.get(), BASE | ON));
+    CHECK(state_machine_add_transition(m.get(), TOGGLE, BASE, BASE | ON));
+    CHECK(state_machine_add_transition(m.get(), TOGGLE, BASE | ON, BASE));
+    
+    sm::population p(m.get(), 2, BASE);
+    unsigned int count = 0;
+    
+    auto_off(p, 0, &count);
+    CHECK(p.waiting(0) == 1);
+    CHECK(p.waiting(1) == 0);
+    
+    // the flow resumes after the event, and its own action applies at once
+    CHECK(p.take_action(0, TOGGLE) == (BASE | ON));
+    CHECK(count == 1);
+    CHECK(p.state(0) == BASE);
+    CHECK(p.waiting(0) == 1);
+    
+    // other elements do not wake it
+    CHECK(p.take_action(1, TOGGLE) == (BASE | ON));
+    CHECK(count == 1);
+    
+    const state_machine_event events[] = { { 0, TOGGLE }, { 1, TOGGLE }, { 0, TOGGLE } };
+    CHECK(p.dispatch(events, 3) == 3);
+    CHECK(count == 3);
+    
+    // an invalid element is never waited on, and an invalid event stops a
+    // batch there, as in the C API (which reports them)
+    bse_quiet_exceptions = 1;
+    
+    auto_off(p, p.elements(), &count);
+    CHECK(p.waiting(p.elements()) == 0);
+    
+    const state_machine_event bad[] = { { 0, TOGGLE }, { 2, TOGGLE }, { 0, TOGGLE } };
+    CHECK(p.dispatch(bad, 3) == 1);
+    CHECK(count == 4);
+    
+    const state_machine_event bad_action[] = { { 0, NUM_ACTIONS }, { 0, TOGGLE } };
+    CHECK(p.dispatch(bad_action, 2) == 0);
+    CHECK(count == 4);
+    
+    bse_quiet_exceptions = 0;
+}
+
+
+// The same lamp, known at compile time
+static constexpr std::array<unsigned int, 2> lamp_states = {{ BASE, BASE | ON }};
+static constexpr std::array<state_machine_rule, 2> lamp_rules =
+{{
+    STATE_MACHINE_RULE_TRANSITION(TOGGLE, BASE, BASE | ON),
+    STATE_MACHINE_RULE_REPLACING(TOGGLE, ON, 0, BASE | ON),
+}};
+
+using lamp = sm::fixed_machine<NUM_ACTIONS, lamp_states, lamp_rules, BASE>;
+
+static_assert(lamp::states == 2, "two states");
+static_assert(lamp::take_action_id(BASE, TOGGLE) == (BASE | ON), "toggles on");
+static_assert(lamp::take_action_id(BASE | ON, TOGGLE) == BASE, "toggles off");
+static_assert(lamp::take_action(lamp::initial, TOGGLE) == lamp::index(BASE | ON), "by index");
+static_assert(lamp::take_action_id(BASE, NUM_ACTIONS) == 0, "action out of range");
+
+
+static void test_constexpr()
+{
+    state_machine *m = lamp::make();
+    CHECK(m);
+    if (!m) { return; }
+    
+    // a regular machine with the same state indexes and transitions
+    for (unsigned int i = 0; i < lamp::states; i++)
+    {
+        CHECK(state_machine_state_id(m, i) == lamp::id(i));
+        CHECK(state_machine_take_action_index(m, i, TOGGLE) == lamp::take_action(i, TOGGLE));
+    }
+    
+    state_machine_free(m);
+}
+
+
+int main()
+{
+    test_coroutine();
+    test_constexpr();
+    
+    std::printf("%s\n", failures ? "OVERALL FAIL." : "OVERALL SUCCESS.");
+    return failures ? 1 : 0;
+}
@@ -1,8 +1,18 @@
 // BSAG 2014 public domain
 
+#define BSE_EXPOSE_MEMORY_MANAGER
 #include "test/_test.h"
 #include "state-machine/state-machine.h"
+#include "state-machine/lazy.h"
+#include "state-machine/registry.h"
+#include "state-machine/trace.h"
+#include "state-machine/statechart.h"
+#include "state-machine/timers.h"
+#include "state-machine/models/gui.h"
 #include <assert.h>
+#include <string.h> // memcpy, memcmp, strstr
+#include <stdlib.h> // free
+#include <stdint.h> // uintptr_t
 
 
 
@@ -18,3 +28,1618 @@ int test_state_machine_1(void)
 }
 
 
+// counts the allocations made through a bse_simple_memory_manager
+typedef struct test_memory_count
+{
+    size_t used; // bytes allocated and not yet freed
+    unsigned int allocations;
+    unsigned int deallocations;
+} test_memory_count;
+
+
+static void *test_count_allocate(size_t size, void *arg)
+{
+    test_memory_count *count = arg;
+    
+    count->used += size;
+    count->allocations++;
+    
+    return bse_default_malloc(size, NULL);
+}
+
+
+static void test_count_deallocate(void *ptr, size_t size, void *arg)
+{
+    test_memory_count *count = arg;
+    
+    count->used -= size;
+    count->deallocations++;
+    
+    bse_default_free(ptr, size, NULL);
+}
+
+
+int test_state_machine_new_using(void)
+{
+    START;
+    
+    test_memory_count count = { 0, 0, 0 };
+    bse_simple_memory_manager mgr = { test_count_allocate, test_count_deallocate, &count };
+    
+    state_machine *m = state_machine_new_using(8, 3, &mgr);
+    TEST_FATAL(m);
+    TEST(count.allocations == 1);
+    TEST(count.used == state_machine_memory(m));
+    
+    // added out of order, states are indexed in the order they were added
+    const unsigned int ids[] = { 40, 7, 1023, 1, 99, 8 };
+    const unsigned int added = sizeof(ids) / sizeof(ids[0]);
+    
+    for (unsigned int i = 0; i < added; i++)
+    {
+        TEST(state_machine_add_state(m, ids[i]));
+    }
+    
+    for (unsigned int i = 0; i < added; i++)
+    {
+        TEST(state_machine_state_index(m, ids[i]) == i);
+        TEST(state_machine_state_id(m, i) == ids[i]);
+        TEST(state_machine_state_id(m, state_machine_state_index(m, ids[i])) == ids[i]);
+    }
+    
+    // empty slots and unknown IDs
+    TEST(state_machine_state_id(m, added) == 0);
+    TEST(state_machine_state_id(m, 7) == 0);
+    TEST(state_machine_state_index(m, 0) == STATE_MACHINE_INVALID);
+    TEST(state_machine_state_index(m, 2) == STATE_MACHINE_INVALID);
+    TEST(state_machine_state_index(m, 100000) == STATE_MACHINE_INVALID);
+    
+    // lookups by ID find the right rows
+    TEST(state_machine_add_transition(m, 2, 1023, 1));
+    TEST(state_machine_add_transition(m, 0, 1, 40));
+    TEST(state_machine_take_action(m, 1023, 2) == 1);
+    TEST(state_machine_take_action(m, 1, 0) == 40);
+    TEST(state_machine_take_action_index(m, 2, 2) == 3);
+    
+    // the states, index and table all live in the one allocation
+    TEST(count.allocations == 1);
+    TEST(count.deallocations == 0);
+    
+    state_machine_free(m);
+    TEST(count.allocations == 1);
+    TEST(count.deallocations == 1);
+    TEST(count.used == 0);
+    
+#   if SIZE_MAX <= UINT_MAX
+        // states * stride fits in an unsigned int, but not the whole block
+        TEST(!state_machine_new_using(1u << 28, 7, &mgr));
+        TEST(!state_machine_new_aligned(1u << 26, 1, NULL));
+        TEST(count.allocations == 1);
+#   endif
+    
+    END;
+}
+
+
+static int test_lazy_valid(unsigned int state, void *arg)
+{
+    UNUSED(arg);
+    return (state < 64);
+}
+
+
+int test_state_machine_lazy(void)
+{
+    START;
+    
+    state_machine_rule rules[] =
+    {
+        STATE_MACHINE_RULE_TRANSITION(0, 1, 2),
+        STATE_MACHINE_RULE_FROM_ALL_STATES(1, 1, 4),
+        STATE_MACHINE_RULE_REPLACING(0, 3, 8, 2),
+        STATE_MACHINE_RULE_REPLACING(2, 0, 32, 0),
+        STATE_MACHINE_RULE_REPLACING(2, 48, 16, 32),
+        { 1, 12, 8, 8, 16 }
+    };
+    
+    unsigned int num_rules = sizeof(rules) / sizeof(rules[0]);
+    
+    // eager machine over every state in the flag space
+    state_machine *m = state_machine_new(63, 3);
+    TEST_FATAL(m);
+    
+    for (unsigned int i = 1; i < 64; i++)
+        { TEST_FATAL(state_machine_add_state(m, i)); }
+    
+    TEST_FATAL(state_machine_add_rules(m, rules, num_rules));
+    
+    state_machine_lazy *l = state_machine_lazy_new(3, rules, num_rules, 16);
+    TEST_FATAL(l);
+    state_machine_lazy_set_validator(l, test_lazy_valid, NULL);
+    
+    int same = 1;
+    for (unsigned int pass = 0; pass < 2; pass++)
+    {
+        for (unsigned int i = 1; i < 64; i++)
+        {
+            for (unsigned int a = 0; a < 3; a++)
+            {
+                if (state_machine_take_action(m, i, a)
+                    != state_machine_lazy_take_action(l, i, a)) { same = 0; }
+            }
+        }
+    }
+    TEST(same);
+    
+    // only the states reachable from the initial state are materialized
+    unsigned int initial = 1;
+    state_machine *r = state_machine_lazy_materialize(l, &initial, 1, 63);
+    TEST_FATAL(r);
+    
+    TEST(state_machine_state_index(r, 1) != STATE_MACHINE_INVALID);
+    TEST(state_machine_state_index(r, 2) != STATE_MACHINE_INVALID);
+    TEST(state_machine_state_index(r, 3) == STATE_MACHINE_INVALID);
+    TEST(state_machine_take_action(r, 1, 0) == 2);
+    TEST(state_machine_take_action(r, 2, 0) == 8);
+    
+    TEST(!state_machine_lazy_materialize(l, &initial, 1, 2));
+    TEST(!state_machine_lazy_materialize(l, &initial, 1, UINT_MAX));
+    TEST(!state_machine_lazy_materialize(l, &initial, 1, (UINT_MAX / 4) + 2));
+    
+    state_machine_free(r);
+    state_machine_lazy_free(l);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+// every transition of b is the same as in a
+static int test_same_transitions(state_machine *a, state_machine *b)
+{
+    unsigned int states  = state_machine_states(a);
+    unsigned int actions = state_machine_actions(a);
+    
+    if (states  != state_machine_states(b))  { return 0; }
+    if (actions != state_machine_actions(b)) { return 0; }
+    
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int id = state_machine_state_id(a, i);
+        if (id != state_machine_state_id(b, i)) { return 0; }
+        if (!id) { continue; }
+        
+        if (state_machine_state_index(b, id) != state_machine_state_index(a, id))
+            { return 0; }
+        
+        for (unsigned int j = 0; j < actions; j++)
+        {
+            if (state_machine_take_action_index(a, i, j)
+                != state_machine_take_action_index(b, i, j)) { return 0; }
+            if (state_machine_take_action(a, id, j)
+                != state_machine_take_action(b, id, j)) { return 0; }
+        }
+    }
+    
+    return 1;
+}
+
+
+int test_state_machine_freeze(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    TEST_FATAL(m);
+    
+    state_machine *dense = state_machine_freeze(m, STATE_MACHINE_LAYOUT_DENSE);
+    state_machine *sparse = state_machine_freeze(m, STATE_MACHINE_LAYOUT_SPARSE);
+    state_machine *rows = state_machine_freeze(m, STATE_MACHINE_LAYOUT_ROWS);
+    state_machine *defaults = state_machine_freeze(m, STATE_MACHINE_LAYOUT_DEFAULTS);
+    state_machine *automatic = state_machine_freeze(m, STATE_MACHINE_LAYOUT_AUTO);
+    
+    TEST_FATAL(dense && sparse && rows && defaults && automatic);
+    
+    TEST(state_machine_layout(m) == STATE_MACHINE_LAYOUT_DENSE);
+    TEST(state_machine_layout(dense) == STATE_MACHINE_LAYOUT_DENSE);
+    TEST(state_machine_layout(sparse) == STATE_MACHINE_LAYOUT_SPARSE);
+    TEST(state_machine_layout(rows) == STATE_MACHINE_LAYOUT_ROWS);
+    TEST(state_machine_layout(defaults) == STATE_MACHINE_LAYOUT_DEFAULTS);
+    
+    TEST(test_same_transitions(m, dense));
+    TEST(test_same_transitions(m, sparse));
+    TEST(test_same_transitions(m, rows));
+    TEST(test_same_transitions(m, defaults));
+    TEST(test_same_transitions(m, automatic));
+    
+    // the button model has unused and repeated states, so shares rows
+    TEST(state_machine_memory(rows) < state_machine_memory(dense));
+    
+    // no state of the button model accepts input or scroll actions, so they
+    // share an action class
+    TEST(state_machine_action_classes(m) == NUM_ACTIONS_GUI);
+    TEST(state_machine_action_classes(dense) < NUM_ACTIONS_GUI);
+    TEST(state_machine_action_class(dense, ACTION_GUI_INPUT)
+        == state_machine_action_class(dense, ACTION_GUI_SCROLL));
+    TEST(state_machine_action_class(dense, ACTION_GUI_MOUSE_DOWN)
+        != state_machine_action_class(dense, ACTION_GUI_MOUSE_UP));
+    
+    // frozen machines are read-only
+    TEST(!state_machine_add_state(sparse, 4096));
+    TEST(!state_machine_add_transition(dense, ACTION_GUI_ENABLE,
+        STATE_GUI_BUTTON_DEFAULT, STATE_GUI_BUTTON_DEFAULT));
+    TEST(!state_machine_clear(sparse));
+    
+    // a frozen machine can itself be frozen into another layout
+    state_machine *again = state_machine_freeze(sparse, STATE_MACHINE_LAYOUT_DENSE);
+    TEST_FATAL(again);
+    TEST(test_same_transitions(m, again));
+    
+    // an aligned machine keeps its alignment when frozen
+    state_machine *aligned = state_machine_new_aligned(3, 20, NULL);
+    TEST_FATAL(aligned);
+    TEST(state_machine_add_state(aligned, 1));
+    TEST(state_machine_add_state(aligned, 2));
+    TEST(state_machine_add_transition(aligned, 19, 1, 2));
+    TEST(state_machine_add_transition(aligned, 0, 2, 1));
+    
+    state_machine *aligned_sparse = state_machine_freeze(aligned, STATE_MACHINE_LAYOUT_SPARSE);
+    TEST_FATAL(aligned_sparse);
+    TEST(test_same_transitions(aligned, aligned_sparse));
+    
+    state_machine_free(aligned_sparse);
+    state_machine_free(aligned);
+    state_machine_free(again);
+    state_machine_free(automatic);
+    state_machine_free(defaults);
+    state_machine_free(rows);
+    state_machine_free(sparse);
+    state_machine_free(dense);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+// records the allocation of an aligned machine, checking it is freed as made
+typedef struct test_aligned_count
+{
+    void *block;
+    size_t size;
+    size_t alignment;
+    unsigned int allocations;
+    unsigned int deallocations;
+} test_aligned_count;
+
+
+static void *test_aligned_allocate(size_t size, size_t alignment, void *arg)
+{
+    test_aligned_count *count = arg;
+    
+    count->block     = bse_default_aligned_malloc(size, alignment, NULL);
+    count->size      = size;
+    count->alignment = alignment;
+    count->allocations++;
+    
+    return count->block;
+}
+
+
+static void test_aligned_deallocate(void *ptr, size_t size, size_t alignment, void *arg)
+{
+    test_aligned_count *count = arg;
+    
+    if ((ptr == count->block) && (size == count->size) && (alignment == count->alignment))
+        { count->deallocations++; }
+    
+    bse_default_aligned_free(ptr, size, alignment, NULL);
+}
+
+
+int test_state_machine_aligned(void)
+{
+    START;
+    
+    const unsigned int line = STATE_MACHINE_CACHE_LINE / sizeof(unsigned int);
+    const unsigned int states = 5;
+    
+    // with one action, a row and its payload fit in a single cache line
+    state_machine *narrow = state_machine_new_aligned(states, 1, NULL);
+    TEST_FATAL(narrow);
+    size_t narrow_size = state_machine_memory(narrow);
+    state_machine_free(narrow);
+    
+    for (unsigned int actions = 1; actions <= 3 * line; actions++)
+    {
+        test_aligned_count count = { NULL, 0, 0, 0, 0 };
+        bse_aligned_memory_manager mgr = { test_aligned_allocate, test_aligned_deallocate, &count };
+        
+        state_machine *m = state_machine_new_aligned(states, actions, &mgr);
+        TEST_FATAL(m);
+        
+        // a single block on a cache line, which the table ends: it starts on
+        // a cache line too if the block is a whole number of them
+        TEST(count.allocations == 1);
+        TEST(count.alignment == STATE_MACHINE_CACHE_LINE);
+        TEST(((uintptr_t) count.block % STATE_MACHINE_CACHE_LINE) == 0);
+        TEST(count.size == state_machine_memory(m));
+        TEST((count.size % STATE_MACHINE_CACHE_LINE) == 0);
+        
+        // each row holds the actions and the payload, padded to whole lines
+        size_t lines = (actions + line) / line;
+        TEST(count.size == narrow_size + (states * (lines - 1) * STATE_MACHINE_CACHE_LINE));
+        
+        // the last action and the payload do not overlap
+        TEST(state_machine_add_state(m, 1));
+        TEST(state_machine_add_state(m, 2));
+        TEST(state_machine_add_transition(m, actions - 1, 1, 2));
+        TEST(state_machine_set_payload(m, 1, 77));
+        TEST(state_machine_take_action(m, 1, actions - 1) == 2);
+        TEST(state_machine_payload(m, 1) == 77);
+        
+        state_machine_free(m);
+        TEST(count.deallocations == 1);
+    }
+    
+    END;
+}
+
+
+// appends output to a fixed buffer, failing when it is full
+typedef struct test_print_buffer
+{
+    char data[512];
+    size_t used;
+} test_print_buffer;
+
+
+static int test_print_write(const char *data, size_t size, void *arg)
+{
+    test_print_buffer *b = arg;
+    if (size >= sizeof(b->data) - b->used) { return 0; }
+    
+    memcpy(b->data + b->used, data, size);
+    b->used += size;
+    b->data[b->used] = '\0';
+    
+    return 1;
+}
+
+
+int test_state_machine_print(void)
+{
+    START;
+    
+    test_memory_count count = { 0, 0, 0 };
+    bse_simple_memory_manager mgr = { test_count_allocate, test_count_deallocate, &count };
+    
+    state_machine *m = state_machine_new_using(3, 3, &mgr);
+    TEST_FATAL(m);
+    TEST(state_machine_add_state(m, 1));
+    TEST(state_machine_add_state(m, 2));
+    TEST(state_machine_add_state(m, 6));
+    TEST(state_machine_add_transition(m, 0, 1, 2));
+    TEST(state_machine_add_transition(m, 2, 1, 2));
+    TEST(state_machine_add_transition(m, 1, 2, 6));
+    
+    const char *states[] = { "one", "t\"wo", NULL };
+    const char *actions[] = { "a", "\\\"b\"", "c\\" };
+    const state_machine_cluster clusters[] = { { 4, "big" }, { 2, "even" } };
+    
+    test_print_buffer b;
+    b.used = 0;
+    
+    TEST_FATAL(state_machine_print_using(test_print_write, &b, m, "g", states, actions, clusters, 2));
+    
+    // parallel edges are merged, names and labels are escaped, and each
+    // state is in the first cluster that it matches
+    TEST(strstr(b.data, "\"one\" -> \"t\\\"wo\" [ label=\"a, c\\\\\" ]\n"));
+    TEST(strstr(b.data, "\"t\\\"wo\" -> \"2\" [ label=\"\\\\\\\"b\\\"\" ]\n"));
+    TEST(strstr(b.data, "label=\"big\"\n        \"2\"\n    }"));
+    TEST(strstr(b.data, "label=\"even\"\n        \"t\\\"wo\"\n    }"));
+    
+    // a failing write function is reported
+    b.used = sizeof(b.data) - 1;
+    TEST(!state_machine_print_using(test_print_write, &b, m, "g", states, actions, NULL, 0));
+    
+    // working memory comes from the machine's memory manager, and is freed
+    TEST(count.allocations == 5);
+    TEST(count.deallocations == 4);
+    TEST(count.used == state_machine_memory(m));
+    
+    state_machine_free(m);
+    TEST(count.used == 0);
+    
+    END;
+}
+
+
+typedef struct test_trace_buffer
+{
+    unsigned char data[4096];
+    size_t used;
+} test_trace_buffer;
+
+
+static int test_trace_write(const char *data, size_t size, void *arg)
+{
+    test_trace_buffer *b = arg;
+    if (size > sizeof(b->data) - b->used) { return 0; }
+    
+    memcpy(b->data + b->used, data, size);
+    b->used += size;
+    
+    return 1;
+}
+
+
+static void test_trace_divergence
+    (size_t event, unsigned int element, unsigned int action,
+     unsigned int recorded, unsigned int replayed, void *arg)
+{
+    UNUSED(recorded); UNUSED(replayed);
+    
+    // counts divergences, and those reported for a different event than the
+    // trace test recorded at that position
+    unsigned int *reported = arg;
+    reported[0]++;
+    
+    if ((element != (event * 7) % 20) || (action != (event % 5 ? 0u : 1u)))
+        { reported[1]++; }
+}
+
+
+int test_state_machine_trace(void)
+{
+    START;
+    
+    // a counter modulo 3, and a version where the last step wraps to 2
+    state_machine *m = state_machine_new(3, 2);
+    state_machine *changed = state_machine_new(3, 2);
+    TEST_FATAL(m && changed);
+    
+    for (unsigned int i = 1; i <= 3; i++)
+    {
+        TEST(state_machine_add_state(m, i));
+        TEST(state_machine_add_state(changed, i));
+    }
+    
+    TEST(state_machine_add_transition(m, 0, 1, 2));
+    TEST(state_machine_add_transition(m, 0, 2, 3));
+    TEST(state_machine_add_transition(m, 0, 3, 1));
+    TEST(state_machine_add_transition(changed, 0, 1, 2));
+    TEST(state_machine_add_transition(changed, 0, 2, 3));
+    TEST(state_machine_add_transition(changed, 0, 3, 2));
+    
+    state_machine_event events[300];
+    for (unsigned int i = 0; i < 300; i++)
+    {
+        events[i].element = (i * 7) % 20;
+        events[i].action  = i % 5 ? 0 : 1; // action 1 has no transitions
+    }
+    
+    test_trace_buffer b;
+    b.used = 0;
+    
+    state_machine_population *recorded = state_machine_population_new(m, 20, 1);
+    state_machine_trace *t = state_machine_trace_new(test_trace_write, &b);
+    TEST_FATAL(recorded && t);
+    
+    TEST(state_machine_trace_dispatch(t, recorded, events, 300) == 240);
+    TEST(state_machine_trace_flush(t));
+    TEST(b.used < 8 + (300 * 4));
+    
+    // the same model never diverges
+    state_machine_population *same = state_machine_population_new(m, 20, 1);
+    size_t divergences = 1;
+    TEST_FATAL(same);
+    TEST(state_machine_trace_replay(b.data, b.used, same, NULL, NULL, &divergences));
+    TEST(divergences == 0);
+    
+    for (unsigned int i = 0; i < 20; i++)
+        { TEST(state_machine_population_state(same, i) == state_machine_population_state(recorded, i)); }
+    
+    // every element steps past 3, where the changed model differs
+    state_machine_population *other = state_machine_population_new(changed, 20, 1);
+    unsigned int reported[2] = { 0, 0 };
+    TEST_FATAL(other);
+    TEST(state_machine_trace_replay(b.data, b.used, other, test_trace_divergence, reported, &divergences));
+    TEST(divergences == reported[0]);
+    TEST(reported[1] == 0);
+    TEST(divergences >= 20);
+    
+    // as many as replaying one event at a time, resynchronising each time
+    unsigned int model[20], replay[20];
+    size_t expected = 0;
+    
+    for (unsigned int i = 0; i < 20; i++) { model[i] = replay[i] = 1; }
+    
+    for (unsigned int i = 0; i < 300; i++)
+    {
+        unsigned int e = events[i].element;
+        unsigned int a = events[i].action;
+        unsigned int rec = state_machine_take_action(m, model[e], a);
+        unsigned int rep = state_machine_take_action(changed, replay[e], a);
+        
+        model[e]  = rec ? rec : model[e];
+        replay[e] = rep ? rep : replay[e];
+        
+        if (model[e] != replay[e]) { expected++; replay[e] = model[e]; }
+    }
+    
+    TEST(divergences == expected);
+    
+    // a truncated trace is rejected
+    TEST(!state_machine_trace_replay(b.data, b.used - 1, same, NULL, NULL, NULL));
+    TEST(!state_machine_trace_replay(b.data, 4, same, NULL, NULL, NULL));
+    
+    // as is a varint over 32 bits, here an action of 1 << 32
+    const unsigned char wide[] = { 'S', 'M', 'T', 'R', 'A', 'C', 'E', 1,
+                                   0x00, 0x80, 0x80, 0x80, 0x80, 0x10, 0x01 };
+    TEST(!state_machine_trace_replay(wide, sizeof(wide), same, NULL, NULL, NULL));
+    
+    state_machine_population_free(other);
+    state_machine_population_free(same);
+    state_machine_trace_free(t);
+    state_machine_population_free(recorded);
+    state_machine_free(changed);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_save(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    TEST_FATAL(m);
+    
+    test_trace_buffer b;
+    b.used = 0;
+    
+    TEST_FATAL(state_machine_save(test_trace_write, &b, m));
+    
+    state_machine *loaded = state_machine_load(b.data, b.used);
+    TEST_FATAL(loaded);
+    TEST(test_same_transitions(m, loaded));
+    
+    // a frozen machine saves the same transitions
+    state_machine *frozen = state_machine_freeze(m, STATE_MACHINE_LAYOUT_SPARSE);
+    test_trace_buffer c;
+    c.used = 0;
+    
+    TEST_FATAL(frozen);
+    TEST(state_machine_save(test_trace_write, &c, frozen));
+    TEST((c.used == b.used) && !memcmp(c.data, b.data, b.used));
+    
+    // truncated or corrupt data is rejected
+    TEST(!state_machine_load(b.data, b.used - 1));
+    b.data[0] = 'X';
+    TEST(!state_machine_load(b.data, b.used));
+    
+    state_machine_free(frozen);
+    state_machine_free(loaded);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_statechart(void)
+{
+    START;
+    
+    enum { POWER, UP, DOWN, STEP, RESET, NUM_ACTIONS };
+    enum { OFF = 1, ON = 2, LOW = 4, HIGH = 8, BOTH = 16, L1 = 32, L2 = 64, R1 = 128, R2 = 256, LEFT = 512, RIGHT = 1024 };
+    
+    // a dimmer that remembers its level, and a state with two regions
+    const state_machine_statechart_state states[] =
+    {
+        { OFF,   0,      STATE_MACHINE_STATECHART_EXCLUSIVE },
+        { ON,    0,      STATE_MACHINE_STATECHART_HISTORY },
+        { LOW,   ON,     0 },
+        { HIGH,  ON,     0 },
+        { BOTH,  0,      STATE_MACHINE_STATECHART_PARALLEL },
+        { LEFT,  BOTH,   0 },
+        { L1,    LEFT,   0 },
+        { L2,    LEFT,   0 },
+        { RIGHT, BOTH,   0 },
+        { R1,    RIGHT,  0 },
+        { R2,    RIGHT,  0 },
+    };
+    
+    const state_machine_statechart_transition transitions[] =
+    {
+        { POWER, OFF,  ON },
+        { POWER, ON,   OFF },
+        { UP,    LOW,  HIGH },
+        { DOWN,  HIGH, LOW },
+        { STEP,  ON,   R2 },
+        { STEP,  L1,   L2 },
+        { STEP,  R1,   R2 },
+        { RESET, L2,   L1 },
+        { RESET, R2,   R1 },
+        { RESET, BOTH, OFF },
+    };
+    
+    unsigned int initial = 0;
+    state_machine *m = state_machine_statechart_compile(states, 11, transitions, 10, NUM_ACTIONS, 64, &initial);
+    TEST_FATAL(m);
+    TEST(initial == OFF);
+    
+    // entry defaults to the first child, and history resumes the last one
+    TEST(state_machine_take_action(m, OFF, POWER) == (ON | LOW));
+    TEST(state_machine_take_action(m, ON | LOW, UP) == (ON | HIGH));
+    TEST(state_machine_take_action(m, ON | HIGH, POWER) == (OFF | HIGH));
+    TEST(state_machine_take_action(m, OFF | HIGH, POWER) == (ON | HIGH));
+    
+    // entering one region of a parallel state enters the others by default;
+    // HIGH is still remembered by the history of ON
+    unsigned int both = BOTH | LEFT | RIGHT | HIGH;
+    TEST(state_machine_take_action(m, ON | HIGH, STEP) == (both | L1 | R2));
+    
+    // both regions take an action, and an inner transition beats an outer one
+    TEST(state_machine_take_action(m, both | L1 | R2, STEP) == (both | L2 | R2));
+    TEST(state_machine_take_action(m, both | L2 | R2, RESET) == (both | L1 | R1));
+    TEST(state_machine_take_action(m, both | L1 | R1, STEP) == (both | L2 | R2));
+    
+    // an inner transition beats a conflicting outer one, wherever it is
+    TEST(state_machine_take_action(m, both | L1 | R2, RESET) == (both | L1 | R1));
+    
+    // and the outer one applies when no inner state handles the action
+    TEST(state_machine_take_action(m, both | L1 | R1, RESET) == (OFF | HIGH));
+    TEST(state_machine_take_action(m, OFF, UP) == 0);
+    
+    // flags must not share bits
+    state_machine_statechart_state bad[] = { { 3, 0, 0 }, { 1, 0, 0 } };
+    TEST(!state_machine_statechart_compile(bad, 2, NULL, 0, 1, 8, NULL));
+    
+    // nor may max_states overflow the set of seen states
+    TEST(!state_machine_statechart_compile(states, 11, transitions, 10, NUM_ACTIONS, UINT_MAX, NULL));
+    
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_timers(void)
+{
+    START;
+    
+    // a tooltip shown after hovering for 500 ticks
+    enum { IDLE = 1, HOVER = 2, TIP = 4 };
+    enum { ENTER, LEAVE, SHOW, NUM_ACTIONS };
+    
+    state_machine *m = state_machine_new(3, NUM_ACTIONS);
+    TEST_FATAL(m);
+    TEST(state_machine_add_state(m, IDLE));
+    TEST(state_machine_add_state(m, HOVER));
+    TEST(state_machine_add_state(m, TIP));
+    TEST(state_machine_add_transition(m, ENTER, IDLE, HOVER));
+    TEST(state_machine_add_transition(m, LEAVE, HOVER, IDLE));
+    TEST(state_machine_add_transition(m, LEAVE, TIP, IDLE));
+    TEST(state_machine_add_transition(m, SHOW, HOVER, TIP));
+    
+    state_machine_population *p = state_machine_population_new(m, 3, IDLE);
+    state_machine_timers *w = state_machine_timers_new(p, 1000);
+    TEST_FATAL(p && w);
+    
+    TEST(state_machine_timers_set_timeout(w, HOVER, SHOW, 500));
+    
+    state_machine_event enter[] = { { 0, ENTER }, { 1, ENTER } };
+    TEST(state_machine_timers_dispatch(w, enter, 2) == 2);
+    
+    // leaving the state cancels its timeout
+    TEST(state_machine_timers_tick(w, 1300) == 0);
+    TEST(state_machine_timers_take_action(w, 1, LEAVE) == IDLE);
+    
+    TEST(state_machine_timers_tick(w, 1499) == 0);
+    TEST(state_machine_population_state(p, 0) == HOVER);
+    TEST(state_machine_timers_tick(w, 1500) == 1);
+    TEST(state_machine_population_state(p, 0) == TIP);
+    TEST(state_machine_population_state(p, 1) == IDLE);
+    
+    // timers armed directly, one of them much later than the wheel's range
+    TEST(state_machine_timers_arm(w, 0, LEAVE, 100000000));
+    TEST(state_machine_timers_arm(w, 2, ENTER, 70));
+    TEST(state_machine_timers_arm(w, 1, ENTER, 70));
+    TEST(state_machine_timers_cancel(w, 1));
+    
+    TEST(state_machine_timers_tick(w, 1570) == 1);
+    TEST(state_machine_population_state(p, 1) == IDLE);
+    TEST(state_machine_population_state(p, 2) == HOVER);
+    
+    TEST(state_machine_timers_tick(w, 100000000) == 1); // element 2 shows its tip
+    TEST(state_machine_population_state(p, 0) == TIP);
+    TEST(state_machine_timers_tick(w, 100001500) == 1);
+    TEST(state_machine_population_state(p, 0) == IDLE);
+    
+    state_machine_timers_free(w);
+    state_machine_population_free(p);
+    
+    // against a list of expiries, over idle stretches of every size
+    p = state_machine_population_new(m, 64, TIP);
+    w = state_machine_timers_new(p, 0);
+    TEST_FATAL(p && w);
+    
+    unsigned long long expiry[64] = {0}; // 0 for none
+    unsigned long long now = 0;
+    unsigned int seed = 3, same = 1;
+    
+    for (unsigned int round = 0; round < 2000; round++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        unsigned int element = (seed >> 8) % 64;
+        unsigned long long delay = 1 + (((unsigned long long) seed >> 4) % (1ull << ((seed >> 16) % 30)));
+        
+        TEST(state_machine_timers_arm(w, element, LEAVE, delay));
+        expiry[element] = now + delay;
+        
+        seed = seed * 1103515245u + 12345u;
+        now += ((unsigned long long) seed >> 8) % (1ull << ((seed >> 20) % 26));
+        
+        size_t due = 0;
+        for (unsigned int e = 0; e < 64; e++)
+            { if (expiry[e] && (expiry[e] <= now)) { due++; expiry[e] = 0; } }
+        
+        same &= (state_machine_timers_tick(w, now) == due);
+    }
+    
+    TEST(same);
+    
+    state_machine_timers_free(w);
+    state_machine_population_free(p);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_gui_hit(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    state_machine_population *p = state_machine_population_new(m, 3, STATE_GUI_BUTTON_DEFAULT);
+    state_machine_gui_hit *h = state_machine_gui_hit_new(3, 640, 480, 64);
+    TEST_FATAL(m && p && h);
+    
+    // two overlapping buttons, and one partly off screen
+    TEST(state_machine_gui_hit_set_rect(h, 0, 10, 10, 100, 20));
+    TEST(state_machine_gui_hit_set_rect(h, 1, 100, 10, 100, 20));
+    TEST(state_machine_gui_hit_set_rect(h, 2, -50, 400, 100, 200));
+    
+    size_t n;
+    const state_machine_event *events = state_machine_gui_hit_move(h, 105, 15, &n);
+    TEST_FATAL(events && (n == 2));
+    TEST((events[0].element == 0) && (events[0].action == ACTION_GUI_MOUSE_ENTER));
+    TEST((events[1].element == 1) && (events[1].action == ACTION_GUI_MOUSE_ENTER));
+    TEST(state_machine_population_dispatch(p, events, n) == 2);
+    TEST(state_machine_population_state(p, 1) & STATE_GUI_HOVERED);
+    
+    // moving within both elements changes nothing
+    events = state_machine_gui_hit_move(h, 108, 20, &n);
+    TEST(n == 0);
+    
+    // only the deltas: leave 0, stay in 1
+    events = state_machine_gui_hit_move(h, 150, 20, &n);
+    TEST_FATAL(events && (n == 1));
+    TEST((events[0].element == 0) && (events[0].action == ACTION_GUI_MOUSE_LEAVE));
+    TEST(state_machine_population_dispatch(p, events, n) == 1);
+    TEST(state_machine_population_state(p, 0) & STATE_GUI_NOT_HOVERED);
+    
+    // leave 1, enter 2, in that order
+    events = state_machine_gui_hit_move(h, 0, 479, &n);
+    TEST_FATAL(events && (n == 2));
+    TEST((events[0].element == 1) && (events[0].action == ACTION_GUI_MOUSE_LEAVE));
+    TEST((events[1].element == 2) && (events[1].action == ACTION_GUI_MOUSE_ENTER));
+    
+    // off screen, nothing is hit; a removed rectangle is left on the next move
+    TEST(state_machine_gui_hit_set_rect(h, 2, 0, 0, 0, 0));
+    events = state_machine_gui_hit_move(h, 0, 479, &n);
+    TEST_FATAL(events && (n == 1));
+    TEST((events[0].element == 2) && (events[0].action == ACTION_GUI_MOUSE_LEAVE));
+    events = state_machine_gui_hit_move(h, -1, 5000, &n);
+    TEST(n == 0);
+    
+    state_machine_gui_hit_free(h);
+    state_machine_population_free(p);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_gui_focus(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    state_machine_population *p = state_machine_population_new(m, 200, STATE_GUI_BUTTON_DEFAULT);
+    TEST_FATAL(m && p);
+    
+    // only every tenth element is enabled
+    for (unsigned int i = 0; i < 200; i++)
+        { if (i % 10) { TEST(state_machine_population_take_action(p, i, ACTION_GUI_DISABLE)); } }
+    
+    state_machine_gui_focus *f = state_machine_gui_focus_new(p);
+    TEST_FATAL(f);
+    TEST(state_machine_gui_focus_holder(f) == STATE_MACHINE_INVALID);
+    
+    TEST(state_machine_gui_focus_next(f));
+    TEST(state_machine_gui_focus_holder(f) == 0);
+    TEST(state_machine_gui_focus_next(f));
+    TEST(state_machine_gui_focus_holder(f) == 10);
+    TEST(state_machine_population_state(p, 10) & STATE_GUI_FOCUSED);
+    TEST(state_machine_population_state(p, 0) & STATE_GUI_UNFOCUSED);
+    
+    // enabling an element puts it in tab order
+    TEST(state_machine_gui_focus_take_action(f, 15, ACTION_GUI_ENABLE));
+    TEST(state_machine_gui_focus_next(f));
+    TEST(state_machine_gui_focus_holder(f) == 15);
+    TEST(state_machine_gui_focus_prev(f));
+    TEST(state_machine_gui_focus_prev(f));
+    TEST(state_machine_gui_focus_prev(f));
+    TEST(state_machine_gui_focus_holder(f) == 190);
+    TEST(!state_machine_gui_focus_set(f, 3)); // disabled
+    
+    // focus taken by a mouse down unfocuses the holder
+    TEST(state_machine_gui_focus_take_action(f, 20, ACTION_GUI_MOUSE_ENTER));
+    TEST(state_machine_gui_focus_take_action(f, 20, ACTION_GUI_MOUSE_DOWN));
+    TEST(state_machine_gui_focus_holder(f) == 20);
+    TEST(state_machine_population_state(p, 190) & STATE_GUI_UNFOCUSED);
+    
+    // disabling the holder passes focus on
+    TEST(state_machine_gui_focus_take_action(f, 20, ACTION_GUI_DISABLE));
+    TEST(state_machine_gui_focus_holder(f) == 30);
+    TEST(state_machine_population_state(p, 30) & STATE_GUI_FOCUSED);
+    
+    unsigned int focused = 0;
+    for (unsigned int i = 0; i < 200; i++)
+        { focused += ((state_machine_population_state(p, i) & STATE_GUI_FOCUSED) != 0); }
+    TEST(focused == 1);
+    
+    state_machine_gui_focus_free(f);
+    state_machine_population_free(p);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_gui_radio(void)
+{
+    START;
+    
+    #define CHECKED(e) ((state_machine_population_state(p, (e)) & STATE_GUI_CHECKED) != 0)
+    
+    // a checkbox toggles on each click, and keeps its flag when disabled
+    state_machine *c = state_machine_new_gui_checkbox();
+    TEST_FATAL(c);
+    
+    unsigned int s = STATE_GUI_CHECKBOX_DEFAULT;
+    TEST((s = state_machine_take_action(c, s, ACTION_GUI_ACCELERATOR)));
+    TEST(s & STATE_GUI_CHECKED);
+    TEST((s = state_machine_take_action(c, s, ACTION_GUI_CONTINUE)));
+    TEST(s & STATE_GUI_CHECKED);
+    TEST((s = state_machine_take_action(c, s, ACTION_GUI_KEY_DOWN)));
+    TEST((s = state_machine_take_action(c, s, ACTION_GUI_KEY_UP)));
+    TEST(s & STATE_GUI_UNCHECKED);
+    TEST((s = state_machine_take_action(c, s, ACTION_GUI_DISABLE)));
+    TEST((s = state_machine_take_action(c, s, ACTION_GUI_CHECK)));
+    TEST(s == (STATE_GUI_DISABLED | STATE_GUI_NOT_HOVERED | STATE_GUI_UNFOCUSED
+        | STATE_GUI_INACTIVE | STATE_GUI_NOT_CLICKED | STATE_GUI_CHECKED));
+    TEST(!state_machine_take_action(c, s, ACTION_GUI_CHECK));
+    state_machine_free(c);
+    
+    // a radio button stays checked when clicked again
+    state_machine *m = state_machine_new_gui_radio();
+    state_machine_population *p = state_machine_population_new(m, 12, STATE_GUI_CHECKBOX_DEFAULT);
+    state_machine_gui_radio *r = state_machine_gui_radio_new(p, 2);
+    TEST_FATAL(m && p && r);
+    
+    for (unsigned int i = 0; i < 10; i++) { TEST(state_machine_gui_radio_join(r, i, i % 2)); }
+    TEST(state_machine_gui_radio_holder(r, 0) == STATE_MACHINE_INVALID);
+    
+    state_machine_event events[] =
+    {
+        {2, ACTION_GUI_ACCELERATOR}, {2, ACTION_GUI_CONTINUE},
+        {3, ACTION_GUI_CHECK},
+        {4, ACTION_GUI_ACCELERATOR}, {4, ACTION_GUI_CONTINUE},
+        {4, ACTION_GUI_ACCELERATOR}, {4, ACTION_GUI_CONTINUE},
+        {10, ACTION_GUI_CHECK}, {11, ACTION_GUI_CHECK}, // in no group
+    };
+    
+    TEST(state_machine_gui_radio_dispatch(r, events, sizeof(events) / sizeof(events[0])) == 9);
+    TEST(state_machine_gui_radio_holder(r, 0) == 4);
+    TEST(state_machine_gui_radio_holder(r, 1) == 3);
+    TEST(!CHECKED(2) && CHECKED(3) && CHECKED(4) && CHECKED(10) && CHECKED(11));
+    
+    unsigned int checked = 0;
+    for (unsigned int i = 0; i < 10; i++) { checked += CHECKED(i); }
+    TEST(checked == 2);
+    
+    TEST(state_machine_gui_radio_take_action(r, 4, ACTION_GUI_UNCHECK));
+    TEST(state_machine_gui_radio_holder(r, 0) == STATE_MACHINE_INVALID);
+    
+    // joining a group that already has a checked member unchecks the element
+    TEST(state_machine_gui_radio_join(r, 10, 1));
+    TEST(!CHECKED(10) && CHECKED(3));
+    TEST(state_machine_gui_radio_join(r, 11, 0));
+    TEST(state_machine_gui_radio_holder(r, 0) == 11);
+    TEST(!state_machine_gui_radio_join(r, 11, 2));
+    
+    state_machine_gui_radio_free(r);
+    state_machine_population_free(p);
+    state_machine_free(m);
+    
+    #undef CHECKED
+    
+    END;
+}
+
+
+int test_state_machine_registry(void)
+{
+    START;
+    
+    state_machine *machines[3] =
+    {
+        state_machine_new_gui_button(),
+        state_machine_new_gui_checkbox(),
+        state_machine_new_gui_radio(),
+    };
+    
+    for (unsigned int t = 0; t < 3; t++) { TEST_FATAL(machines[t]); }
+    
+    state_machine_registry *r = state_machine_registry_new(machines, 3);
+    TEST_FATAL(r);
+    
+    // a mixed population, tracked alongside by state ID in each machine
+    const unsigned int initial[3] =
+        { STATE_GUI_BUTTON_DEFAULT, STATE_GUI_CHECKBOX_DEFAULT, STATE_GUI_CHECKBOX_DEFAULT };
+    
+    state_machine_registry_element elements[9];
+    unsigned int expected[9];
+    
+    for (unsigned int i = 0; i < 9; i++)
+    {
+        TEST(state_machine_registry_element_init(r, &elements[i], i % 3, initial[i % 3]));
+        TEST(state_machine_registry_state(r, &elements[i]) == initial[i % 3]);
+        expected[i] = initial[i % 3];
+    }
+    
+    state_machine_event events[2000];
+    unsigned int seed = 7;
+    
+    for (unsigned int i = 0; i < 2000; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        events[i].element = (seed >> 8) % 9;
+        events[i].action  = (seed >> 16) % NUM_ACTIONS_GUI;
+    }
+    
+    size_t taken = 0;
+    
+    for (unsigned int i = 0; i < 2000; i++)
+    {
+        unsigned int e = events[i].element;
+        unsigned int to = state_machine_take_action(machines[e % 3], expected[e], events[i].action);
+        if (to) { expected[e] = to; taken++; }
+    }
+    
+    TEST(taken > 0);
+    TEST(state_machine_registry_dispatch(r, elements, 9, events, 2000) == taken);
+    
+    unsigned int same = 1;
+    for (unsigned int i = 0; i < 9; i++)
+        { same &= (state_machine_registry_state(r, &elements[i]) == expected[i]); }
+    TEST(same);
+    
+    // one element at a time agrees with the machine too
+    unsigned int to = state_machine_take_action(machines[1], expected[1], ACTION_GUI_CHECK);
+    TEST(state_machine_registry_take_action(r, &elements[1], ACTION_GUI_CHECK) == to);
+    TEST(state_machine_registry_state(r, &elements[1]) == (to ? to : expected[1]));
+    
+    // invalid arguments
+    state_machine_registry_element bad = { 3, 0 };
+    state_machine_event stop[3] = { { 0, ACTION_GUI_CHECK }, { 9, 0 }, { 1, 0 } };
+    
+    TEST(!state_machine_registry_element_init(r, &elements[0], 3, initial[0]));
+    TEST(!state_machine_registry_element_init(r, &elements[0], 0, 0));
+    TEST(!state_machine_registry_element_init(r, &elements[0], 0, STATE_GUI_CHECKBOX_DEFAULT));
+    TEST(!state_machine_registry_state(r, &bad));
+    TEST(!state_machine_registry_take_action(r, &bad, 0));
+    TEST(!state_machine_registry_take_action(r, &elements[0], NUM_ACTIONS_GUI));
+    TEST(state_machine_registry_dispatch(r, elements, 9, stop, 3) <= 1);
+    TEST(!state_machine_registry_dispatch(r, NULL, 9, events, 1));
+    TEST(!state_machine_registry_new(NULL, 3));
+    
+    // as are elements whose type or state is out of range
+    state_machine_registry_element stale[2] = { { 0, 0 }, { 0, 1u << 20 } };
+    state_machine_event on_stale[2] = { { 1, ACTION_GUI_MOUSE_ENTER }, { 0, ACTION_GUI_MOUSE_ENTER } };
+    TEST(state_machine_registry_dispatch(r, stale, 2, on_stale, 2) == 0);
+    TEST(stale[0].state == 0);
+    TEST(state_machine_registry_dispatch(r, &bad, 1, on_stale + 1, 1) == 0);
+    
+    // each state ID of each type is found at its index in the machine
+    unsigned int found = 1;
+    
+    for (unsigned int t = 0; t < 3; t++)
+    {
+        for (unsigned int i = 0; i < state_machine_states(machines[t]); i++)
+        {
+            unsigned int id = state_machine_state_id(machines[t], i);
+            if (!id) { continue; }
+            
+            state_machine_registry_element e;
+            found &= state_machine_registry_element_init(r, &e, t, id)
+                && (e.state == state_machine_state_index(machines[t], id));
+        }
+    }
+    
+    TEST(found);
+    
+    // including when states were added out of order
+    state_machine *unordered = state_machine_new(5, NUM_ACTIONS_GUI);
+    TEST_FATAL(unordered);
+    
+    const unsigned int ids[] = { 40, 7, 1023, 1 };
+    for (unsigned int i = 0; i < 4; i++) { TEST(state_machine_add_state(unordered, ids[i])); }
+    
+    state_machine *pair[2] = { machines[0], unordered };
+    state_machine_registry *r2 = state_machine_registry_new(pair, 2);
+    TEST_FATAL(r2);
+    
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        state_machine_registry_element e;
+        TEST(state_machine_registry_element_init(r2, &e, 1, ids[i]));
+        TEST((e.type == 1) && (e.state == i));
+    }
+    
+    state_machine_registry_element e2;
+    TEST(!state_machine_registry_element_init(r2, &e2, 1, 8));
+    TEST(!state_machine_registry_element_init(r2, &e2, 1, 2000));
+    
+    state_machine_registry_free(r2);
+    state_machine_free(unordered);
+    
+    state_machine *other = state_machine_new(2, NUM_ACTIONS_GUI + 1);
+    TEST_FATAL(other);
+    state_machine *mismatched[2] = { machines[0], other };
+    TEST(!state_machine_registry_new(mismatched, 2));
+    
+    // the registry is a snapshot, independent of the machines
+    for (unsigned int t = 0; t < 3; t++) { state_machine_free(machines[t]); }
+    TEST(state_machine_registry_state(r, &elements[2]) == expected[2]);
+    
+    state_machine_free(other);
+    state_machine_registry_free(r);
+    
+    END;
+}
+
+
+int test_state_machine_population_query(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    state_machine_population *p = state_machine_population_new(m, 500, STATE_GUI_BUTTON_DEFAULT);
+    TEST_FATAL(m && p);
+    
+    static unsigned int found[500];
+    static unsigned char seen[500];
+    
+    const unsigned int masks[] =
+        { 0, STATE_GUI_FOCUSED, STATE_GUI_CLICKED, STATE_GUI_HOVERED | STATE_GUI_ACTIVE, STATE_GUI_DISABLED };
+    
+    unsigned int seed = 12345;
+    
+    for (unsigned int round = 0; round < 20; round++)
+    {
+        for (unsigned int i = 0; i < 1000; i++)
+        {
+            seed = (seed * 1103515245u) + 12345u;
+            unsigned int element = (seed >> 8) % 500;
+            unsigned int action  = (seed >> 20) % NUM_ACTIONS_GUI;
+            
+            state_machine_event event = {element, action};
+            
+            if (i % 2) { state_machine_population_take_action(p, element, action); }
+            else       { state_machine_population_dispatch(p, &event, 1); }
+        }
+        
+        if (round == 10) { TEST(state_machine_population_set_state(p, 3, STATE_GUI_BUTTON_DEFAULT)); }
+        
+        for (size_t k = 0; k < sizeof(masks) / sizeof(masks[0]); k++)
+        {
+            size_t n = state_machine_population_query(p, masks[k], found, 500);
+            size_t expect = 0;
+            
+            memset(seen, 0, sizeof(seen));
+            for (size_t i = 0; (i < n) && (i < 500); i++) { seen[found[i]]++; }
+            
+            for (unsigned int e = 0; e < 500; e++)
+            {
+                int match = ((state_machine_population_state(p, e) & masks[k]) == masks[k]);
+                expect += (size_t) match;
+                if (seen[e] != match) { TEST(seen[e] == match); break; }
+            }
+            
+            TEST(n == expect);
+            
+            // the count is returned even without space for the elements
+            TEST(state_machine_population_query(p, masks[k], NULL, 0) == expect);
+        }
+    }
+    
+    // iterate over one state
+    unsigned int in_default = 0;
+    for (unsigned int e = state_machine_population_first(p, STATE_GUI_BUTTON_DEFAULT);
+        e != STATE_MACHINE_INVALID; e = state_machine_population_next(p, e))
+    {
+        TEST(state_machine_population_state(p, e) == STATE_GUI_BUTTON_DEFAULT);
+        in_default++;
+    }
+    
+    unsigned int expect_default = 0;
+    for (unsigned int e = 0; e < 500; e++)
+        { expect_default += (state_machine_population_state(p, e) == STATE_GUI_BUTTON_DEFAULT); }
+    TEST(in_default == expect_default);
+    
+    state_machine_population_free(p);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_population_census(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new(3, 3);
+    TEST_FATAL(m);
+    TEST(state_machine_add_state(m, 1));
+    TEST(state_machine_add_state(m, 2));
+    TEST(state_machine_add_state(m, 6));
+    TEST(state_machine_add_transition(m, 0, 1, 2));
+    TEST(state_machine_add_transition(m, 1, 2, 6));
+    TEST(state_machine_add_transition(m, 2, 6, 1));
+    
+    state_machine_population *p = state_machine_population_new(m, 100, 1);
+    TEST_FATAL(p);
+    
+    state_machine_event events[] = { {0, 0}, {1, 0}, {2, 0}, {1, 1}, {2, 1}, {2, 2}, {3, 1} };
+    TEST(state_machine_population_dispatch(p, events, sizeof(events) / sizeof(events[0])) == 6);
+    TEST(state_machine_population_take_action(p, 4, 0));
+    TEST(state_machine_population_set_state(p, 5, 6));
+    
+    unsigned int counts[4] = {0, 0, 0, 99};
+    TEST(state_machine_population_census(p, counts, 4) == 3);
+    TEST((counts[0] == 96) && (counts[1] == 2) && (counts[2] == 2) && (counts[3] == 99));
+    TEST(state_machine_population_census(p, counts, 1) == 3);
+    
+    TEST(state_machine_population_count(p, 0) == 100);
+    TEST(state_machine_population_count(p, 2) == 4);
+    TEST(state_machine_population_count(p, 4) == 2);
+    
+    const char *states[] = { "one", NULL, "six" };
+    const char *actions[] = { "a", "b", "c" };
+    
+    test_print_buffer b;
+    b.used = 0;
+    
+    TEST(state_machine_population_print_census(test_print_write, &b, p, "g", states, actions, NULL, 0));
+    TEST(strstr(b.data, "\"one (96)\" -> \"1 (2)\""));
+    TEST(strstr(b.data, "\"six (2)\" -> \"one (96)\""));
+    
+    state_machine_population_free(p);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_payload(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    TEST_FATAL(m);
+    
+    unsigned int states = state_machine_states(m);
+    
+    // give every other state the same payload, so that the rows layout must
+    // tell apart states with equal transitions but different payloads
+    for (unsigned int i = 0; i < states; i++)
+    {
+        unsigned int id = state_machine_state_id(m, i);
+        if (id) { TEST(state_machine_set_payload(m, id, (i % 2) ? 1000 + i : 7)); }
+    }
+    
+    unsigned int payload = 0;
+    unsigned int to = state_machine_take_action_payload(m, STATE_GUI_BUTTON_DEFAULT, ACTION_GUI_MOUSE_ENTER, &payload);
+    TEST(to);
+    TEST(payload == state_machine_payload(m, to));
+    TEST(payload == state_machine_payload_index(m, state_machine_state_index(m, to)));
+    TEST(!state_machine_set_payload(m, 3, 1)); // not a state
+    
+    const int layouts[] =
+    {
+        STATE_MACHINE_LAYOUT_DENSE, STATE_MACHINE_LAYOUT_SPARSE,
+        STATE_MACHINE_LAYOUT_ROWS, STATE_MACHINE_LAYOUT_DEFAULTS
+    };
+    
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++)
+    {
+        state_machine *f = state_machine_freeze(m, layouts[l]);
+        TEST_FATAL(f);
+        TEST(test_same_transitions(m, f));
+        TEST(!state_machine_set_payload(f, STATE_GUI_BUTTON_DEFAULT, 1));
+        
+        for (unsigned int i = 0; i < states; i++)
+        {
+            if (state_machine_payload_index(f, i) != state_machine_payload_index(m, i))
+                { TEST(state_machine_payload_index(f, i) == state_machine_payload_index(m, i)); break; }
+            
+            for (unsigned int a = 0; a < NUM_ACTIONS_GUI; a++)
+            {
+                unsigned int from = state_machine_state_id(m, i);
+                if (!from) { continue; }
+                
+                unsigned int expect = 0, got = 0;
+                state_machine_take_action_payload(m, from, a, &expect);
+                state_machine_take_action_payload(f, from, a, &got);
+                if (got != expect) { TEST(got == expect); break; }
+            }
+        }
+        
+        state_machine_free(f);
+    }
+    
+    // payloads are saved and loaded
+    test_trace_buffer b;
+    b.used = 0;
+    
+    TEST_FATAL(state_machine_save(test_trace_write, &b, m));
+    
+    state_machine *loaded = state_machine_load(b.data, b.used);
+    TEST_FATAL(loaded);
+    
+    for (unsigned int i = 0; i < states; i++)
+        { TEST(state_machine_payload_index(loaded, i) == state_machine_payload_index(m, i)); }
+    
+    TEST(!state_machine_load(b.data, b.used - 1));
+    
+    // clearing a machine clears its payloads
+    TEST(state_machine_clear(m));
+    TEST(state_machine_add_state(m, STATE_GUI_BUTTON_DEFAULT));
+    TEST(state_machine_payload(m, STATE_GUI_BUTTON_DEFAULT) == 0);
+    
+    state_machine_free(loaded);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+int test_state_machine_clone(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    TEST_FATAL(m);
+    
+    // variants that each change what the accelerator does in one state
+    state_machine *variants[100];
+    size_t memory = 0;
+    
+    const unsigned int from = STATE_GUI_BUTTON_DEFAULT;
+    const unsigned int to = state_machine_take_action(m, from, ACTION_GUI_MOUSE_ENTER);
+    const state_machine_rule accel = STATE_MACHINE_RULE_FROM_ALL_STATES(ACTION_GUI_ACCEL, to, 0);
+    
+    for (unsigned int i = 0; i < 100; i++)
+    {
+        variants[i] = state_machine_clone_cow(m);
+        TEST_FATAL(variants[i]);
+        TEST(state_machine_layout(variants[i]) == STATE_MACHINE_LAYOUT_CLONE);
+        TEST(test_same_transitions(m, variants[i]));
+        
+        if (i % 2) { TEST(state_machine_add_transition(variants[i], ACTION_GUI_ACCEL, from, to)); }
+        memory += state_machine_memory(variants[i]);
+    }
+    
+    TEST(memory < 100 * state_machine_memory(m) / 2);
+    
+    TEST(state_machine_take_action(variants[1], from, ACTION_GUI_ACCEL) == to);
+    TEST(state_machine_take_action(variants[0], from, ACTION_GUI_ACCEL) != to);
+    TEST(state_machine_take_action(m, from, ACTION_GUI_ACCEL) != to);
+    
+    // writing twice to a row copies it once
+    size_t before = state_machine_memory(variants[1]);
+    TEST(state_machine_add_transition(variants[1], ACTION_GUI_SCROLL, from, to));
+    TEST(state_machine_set_payload(variants[1], from, 5));
+    TEST(state_machine_memory(variants[1]) == before);
+    TEST(state_machine_payload(m, from) == 0);
+    
+    // the shared parts cannot change while shared
+    TEST(!state_machine_add_state(variants[0], 3));
+    TEST(!state_machine_clear(variants[0]));
+    TEST(!state_machine_add_transition(m, ACTION_GUI_ACCEL, from, to));
+    TEST(!state_machine_add_transition_from_all_states(m, ACTION_GUI_ACCEL, to, 0));
+    TEST(!state_machine_add_rules(m, &accel, 1));
+    TEST(!state_machine_add_transition_from_all_states_replacing(m, ACTION_GUI_ACCEL, 0, 0, 0));
+    TEST(!state_machine_clear(m));
+    
+    // a frozen clone is independent of the original
+    state_machine *frozen = state_machine_freeze(variants[1], STATE_MACHINE_LAYOUT_DENSE);
+    TEST_FATAL(frozen);
+    TEST(test_same_transitions(variants[1], frozen));
+    TEST(state_machine_payload(frozen, from) == 5);
+    
+    TEST(!state_machine_add_transition_from_all_states(frozen, ACTION_GUI_ACCEL, to, 0));
+    TEST(!state_machine_add_rules(frozen, &accel, 1));
+    TEST(!state_machine_add_transition_from_all_states_replacing(frozen, ACTION_GUI_ACCEL, 0, 0, 0));
+    
+    // other layouts cannot be cloned
+    state_machine *sparse = state_machine_freeze(m, STATE_MACHINE_LAYOUT_SPARSE);
+    TEST_FATAL(sparse);
+    TEST(!state_machine_clone_cow(sparse));
+    
+    for (unsigned int i = 0; i < 100; i++) { state_machine_free(variants[i]); }
+    
+    TEST(state_machine_add_transition(m, ACTION_GUI_ACCEL, from, to));
+    
+    // clones of aligned machines copy rows with the same alignment
+    state_machine *aligned = state_machine_new_aligned(4, 20, NULL);
+    TEST_FATAL(aligned);
+    TEST(state_machine_add_state(aligned, 1));
+    TEST(state_machine_add_state(aligned, 2));
+    
+    state_machine *aligned_clone = state_machine_clone_cow(aligned);
+    TEST_FATAL(aligned_clone);
+    TEST(state_machine_add_transition(aligned_clone, 19, 1, 2));
+    TEST(state_machine_take_action(aligned_clone, 1, 19) == 2);
+    TEST(state_machine_take_action(aligned, 1, 19) == 0);
+    
+    state_machine_free(aligned_clone);
+    state_machine_free(aligned);
+    state_machine_free(sparse);
+    state_machine_free(frozen);
+    state_machine_free(m);
+    
+    END;
+}
+
+
+// A machine with a state for every combination of 14 flags
+static state_machine *test_flags_machine(int aligned)
+{
+    state_machine *m = aligned ? state_machine_new_aligned(1u << 14, 40, NULL)
+                               : state_machine_new(1u << 14, 40);
+    if (!m) { return NULL; }
+    
+    for (unsigned int i = 0; i < (1u << 14); i++)
+    {
+        if (!state_machine_add_state(m, (i << 1) | 1)) { state_machine_free(m); return NULL; }
+    }
+    
+    return m;
+}
+
+
+int test_state_machine_add_rules_parallel(void)
+{
+    START;
+    
+    state_machine_rule rules[200];
+    unsigned int seed = 1;
+    
+    for (unsigned int i = 0; i < 200; i++)
+    {
+        unsigned int r[4];
+        for (unsigned int k = 0; k < 4; k++) { seed = seed * 1103515245u + 12345u; r[k] = seed >> 8; }
+        
+        // a few flags to match, and targets that are always states
+        rules[i].action  = i % 40;
+        rules[i].mask    = (r[0] & r[1] & 0x7ffe) | 1;
+        rules[i].match   = (rules[i].mask & r[2]) | 1;
+        rules[i].replace = r[3] & 0x7ffe;
+        rules[i].with    = r[2] & r[3] & 0x7ffe;
+    }
+    
+    state_machine *serial = test_flags_machine(0);
+    TEST_FATAL(serial);
+    TEST(state_machine_add_rules(serial, rules, 200));
+    
+    const unsigned int threads[] = {1, 2, 3, 8, 0};
+    
+    for (unsigned int t = 0; t < 5; t++)
+    {
+        state_machine *m = test_flags_machine(t % 2);
+        TEST_FATAL(m);
+        TEST(state_machine_add_rules_parallel(m, rules, 200, threads[t]));
+        TEST(test_same_transitions(serial, m));
+        state_machine_free(m);
+    }
+    
+    // a bad action is found before any rule is applied
+    state_machine *m = test_flags_machine(0);
+    TEST_FATAL(m);
+    rules[100].action = 40;
+    TEST(!state_machine_add_rules_parallel(m, rules, 200, 4));
+    TEST(state_machine_take_action(m, 1, rules[0].action) == 0);
+    rules[100].action = 0;
+    
+    // as does a target that is not a state
+    rules[100].with = 1u << 20;
+    TEST(!state_machine_add_rules_parallel(m, rules, 200, 4));
+    TEST(!state_machine_add_rules(m, rules, 200));
+    
+    // small machines and clones are built by one thread
+    state_machine *button = state_machine_new_gui_button();
+    TEST_FATAL(button);
+    state_machine *clone = state_machine_clone_cow(button);
+    TEST_FATAL(clone);
+    
+    state_machine_rule accel = STATE_MACHINE_RULE_FROM_ALL_STATES
+        (ACTION_GUI_ACCEL, STATE_GUI_BUTTON_DEFAULT, STATE_GUI_BUTTON_DEFAULT);
+    TEST(state_machine_add_rules_parallel(clone, &accel, 1, 0));
+    TEST(state_machine_take_action(clone, STATE_GUI_BUTTON_DEFAULT, ACTION_GUI_ACCEL)
+        == STATE_GUI_BUTTON_DEFAULT);
+    TEST(!state_machine_add_rules_parallel(button, &accel, 1, 0));
+    
+    state_machine_free(clone);
+    TEST(state_machine_add_rules_parallel(button, &accel, 1, 0));
+    
+    state_machine_free(button);
+    state_machine_free(m);
+    state_machine_free(serial);
+    
+    END;
+}
+
+
+int test_state_machine_timing(void)
+{
+    START;
+    
+    unsigned int loops = 0;
+    
+#   ifdef BSE_TIMING
+        bse_timing_reset();
+#   endif
+    
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        T_SCOPE(test_state_machine_timing);
+        
+        loops++;
+        if (i == 1) { continue; } // leaving the scope early still counts
+    }
+    
+    TEST(loops == 3);
+    
+    state_machine *m = state_machine_new_gui_button();
+    TEST_FATAL(m);
+    state_machine_free(m);
+    
+#   ifdef BSE_TIMING
+        bse_timing_site *site = bse_timing_find("test_state_machine_timing");
+        TEST_FATAL(site);
+        TEST(site->calls == 3);
+        TEST(site->max <= site->total);
+        
+        unsigned long long histogram = 0;
+        for (unsigned int i = 0; i < BSE_TIMING_BUCKETS; i++) { histogram += site->buckets[i]; }
+        TEST(histogram == 3);
+        
+        site = bse_timing_find("state_machine_new_using");
+        TEST_FATAL(site);
+        TEST(site->calls >= 1);
+        
+        char *text = NULL;
+        size_t size = 0;
+        FILE *stream = open_memstream(&text, &size);
+        TEST_FATAL(stream);
+        bse_timing_report(stream);
+        fclose(stream);
+        
+        TEST(strstr(text, "test_state_machine_timing"));
+        TEST(strstr(text, "calls: 3"));
+        free(text);
+        
+        bse_timing_reset();
+        TEST(bse_timing_find("test_state_machine_timing")->calls == 0);
+#   endif
+    
+    END;
+}
+
+
+#ifdef BSE_ASYNC_EXCEPTIONS
+
+#include <pthread.h>
+
+static void *test_async_raise(void *arg)
+{
+    state_machine *m = (state_machine *) arg;
+    
+    // every call raises an exception for an invalid state
+    for (unsigned int i = 0; i < 2000; i++) { state_machine_take_action(m, 12345, 0); }
+    
+    return NULL;
+}
+
+
+int test_state_machine_async_exceptions(void)
+{
+    START;
+    
+    state_machine *m = state_machine_new_gui_button();
+    TEST_FATAL(m);
+    
+    FILE *stream = tmpfile();
+    TEST_FATAL(stream);
+    
+    TEST(bse_async_exceptions_start(stream));
+    TEST(!bse_async_exceptions_start(stream));
+    
+    // TEST prints unless quiet, so nothing is tested until quiet again
+    int quiet = bse_quiet_exceptions;
+    bse_quiet_exceptions = 0;
+    
+    // messages are copied, not referenced
+    char msg[32] = "copied message";
+    W3(msg, 0, 7);
+    memcpy(msg, "overwritten", sizeof("overwritten"));
+    
+    pthread_t threads[4];
+    unsigned int started = 0;
+    
+    for (; started < 4; started++)
+    {
+        if (pthread_create(&threads[started], NULL, test_async_raise, m)) { break; }
+    }
+    
+    for (unsigned int i = 0; i < started; i++) { pthread_join(threads[i], NULL); }
+    
+    bse_quiet_exceptions = quiet;
+    
+    TEST(started == 4);
+    
+    unsigned long dropped = bse_async_exceptions_stop();
+    TEST(dropped <= 4 * 2000 + 1);
+    TEST(!bse_async_exceptions_stop());
+    
+    // every message was either written or counted as dropped
+    char line[256];
+    unsigned long written = 0, reported = 0, copied = 0;
+    rewind(stream);
+    
+    while (fgets(line, sizeof(line), stream))
+    {
+        unsigned long n = 0;
+        if (strstr(line, "Exception 'err_bad_arg'")) { written++; }
+        if (strstr(line, "'copied message', 7")) { copied++; }
+        if (sscanf(line, PROG_ID ": %lu errors and warnings dropped", &n) == 1)
+            { reported += n; }
+    }
+    
+    fclose(stream);
+    
+    TEST(written + dropped == 4 * 2000 + (copied ? 0 : 1));
+    TEST(reported == dropped);
+    
+    state_machine_free(m);
+    
+    END;
+}
+
+#endif